@@ -19,7 +19,8 @@ class Client(ctypes.Structure):
     _fields_ = [
         ("sockfd", ctypes.c_int),
         ("server_addr", sockaddr_in),      # FIXED: proper structure
-        ("is_connected", ctypes.c_int)
+        ("is_connected", ctypes.c_int),
+        ("is_local", ctypes.c_int)         # using the server's Unix socket
     ]
 
 client = Client()
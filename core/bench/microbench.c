@@ -0,0 +1,457 @@
+/*
+ * Microbenchmarks for the protocol and data-path kernels.
+ *
+ * Every case is calibrated to run for about BENCH_TARGET_NS per repetition,
+ * repeated BENCH_REPS times on a pinned CPU; the median and minimum ns/op
+ * are reported as JSON. With --compare, medians are checked against a
+ * previously saved run and slower cases are flagged as regressions.
+ *
+ *   microbench [--cpu N] [--out FILE] [--compare BASELINE] [--threshold PCT] [--filter SUBSTR]
+ */
+#define _GNU_SOURCE
+#include "common.h"
+#include "protocol.h"
+#include "md5.h"
+#include "delta.h"
+#include <sched.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define BENCH_TARGET_NS   (100 * 1000 * 1000ULL)  /* per repetition */
+#define BENCH_REPS        7
+#define BENCH_MAX_CASES   64
+#define BENCH_BULK_SIZE   (1024 * 1024)
+#define BENCH_THRESHOLD   10.0                    /* default regression threshold, % */
+
+typedef struct {
+    const char *name;
+    size_t bytes;            /* bytes processed per op, 0 if not a throughput case */
+    void (*setup)(void);
+    void (*run)(uint64_t iters);
+    void (*teardown)(void);
+} BenchCase;
+
+typedef struct {
+    char name[64];
+    uint64_t iters;
+    double median_ns;
+    double min_ns;
+    double mb_per_s;
+} BenchResult;
+
+static int bench_cpu = 0;
+
+/* Keeps results of the measured code alive without adding work */
+static volatile uint64_t sink;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+/* Helper threads (socket peers) go on the next CPU when there is one */
+static void pin_peer(void) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    pin_to_cpu(ncpu > 1 ? (int)((bench_cpu + 1) % ncpu) : bench_cpu);
+}
+
+/* ================================
+ * Packet encode / decode
+ * ================================ */
+
+static const char *sample_header = "testuser:quarterly-report-final.pdf:1048576";
+
+static void run_init_packet(uint64_t iters) {
+    Packet p;
+    for (uint64_t i = 0; i < iters; i++) {
+        init_packet(&p, CMD_UPLOAD, sample_header);
+        sink += p.data_length;
+    }
+}
+
+static void run_command_to_string(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++)
+        sink += (uint64_t)(uintptr_t)command_to_string((uint32_t)(i % 14));
+}
+
+static int pair[2] = { -1, -1 };
+
+static void setup_socketpair(void) {
+    socketpair(AF_UNIX, SOCK_STREAM, 0, pair);
+}
+
+static void teardown_socketpair(void) {
+    close(pair[0]);
+    close(pair[1]);
+    pair[0] = pair[1] = -1;
+}
+
+/* One small packet through a socketpair: send on one end, receive on the
+ * other. Small enough to never block, so it stays single-threaded. */
+static void run_packet_roundtrip(uint64_t iters) {
+    Packet out, in;
+    init_packet(&out, CMD_UPLOAD, sample_header);
+    for (uint64_t i = 0; i < iters; i++) {
+        send_packet(pair[0], &out);
+        recv_packet(pair[1], &in);
+        sink += in.data_length;
+    }
+}
+
+/* ================================
+ * Header parsing
+ * ================================ */
+
+static void run_parse_upload_header(uint64_t iters) {
+    char user[USERNAME_LEN], filename[FILE_NAME_LEN];
+    size_t filesize;
+    for (uint64_t i = 0; i < iters; i++) {
+        if (sscanf(sample_header, "%63[^:]:%255[^:]:%zu", user, filename, &filesize) == 3)
+            sink += filesize;
+    }
+}
+
+static void run_parse_size_ack(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++)
+        sink += strtoull("1048576", NULL, 10);
+}
+
+/* ================================
+ * Payload transforms
+ * ================================ */
+
+#define KERNEL_BUF (64 * 1024)
+static unsigned char *kbuf;
+static uint32_t *kweak;
+static uint16_t *kscratch;
+
+static void setup_kernel_buf(void) {
+    kbuf = malloc(KERNEL_BUF + DELTA_MIN_BLOCK);
+    kweak = malloc(KERNEL_BUF * sizeof(uint32_t));
+    kscratch = malloc(2 * (KERNEL_BUF + DELTA_MIN_BLOCK + 1) * sizeof(uint16_t));
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < KERNEL_BUF + DELTA_MIN_BLOCK; i++) {
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        kbuf[i] = (unsigned char)x;
+    }
+}
+
+static void teardown_kernel_buf(void) {
+    free(kbuf);
+    free(kweak);
+    free(kscratch);
+}
+
+static void run_xor_crypt(uint64_t iters) {
+    static const unsigned char key[] = "localbin-key";
+    for (uint64_t i = 0; i < iters; i++)
+        xor_crypt(kbuf, KERNEL_BUF, key, sizeof(key) - 1);
+    sink += kbuf[0];
+}
+
+static void run_md5(uint64_t iters) {
+    unsigned char digest[MD5_DIGEST_LEN];
+    for (uint64_t i = 0; i < iters; i++) {
+        md5_digest(kbuf, KERNEL_BUF, digest);
+        sink += digest[0];
+    }
+}
+
+static void run_fnv1a64(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++)
+        sink += fnv1a64(kbuf, KERNEL_BUF, FNV64_OFFSET);
+}
+
+static void run_weak_sum(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++)
+        sink += delta_weak_sum(kbuf, KERNEL_BUF);
+}
+
+/* KERNEL_BUF consecutive windows of DELTA_MIN_BLOCK bytes */
+static void run_weak_sums(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++) {
+        delta_weak_sums(kbuf, KERNEL_BUF, DELTA_MIN_BLOCK, kweak, kscratch);
+        sink += kweak[KERNEL_BUF - 1];
+    }
+}
+
+/* ================================
+ * Bulk send/recv loops
+ * ================================ */
+
+/* A peer thread drains everything sent to its socket */
+static int bulk_tx = -1, bulk_rx = -1;
+static pthread_t bulk_peer;
+static unsigned char *bulk_buf;
+
+static void *bulk_drain(void *arg) {
+    UNUSED(arg);
+    pin_peer();
+    unsigned char *buf = malloc(BENCH_BULK_SIZE);
+    while (recv(bulk_rx, buf, BENCH_BULK_SIZE, 0) > 0)
+        ;
+    free(buf);
+    return NULL;
+}
+
+static void start_bulk_peer(void) {
+    bulk_buf = malloc(BENCH_BULK_SIZE);
+    memset(bulk_buf, 0x5a, BENCH_BULK_SIZE);
+    pthread_create(&bulk_peer, NULL, bulk_drain, NULL);
+}
+
+static void setup_bulk_socketpair(void) {
+    int sv[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    bulk_tx = sv[0];
+    bulk_rx = sv[1];
+    start_bulk_peer();
+}
+
+static void setup_bulk_loopback(void) {
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t alen = sizeof(addr);
+    bind(lfd, (struct sockaddr*)&addr, sizeof(addr));
+    listen(lfd, 1);
+    getsockname(lfd, (struct sockaddr*)&addr, &alen);
+
+    bulk_tx = socket(AF_INET, SOCK_STREAM, 0);
+    int flag = 1;
+    setsockopt(bulk_tx, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    connect(bulk_tx, (struct sockaddr*)&addr, sizeof(addr));
+    bulk_rx = accept(lfd, NULL, NULL);
+    close(lfd);
+    start_bulk_peer();
+}
+
+static void teardown_bulk(void) {
+    shutdown(bulk_tx, SHUT_WR);
+    pthread_join(bulk_peer, NULL);
+    close(bulk_tx);
+    close(bulk_rx);
+    free(bulk_buf);
+    bulk_tx = bulk_rx = -1;
+}
+
+/* The old client upload loop: BUFFER_SIZE sends */
+static void run_send_4k(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++)
+        for (size_t off = 0; off < BENCH_BULK_SIZE; off += BUFFER_SIZE)
+            send_all(bulk_tx, bulk_buf + off, BUFFER_SIZE);
+}
+
+static void run_send_1m(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++)
+        send_all(bulk_tx, bulk_buf, BENCH_BULK_SIZE);
+}
+
+/* Receive side: the peer thread feeds, this thread runs recv_all */
+static void *bulk_feed(void *arg) {
+    UNUSED(arg);
+    pin_peer();
+    unsigned char *buf = malloc(BENCH_BULK_SIZE);
+    memset(buf, 0xa5, BENCH_BULK_SIZE);
+    while (send_all(bulk_rx, buf, BENCH_BULK_SIZE) == BENCH_BULK_SIZE)
+        ;
+    free(buf);
+    return NULL;
+}
+
+static void setup_recv_socketpair(void) {
+    int sv[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    bulk_tx = sv[0];     /* this thread reads from here */
+    bulk_rx = sv[1];     /* peer writes here */
+    bulk_buf = malloc(BENCH_BULK_SIZE);
+    pthread_create(&bulk_peer, NULL, bulk_feed, NULL);
+}
+
+static void teardown_recv(void) {
+    close(bulk_tx);      /* peer's next send fails and it exits */
+    pthread_join(bulk_peer, NULL);
+    close(bulk_rx);
+    free(bulk_buf);
+    bulk_tx = bulk_rx = -1;
+}
+
+static void run_recv_4k(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++)
+        for (size_t off = 0; off < BENCH_BULK_SIZE; off += BUFFER_SIZE)
+            recv_all(bulk_tx, bulk_buf + off, BUFFER_SIZE);
+}
+
+static void run_recv_1m(uint64_t iters) {
+    for (uint64_t i = 0; i < iters; i++)
+        recv_all(bulk_tx, bulk_buf, BENCH_BULK_SIZE);
+}
+
+static const BenchCase cases[] = {
+    { "packet.init",               0, NULL, run_init_packet, NULL },
+    { "packet.command_to_string",  0, NULL, run_command_to_string, NULL },
+    { "packet.roundtrip_socketpair", 0, setup_socketpair, run_packet_roundtrip, teardown_socketpair },
+    { "parse.upload_header",       0, NULL, run_parse_upload_header, NULL },
+    { "parse.size_ack",            0, NULL, run_parse_size_ack, NULL },
+    { "kernel.xor_crypt_64k",      KERNEL_BUF, setup_kernel_buf, run_xor_crypt, teardown_kernel_buf },
+    { "kernel.md5_64k",            KERNEL_BUF, setup_kernel_buf, run_md5, teardown_kernel_buf },
+    { "kernel.fnv1a64_64k",        KERNEL_BUF, setup_kernel_buf, run_fnv1a64, teardown_kernel_buf },
+    { "kernel.weak_sum_64k",       KERNEL_BUF, setup_kernel_buf, run_weak_sum, teardown_kernel_buf },
+    { "kernel.weak_sums_64k_windows", KERNEL_BUF, setup_kernel_buf, run_weak_sums, teardown_kernel_buf },
+    { "io.send_4k_socketpair",     BENCH_BULK_SIZE, setup_bulk_socketpair, run_send_4k, teardown_bulk },
+    { "io.send_1m_socketpair",     BENCH_BULK_SIZE, setup_bulk_socketpair, run_send_1m, teardown_bulk },
+    { "io.send_4k_loopback",       BENCH_BULK_SIZE, setup_bulk_loopback, run_send_4k, teardown_bulk },
+    { "io.send_1m_loopback",       BENCH_BULK_SIZE, setup_bulk_loopback, run_send_1m, teardown_bulk },
+    { "io.recv_4k_socketpair",     BENCH_BULK_SIZE, setup_recv_socketpair, run_recv_4k, teardown_recv },
+    { "io.recv_1m_socketpair",     BENCH_BULK_SIZE, setup_recv_socketpair, run_recv_1m, teardown_recv },
+};
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static void run_case(const BenchCase *bc, BenchResult *res) {
+    if (bc->setup) bc->setup();
+
+    /* Calibrate: double the count until one pass takes >= 1/10 of the target */
+    uint64_t iters = 1;
+    for (;;) {
+        uint64_t t0 = now_ns();
+        bc->run(iters);
+        uint64_t dt = now_ns() - t0;
+        if (dt >= BENCH_TARGET_NS / 10 || iters >= (1ULL << 40)) {
+            double per = (double)dt / (double)iters;
+            iters = per > 0 ? (uint64_t)((double)BENCH_TARGET_NS / per) : iters;
+            if (iters == 0) iters = 1;
+            break;
+        }
+        iters *= 2;
+    }
+
+    double samples[BENCH_REPS];
+    for (int r = 0; r < BENCH_REPS; r++) {
+        uint64_t t0 = now_ns();
+        bc->run(iters);
+        samples[r] = (double)(now_ns() - t0) / (double)iters;
+    }
+    qsort(samples, BENCH_REPS, sizeof(double), cmp_double);
+
+    if (bc->teardown) bc->teardown();
+
+    snprintf(res->name, sizeof(res->name), "%s", bc->name);
+    res->iters = iters;
+    res->median_ns = samples[BENCH_REPS / 2];
+    res->min_ns = samples[0];
+    res->mb_per_s = bc->bytes ? (double)bc->bytes / res->median_ns * 1e9 / (1024.0 * 1024.0) : 0;
+}
+
+static void write_json(FILE *out, const BenchResult *res, size_t n) {
+    char ts[64];
+    get_timestamp(ts, sizeof(ts));
+    fprintf(out, "{\n  \"timestamp\": \"%s\",\n  \"cpu\": %d,\n  \"reps\": %d,\n  \"results\": [\n",
+            ts, bench_cpu, BENCH_REPS);
+    /* One result per line: --compare reads these back line by line */
+    for (size_t i = 0; i < n; i++) {
+        fprintf(out, "    {\"name\": \"%s\", \"iters\": %llu, \"median_ns\": %.3f, "
+                     "\"min_ns\": %.3f, \"mb_per_s\": %.1f}%s\n",
+                res[i].name, (unsigned long long)res[i].iters, res[i].median_ns,
+                res[i].min_ns, res[i].mb_per_s, i + 1 < n ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+/* Returns the number of regressions, -1 if the baseline cannot be read */
+static int compare_baseline(const char *path, const BenchResult *res, size_t n, double threshold) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "microbench: cannot open baseline %s\n", path);
+        return -1;
+    }
+
+    int regressions = 0;
+    char line[512];
+    fprintf(stderr, "%-32s %12s %12s %8s\n", "case", "base ns/op", "now ns/op", "change");
+    while (fgets(line, sizeof(line), fp)) {
+        char name[64];
+        double base;
+        const char *p = strstr(line, "\"name\": \"");
+        const char *m = strstr(line, "\"median_ns\": ");
+        if (!p || !m) continue;
+        if (sscanf(p, "\"name\": \"%63[^\"]\"", name) != 1) continue;
+        if (sscanf(m, "\"median_ns\": %lf", &base) != 1 || base <= 0) continue;
+
+        for (size_t i = 0; i < n; i++) {
+            if (strcmp(res[i].name, name) != 0) continue;
+            double change = (res[i].median_ns - base) / base * 100.0;
+            int regressed = change > threshold;
+            regressions += regressed;
+            fprintf(stderr, "%-32s %12.1f %12.1f %+7.1f%%%s\n", name, base, res[i].median_ns,
+                    change, regressed ? "  REGRESSION" : "");
+        }
+    }
+    fclose(fp);
+    return regressions;
+}
+
+int main(int argc, char *argv[]) {
+    const char *out_path = NULL, *baseline = NULL, *filter = NULL;
+    double threshold = BENCH_THRESHOLD;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) bench_cpu = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) out_path = argv[++i];
+        else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) baseline = argv[++i];
+        else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) threshold = atof(argv[++i]);
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) filter = argv[++i];
+        else {
+            fprintf(stderr, "Usage: %s [--cpu N] [--out FILE] [--compare BASELINE] "
+                            "[--threshold PCT] [--filter SUBSTR]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    /* Socket peers are torn down by closing the other end */
+    signal(SIGPIPE, SIG_IGN);
+    pin_to_cpu(bench_cpu);
+
+    BenchResult res[BENCH_MAX_CASES];
+    size_t n = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]) && n < BENCH_MAX_CASES; i++) {
+        if (filter && !strstr(cases[i].name, filter)) continue;
+        run_case(&cases[i], &res[n]);
+        fprintf(stderr, "%-32s %12.1f ns/op\n", res[n].name, res[n].median_ns);
+        n++;
+    }
+
+    FILE *out = stdout;
+    if (out_path && !(out = fopen(out_path, "w"))) {
+        fprintf(stderr, "microbench: cannot write %s\n", out_path);
+        return 1;
+    }
+    write_json(out, res, n);
+    if (out != stdout) fclose(out);
+
+    if (baseline) {
+        int regressions = compare_baseline(baseline, res, n, threshold);
+        if (regressions < 0) return 1;
+        if (regressions > 0) {
+            fprintf(stderr, "microbench: %d case(s) more than %.1f%% slower than baseline\n",
+                    regressions, threshold);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -4,11 +4,76 @@
 #include <netdb.h>
 #include <string.h>
 #include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include "../common/delta.h"
+#include "../common/tcp_tune.h"
+#include "transfer.h"
+
+/* Offsets scanned per batch of vectorized weak checksums */
+#define DELTA_SCAN_WINDOW (256 * 1024)
+
+/* Receive chunk handed to streaming download sinks */
+#define CLIENT_STREAM_CHUNK (64 * 1024)
+
+/* Progress hook that feeds the TCP tuner, then calls the caller's hook */
+typedef struct {
+    TcpTune tune;
+    uint64_t last;
+    client_progress_fn progress;
+    void *arg;
+} TunedProgress;
+
+static void tuned_progress(uint64_t done, uint64_t total, void *arg) {
+    TunedProgress *tp = (TunedProgress*)arg;
+    tcp_tune_step(&tp->tune, (size_t)(done - tp->last));
+    tp->last = done;
+    if (tp->progress) tp->progress(done, total, tp->arg);
+}
+
+/* Same-host fast path: connect through the server's Unix socket instead of
+ * the loopback TCP stack (returns -1 to fall back to TCP) */
+static int connect_local(Client *c, const char *host, int port) {
+    const char *env = getenv(LOCAL_SOCKET_ENV);
+    if (env && strcmp(env, "0") == 0) return -1;
+    if (strcmp(host, "127.0.0.1") != 0 && strcmp(host, "localhost") != 0) return -1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    int n = snprintf(addr.sun_path, sizeof(addr.sun_path), LOCAL_SOCKET_FMT, port);
+    if (n < 0 || (size_t)n >= sizeof(addr.sun_path) || access(addr.sun_path, F_OK) != 0) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    struct timeval timeout = { 10, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    c->sockfd = fd;
+    c->server_addr.sin_family = AF_INET;
+    c->server_addr.sin_port = htons(port);
+    c->server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    c->is_connected = 1;
+    c->is_local = 1;
+
+    char msg[160];
+    snprintf(msg, sizeof(msg), "Client connected to local server via %s", addr.sun_path);
+    log_message("INFO", msg);
+    return 0;
+}
 
 int client_connect(Client *c, const char *host, int port) {
     if (!c) return -1;
 
     memset(c, 0, sizeof(Client));
+    if (host && connect_local(c, host, port) == 0) return 0;
+
     c->sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (c->sockfd < 0) {
         log_message("ERROR", "client_connect: socket creation failed");
@@ -151,72 +216,427 @@ int client_auth(Client *c, const char *username, const char *password) {
     return -1;
 }
 
+/* "user:filename:size", plus ":mtime" when uploading a local file (st), so
+ * the server's copy and listing carry the file's own modification time */
+static void format_upload_header(char *buf, size_t len, const char *username,
+                                 const char *filename, uint64_t size, const struct stat *st) {
+    int n = snprintf(buf, len, "%s:%s:%llu", username, filename, (unsigned long long)size);
+    if (st && n > 0 && (size_t)n < len)
+        snprintf(buf + n, len - (size_t)n, ":%lld", (long long)st->st_mtime);
+}
+
+/* Send the UPLOAD header announcing size bytes of payload and wait for the
+ * server's READY; a refusal (e.g. QUOTA_EXCEEDED) arrives before any data */
+static int send_upload_header(Client *c, const char *who, const char *username,
+                              const char *filename, uint64_t size, const struct stat *st) {
+    if (!c || !c->is_connected) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "%s: not connected", who);
+        log_message("ERROR", msg);
+        return -1;
+    }
+
+    char header[USERNAME_LEN + FILE_NAME_LEN + 64];
+    format_upload_header(header, sizeof(header), username, filename, size, st);
+
+    Packet p;
+    init_packet(&p, CMD_UPLOAD, header);
+    if (send_packet(c->sockfd, &p) < 0) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "%s: send_packet failed for header", who);
+        log_message("ERROR", msg);
+        return -1;
+    }
+
+    if (recv_packet(c->sockfd, &p) < 0) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "%s: no reply to upload header", who);
+        log_message("ERROR", msg);
+        return -1;
+    }
+    if (p.command != CMD_ACK) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "%s: server refused upload: %.*s", who,
+                 (int)(p.data_length < MAX_PAYLOAD ? p.data_length : MAX_PAYLOAD), p.data);
+        log_message("ERROR", msg);
+        return -1;
+    }
+    return 0;
+}
+
+/* Wait for the server to acknowledge a finished upload */
+static int await_upload_ack(Client *c, const char *who, const char *filename, uint64_t sent) {
+    char msg[FILE_NAME_LEN + 64];
+    snprintf(msg, sizeof(msg), "%s: sent %llu bytes, waiting for ACK", who, (unsigned long long)sent);
+    log_message("INFO", msg);
+
+    Packet resp;
+    if (recv_packet(c->sockfd, &resp) == 0 && resp.command == CMD_ACK) {
+        snprintf(msg, sizeof(msg), "Upload completed successfully: %s (%llu bytes)", filename,
+                 (unsigned long long)sent);
+        log_message("INFO", msg);
+        return 0;
+    }
+
+    log_message("WARN", "Upload failed or not acknowledged by server");
+    return -1;
+}
+
+/* Local socket: hand the open file to the server, which copies it itself */
+static int upload_by_fd(Client *c, const char *username, const char *filename, int fd,
+                        const struct stat *st) {
+    uint64_t filesize = (uint64_t)st->st_size;
+    char header[USERNAME_LEN + FILE_NAME_LEN + 64];
+    format_upload_header(header, sizeof(header), username, filename, filesize, st);
+
+    Packet p;
+    init_packet(&p, CMD_UPLOAD_FD, header);
+    if (send_packet_fd(c->sockfd, &p, fd) < 0) {
+        log_message("ERROR", "client_upload: passing the file to the server failed");
+        return -1;
+    }
+    return await_upload_ack(c, "client_upload", filename, filesize);
+}
+
 int client_upload(Client *c, const char *username, const char *filepath) {
+    return client_upload_ex(c, username, filepath, NULL, NULL);
+}
+
+int client_upload_ex(Client *c, const char *username, const char *filepath,
+                     client_progress_fn progress, void *arg) {
+    if (!filepath) return -1;
+    const char *filename = strrchr(filepath, '/');
+    return client_upload_as(c, username, filepath, filename ? filename + 1 : filepath,
+                            progress, arg);
+}
+
+int client_upload_as(Client *c, const char *username, const char *filepath,
+                     const char *filename, client_progress_fn progress, void *arg) {
     if (!c || !c->is_connected) {
         log_message("ERROR", "client_upload: not connected");
         return -1;
     }
 
-    FILE *fp = fopen(filepath, "rb");
-    if (!fp) {
+    int fd = open(filepath, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
         char msg[256];
         snprintf(msg, sizeof(msg), "client_upload: cannot open file: %s", filepath);
         log_message("ERROR", msg);
+        if (fd >= 0) close(fd);
         return -1;
     }
+    uint64_t filesize = (uint64_t)st.st_size;
 
-    fseek(fp, 0, SEEK_END);
-    size_t filesize = (size_t)ftell(fp);
-    rewind(fp);
+    if (c->is_local) {
+        int rc = upload_by_fd(c, username, filename, fd, &st);
+        close(fd);
+        if (rc == 0 && progress) progress(filesize, filesize, arg);
+        return rc;
+    }
 
-    const char *filename = strrchr(filepath, '/');
-    filename = filename ? filename + 1 : filepath;
+    if (send_upload_header(c, "client_upload", username, filename, filesize, &st) < 0) {
+        close(fd);
+        return -1;
+    }
 
-    char header[USERNAME_LEN + FILE_NAME_LEN + 64];
-    snprintf(header, sizeof(header), "%s:%s:%zu", username, filename, filesize);
+    /* Page-cache reads overlap with the socket sends */
+    TunedProgress tp = { .progress = progress, .arg = arg };
+    tcp_tune_begin(&tp.tune, c->sockfd, filesize, 1);
+    int rc = xfer_send_file(c->sockfd, fd, filesize, tuned_progress, &tp);
+    tcp_tune_end(&tp.tune, filename);
+    close(fd);
+    if (rc < 0) {
+        log_message("ERROR", "client_upload: sending file data failed");
+        return -1;
+    }
 
-    Packet p;
-    init_packet(&p, CMD_UPLOAD, header);
-    if (send_packet(c->sockfd, &p) < 0) {
-        log_message("ERROR", "client_upload: send_packet failed for header");
-        fclose(fp);
+    return await_upload_ack(c, "client_upload", filename, filesize);
+}
+
+int client_upload_buffer(Client *c, const char *username, const char *filename,
+                         const void *data, size_t len) {
+    if (!filename || (!data && len > 0)) return -1;
+    if (send_upload_header(c, "client_upload_buffer", username, filename, len, NULL) < 0) return -1;
+
+    /* Straight from the caller's memory into the socket */
+    ssize_t sent = send_all(c->sockfd, data, len);
+    if (sent < 0 || (size_t)sent != len) {
+        log_message("ERROR", "client_upload_buffer: send_all failed");
         return -1;
     }
 
-    char buffer[BUFFER_SIZE];
-    size_t n;
-    size_t sent = 0;
-    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
-        ssize_t result = send_all(c->sockfd, buffer, n);
-        if (result < 0 || (size_t)result != n) {
+    return await_upload_ack(c, "client_upload_buffer", filename, len);
+}
+
+int client_upload_stream(Client *c, const char *username, const char *filename, uint64_t size,
+                         client_source_fn source, void *arg) {
+    if (!filename || !source) return -1;
+    if (send_upload_header(c, "client_upload_stream", username, filename, size, NULL) < 0) return -1;
+
+    uint64_t sent = 0;
+    while (sent < size) {
+        const void *piece = NULL;
+        ssize_t n = source(&piece, arg);
+        if (n <= 0 || !piece || (uint64_t)n > size - sent) {
             char msg[128];
-            snprintf(msg, sizeof(msg), "client_upload: send_all failed (sent %zu/%zu)", sent, filesize);
+            snprintf(msg, sizeof(msg), "client_upload_stream: source ended after %llu of %llu bytes",
+                     (unsigned long long)sent, (unsigned long long)size);
             log_message("ERROR", msg);
-            fclose(fp);
             return -1;
         }
-        sent += n;
+        ssize_t r = send_all(c->sockfd, piece, (size_t)n);
+        if (r != n) {
+            log_message("ERROR", "client_upload_stream: send_all failed");
+            return -1;
+        }
+        sent += (uint64_t)n;
+    }
+
+    return await_upload_ack(c, "client_upload_stream", filename, sent);
+}
+
+/* Signature table of the server's copy, hashed by weak checksum */
+typedef struct {
+    BlockSig *sigs;
+    uint64_t nblocks;
+    int32_t *heads;          /* bucket -> first block index, -1 if empty */
+    int32_t *next;           /* block index -> next block in bucket */
+    uint32_t mask;
+    uint64_t filter[1024];   /* 64 Kbit prefilter on the folded weak sum */
+} SigIndex;
+
+static uint32_t sig_fold(uint32_t weak) {
+    return (weak ^ (weak >> 16)) & 0xffff;
+}
+
+static int sig_index_build(SigIndex *ix) {
+    uint32_t buckets = 16;
+    while (buckets < ix->nblocks * 2) buckets <<= 1;
+    ix->mask = buckets - 1;
+    ix->heads = malloc(buckets * sizeof(int32_t));
+    ix->next = malloc((ix->nblocks ? ix->nblocks : 1) * sizeof(int32_t));
+    if (!ix->heads || !ix->next) return -1;
+    memset(ix->heads, 0xff, buckets * sizeof(int32_t));
+    memset(ix->filter, 0, sizeof(ix->filter));
+
+    /* insert in reverse so each chain is in ascending block order */
+    for (uint64_t i = ix->nblocks; i-- > 0; ) {
+        uint32_t w = ix->sigs[i].weak;
+        uint32_t b = (w * 0x9e3779b1u) & ix->mask;
+        ix->next[i] = ix->heads[b];
+        ix->heads[b] = (int32_t)i;
+        uint32_t f = sig_fold(w);
+        ix->filter[f >> 6] |= 1ULL << (f & 63);
+    }
+    return 0;
+}
+
+static void sig_index_free(SigIndex *ix) {
+    free(ix->sigs);
+    free(ix->heads);
+    free(ix->next);
+}
+
+/* Find a basis block matching data[0..block-1]; prefer `hint` (the block
+ * that would extend the current copy run). Returns -1 if none. */
+static int64_t sig_index_match(const SigIndex *ix, uint32_t weak, const unsigned char *data,
+                               size_t block, int64_t hint) {
+    uint32_t f = sig_fold(weak);
+    if (!(ix->filter[f >> 6] & (1ULL << (f & 63)))) return -1;
+
+    int have_strong = 0;
+    unsigned char strong[MD5_DIGEST_LEN];
+    int64_t found = -1;
+    for (int32_t i = ix->heads[(weak * 0x9e3779b1u) & ix->mask]; i >= 0; i = ix->next[i]) {
+        if (ix->sigs[i].weak != weak) continue;
+        if (!have_strong) {
+            md5_digest(data, block, strong);
+            have_strong = 1;
+        }
+        if (memcmp(ix->sigs[i].strong, strong, MD5_DIGEST_LEN) != 0) continue;
+        if (i == hint) return i;
+        if (found < 0) found = i;
+    }
+    return found;
+}
+
+static int delta_send_literal(int sockfd, const unsigned char *data, size_t len) {
+    Packet p;
+    while (len > 0) {
+        size_t n = len < MAX_PAYLOAD ? len : MAX_PAYLOAD;
+        p.command = CMD_DELTA_DATA;
+        p.data_length = (uint32_t)n;
+        memcpy(p.data, data, n);
+        if (send_packet(sockfd, &p) < 0) return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int delta_send_copy(int sockfd, int64_t start, int64_t count) {
+    char ref[64];
+    snprintf(ref, sizeof(ref), "%lld:%lld", (long long)start, (long long)count);
+    Packet p;
+    init_packet(&p, CMD_DELTA_COPY, ref);
+    return send_packet(sockfd, &p);
+}
+
+int client_upload_delta(Client *c, const char *username, const char *filepath) {
+    if (!c || !c->is_connected) {
+        log_message("ERROR", "client_upload_delta: not connected");
+        return -1;
+    }
+
+    int fd = open(filepath, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "client_upload_delta: cannot open file: %s", filepath);
+        log_message("ERROR", msg);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    size_t filesize = (size_t)st.st_size;
+    const unsigned char *data = NULL;
+    if (filesize > 0) {
+        data = mmap(NULL, filesize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            log_message("ERROR", "client_upload_delta: mmap failed");
+            close(fd);
+            return -1;
+        }
+        madvise((void*)data, filesize, MADV_SEQUENTIAL);
     }
-    fclose(fp);
+    close(fd);
 
+    const char *filename = strrchr(filepath, '/');
+    filename = filename ? filename + 1 : filepath;
+
+    char header[USERNAME_LEN + FILE_NAME_LEN + 64];
+    format_upload_header(header, sizeof(header), username, filename, filesize, &st);
+
+    int rc = -1;
+    SigIndex ix;
+    memset(&ix, 0, sizeof(ix));
+    uint32_t *weak = NULL;
+    uint16_t *scratch = NULL;
     char msg[256];
-    snprintf(msg, sizeof(msg), "client_upload: sent %zu bytes, waiting for ACK", sent);
-    log_message("INFO", msg);
 
-    Packet resp;
-    if (recv_packet(c->sockfd, &resp) == 0 && resp.command == CMD_ACK) {
-        snprintf(msg, sizeof(msg), "Upload completed successfully: %s (%zu bytes)", filename, sent);
+    Packet p;
+    init_packet(&p, CMD_DELTA, header);
+    if (send_packet(c->sockfd, &p) < 0 || recv_packet(c->sockfd, &p) < 0) {
+        log_message("ERROR", "client_upload_delta: handshake failed");
+        goto out;
+    }
+    if (p.command != CMD_ACK) {
+        p.data[p.data_length < MAX_PAYLOAD ? p.data_length : MAX_PAYLOAD - 1] = '\0';
+        snprintf(msg, sizeof(msg), "client_upload_delta: server refused delta upload: %s", p.data);
+        log_message("ERROR", msg);
+        goto out;
+    }
+    p.data[p.data_length < MAX_PAYLOAD ? p.data_length : MAX_PAYLOAD - 1] = '\0';
+
+    size_t block = 0;
+    unsigned long long nblocks = 0;
+    if (sscanf(p.data, "%zu:%llu", &block, &nblocks) != 2 || block == 0 ||
+        nblocks > INT32_MAX) {
+        log_message("ERROR", "client_upload_delta: bad signature header");
+        goto out;
+    }
+
+    ix.nblocks = nblocks;
+    ix.sigs = malloc((nblocks ? nblocks : 1) * sizeof(BlockSig));
+    if (!ix.sigs) goto out;
+    for (uint64_t i = 0; i < nblocks; i++) {
+        unsigned char raw[DELTA_SIG_SIZE];
+        if (recv_all(c->sockfd, raw, sizeof(raw)) != (ssize_t)sizeof(raw)) {
+            log_message("ERROR", "client_upload_delta: signature stream truncated");
+            goto out;
+        }
+        delta_sig_unpack(raw, &ix.sigs[i]);
+    }
+    if (sig_index_build(&ix) < 0) goto out;
+
+    weak = malloc(DELTA_SCAN_WINDOW * sizeof(uint32_t));
+    scratch = malloc(2 * (DELTA_SCAN_WINDOW + block + 1) * sizeof(uint16_t));
+    if (!weak || !scratch) goto out;
+
+    /* Scan every offset; weak sums are produced a window at a time by the
+     * vectorized kernel, then probed against the prefilter and hash. */
+    size_t pos = 0, lit_start = 0;
+    size_t win_start = 0, win_len = 0;
+    int64_t run_start = -1, run_len = 0;
+    uint64_t matched = 0;
+
+    while (nblocks > 0 && pos + block <= filesize) {
+        if (pos < win_start || pos >= win_start + win_len) {
+            win_start = pos;
+            win_len = filesize - block - pos + 1;
+            if (win_len > DELTA_SCAN_WINDOW) win_len = DELTA_SCAN_WINDOW;
+            delta_weak_sums(data + pos, win_len, block, weak, scratch);
+        }
+
+        int64_t hint = run_start >= 0 ? run_start + run_len : -1;
+        int64_t b = sig_index_match(&ix, weak[pos - win_start], data + pos, block, hint);
+        if (b < 0) {
+            pos++;
+            continue;
+        }
+
+        if (pos > lit_start) {
+            if (run_start >= 0 && delta_send_copy(c->sockfd, run_start, run_len) < 0) goto out;
+            run_start = -1;
+            if (delta_send_literal(c->sockfd, data + lit_start, pos - lit_start) < 0) goto out;
+        }
+        if (run_start >= 0 && b == run_start + run_len) {
+            run_len++;
+        } else {
+            if (run_start >= 0 && delta_send_copy(c->sockfd, run_start, run_len) < 0) goto out;
+            run_start = b;
+            run_len = 1;
+        }
+        matched += block;
+        pos += block;
+        lit_start = pos;
+    }
+
+    if (run_start >= 0 && delta_send_copy(c->sockfd, run_start, run_len) < 0) goto out;
+    if (filesize > lit_start &&
+        delta_send_literal(c->sockfd, data + lit_start, filesize - lit_start) < 0) goto out;
+
+    unsigned char digest[MD5_DIGEST_LEN];
+    char hex[MD5_HEX_LEN];
+    md5_digest(data, filesize, digest);
+    md5_to_hex(digest, hex);
+    init_packet(&p, CMD_DELTA_END, hex);
+    if (send_packet(c->sockfd, &p) < 0) goto out;
+
+    if (recv_packet(c->sockfd, &p) == 0 && p.command == CMD_ACK) {
+        snprintf(msg, sizeof(msg), "Delta upload completed: %s (%zu bytes, %llu reused)",
+                 filename, filesize, (unsigned long long)matched);
         log_message("INFO", msg);
-        return 0;
+        rc = 0;
+    } else {
+        log_message("WARN", "Delta upload failed or not acknowledged by server");
     }
-    
-    log_message("WARN", "Upload failed or not acknowledged by server");
-    return -1;
+
+out:
+    free(weak);
+    free(scratch);
+    sig_index_free(&ix);
+    if (data) munmap((void*)data, filesize);
+    return rc;
 }
 
-int client_download(Client *c, const char *username, const char *filename, const char *save_path) {
+/* Send a DOWNLOAD request and read the size the server announces */
+static int request_download(Client *c, const char *who, const char *username,
+                            const char *filename, uint64_t *size) {
+    char msg[256];
     if (!c || !c->is_connected) {
-        log_message("ERROR", "client_download: not connected");
+        snprintf(msg, sizeof(msg), "%s: not connected", who);
+        log_message("ERROR", msg);
         return -1;
     }
 
@@ -226,62 +646,423 @@ int client_download(Client *c, const char *username, const char *filename, const
     Packet req;
     init_packet(&req, CMD_DOWNLOAD, header);
     if (send_packet(c->sockfd, &req) < 0) {
-        log_message("ERROR", "client_download: send_packet failed");
+        snprintf(msg, sizeof(msg), "%s: send_packet failed", who);
+        log_message("ERROR", msg);
         return -1;
     }
 
     Packet ack;
     if (recv_packet(c->sockfd, &ack) < 0) {
-        log_message("ERROR", "client_download: recv_packet failed");
+        snprintf(msg, sizeof(msg), "%s: recv_packet failed", who);
+        log_message("ERROR", msg);
         return -1;
     }
-    
+
     if (ack.command != CMD_ACK) {
+        snprintf(msg, sizeof(msg), "%s: server error: %.200s", who, ack.data);
+        log_message("ERROR", msg);
+        return CLIENT_REFUSED;
+    }
+
+    *size = strtoull(ack.data, NULL, 10);
+    if (*size == 0) {
+        snprintf(msg, sizeof(msg), "%s: empty file or parse error", who);
+        log_message("WARN", msg);
+        return -1;
+    }
+
+    snprintf(msg, sizeof(msg), "%s: receiving %llu bytes", who, (unsigned long long)*size);
+    log_message("INFO", msg);
+    return 0;
+}
+
+/* Pass size bytes of payload to sink as they arrive. Once sink refuses
+ * data (or with no sink) the rest is still read and dropped, so the
+ * connection stays usable for the next request. */
+static int receive_payload(Client *c, const char *who, uint64_t size,
+                           client_sink_fn sink, void *arg) {
+    unsigned char buf[CLIENT_STREAM_CHUNK];
+    uint64_t total = 0;
+    int refused = 0;
+
+    while (total < size) {
+        size_t want = size - total < sizeof(buf) ? (size_t)(size - total) : sizeof(buf);
+        ssize_t r = recv(c->sockfd, buf, want, 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "%s: recv failed after %llu bytes", who,
+                     (unsigned long long)total);
+            log_message("ERROR", msg);
+            return -1;
+        }
+        if (!sink) refused = 1;
+        else if (!refused && sink(buf, (size_t)r, arg) != 0) refused = 1;
+        total += (uint64_t)r;
+    }
+    return refused ? -1 : 0;
+}
+
+int client_download(Client *c, const char *username, const char *filename, const char *save_path) {
+    return client_download_ex(c, username, filename, save_path, NULL, NULL);
+}
+
+/* Local socket: the server passes its stored file (or streams a packed
+ * one); returns like client_download_ex */
+static int download_by_fd(Client *c, const char *username, const char *filename,
+                          const char *save_path, client_progress_fn progress, void *arg) {
+    char header[USERNAME_LEN + FILE_NAME_LEN + 8];
+    snprintf(header, sizeof(header), "%s:%s", username, filename);
+    Packet p;
+    init_packet(&p, CMD_DOWNLOAD_FD, header);
+    int src = -1;
+    if (send_packet(c->sockfd, &p) < 0 || recv_packet_fd(c->sockfd, &p, &src) < 0) {
+        log_message("ERROR", "client_download: no reply from local server");
+        return -1;
+    }
+    if (p.command != CMD_ACK) {
         char msg[256];
-        snprintf(msg, sizeof(msg), "client_download: server error: %s", ack.data);
+        snprintf(msg, sizeof(msg), "client_download: server error: %.200s", p.data);
         log_message("ERROR", msg);
+        if (src >= 0) close(src);
+        return CLIENT_REFUSED;
+    }
+    uint64_t filesize = strtoull(p.data, NULL, 10);
+
+    char fullpath[PATH_LEN];
+    snprintf(fullpath, sizeof(fullpath), "%s/%s", save_path, filename);
+    int fd = open(fullpath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "client_download: cannot open save path: %s", fullpath);
+        log_message("ERROR", msg);
+        if (src >= 0) close(src);
+        else receive_payload(c, "client_download", filesize, NULL, NULL);
         return -1;
     }
 
-    size_t filesize = strtoull(ack.data, NULL, 10);
-    if (filesize == 0) {
-        log_message("WARN", "client_download: empty file or parse error");
+    int rc;
+    if (src >= 0) {
+        ssize_t n = copy_range(src, 0, fd, (size_t)filesize);
+        rc = n == (ssize_t)filesize ? 0 : -1;
+        close(src);
+        if (rc == 0 && progress) progress(filesize, filesize, arg);
+    } else {
+        rc = xfer_pipe(c->sockfd, xfer_recv, fd, xfer_write_full, filesize, progress, arg);
+    }
+    if (close(fd) < 0) rc = -1;
+    if (rc < 0) {
+        log_message("ERROR", "client_download: transfer failed");
         return -1;
     }
 
+    char msg[FILE_NAME_LEN + 64];
+    snprintf(msg, sizeof(msg), "File download complete: %s (%llu bytes%s)", filename,
+             (unsigned long long)filesize, src >= 0 ? ", passed fd" : "");
+    log_message("INFO", msg);
+    return 0;
+}
+
+int client_download_ex(Client *c, const char *username, const char *filename,
+                       const char *save_path, client_progress_fn progress, void *arg) {
+    if (c && c->is_connected && c->is_local)
+        return download_by_fd(c, username, filename, save_path, progress, arg);
+
+    uint64_t filesize;
+    int rc = request_download(c, "client_download", username, filename, &filesize);
+    if (rc < 0) return rc;
+
     char fullpath[PATH_LEN];
     snprintf(fullpath, sizeof(fullpath), "%s/%s", save_path, filename);
-    FILE *fp = fopen(fullpath, "wb");
-    if (!fp) {
+    int fd = open(fullpath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
         char msg[256];
         snprintf(msg, sizeof(msg), "client_download: cannot open save path: %s", fullpath);
         log_message("ERROR", msg);
+        receive_payload(c, "client_download", filesize, NULL, NULL);
         return -1;
     }
 
-    char buffer[BUFFER_SIZE];
-    size_t total = 0;
-    ssize_t r;
-    
-    char msg[256];
-    snprintf(msg, sizeof(msg), "client_download: receiving %zu bytes", filesize);
+    /* A reader thread drains the socket into the ring while this one writes */
+    TunedProgress tp = { .progress = progress, .arg = arg };
+    tcp_tune_begin(&tp.tune, c->sockfd, filesize, 0);
+    rc = xfer_pipe(c->sockfd, xfer_recv, fd, xfer_write_full, filesize,
+                   tuned_progress, &tp);
+    tcp_tune_end(&tp.tune, filename);
+    if (close(fd) < 0) rc = -1;
+    if (rc < 0) {
+        log_message("ERROR", "client_download: transfer failed");
+        return -1;
+    }
+
+    char msg[FILE_NAME_LEN + 64];
+    snprintf(msg, sizeof(msg), "File download complete: %s (%llu bytes)", filename,
+             (unsigned long long)filesize);
     log_message("INFO", msg);
-    
-    while (total < filesize) {
-        size_t to_read = (filesize - total < BUFFER_SIZE) ? (filesize - total) : BUFFER_SIZE;
-        r = recv(c->sockfd, buffer, to_read, 0);
-        if (r <= 0) {
-            snprintf(msg, sizeof(msg), "client_download: recv failed after %zu bytes", total);
-            log_message("ERROR", msg);
-            fclose(fp);
+    return 0;
+}
+
+int client_download_buffer(Client *c, const char *username, const char *filename,
+                           void *buf, size_t cap, uint64_t *size_out) {
+    uint64_t filesize;
+    if (size_out) *size_out = 0;
+    if (request_download(c, "client_download_buffer", username, filename, &filesize) < 0)
+        return -1;
+    if (size_out) *size_out = filesize;
+
+    if (buf && filesize <= cap) {
+        /* Fits: receive straight into the caller's memory */
+        ssize_t r = recv_all(c->sockfd, buf, (size_t)filesize);
+        if (r < 0 || (uint64_t)r != filesize) {
+            log_message("ERROR", "client_download_buffer: recv failed");
             return -1;
         }
-        fwrite(buffer, 1, (size_t)r, fp);
-        total += (size_t)r;
+        return 0;
+    }
+
+    char msg[FILE_NAME_LEN + 96];
+    snprintf(msg, sizeof(msg), "client_download_buffer: %s needs %llu bytes, buffer holds %zu",
+             filename, (unsigned long long)filesize, cap);
+    log_message("WARN", msg);
+
+    /* Drop the payload; the caller can retry with a buffer of *size_out bytes */
+    receive_payload(c, "client_download_buffer", filesize, NULL, NULL);
+    return -1;
+}
+
+int client_download_stream(Client *c, const char *username, const char *filename,
+                           client_sink_fn sink, void *arg) {
+    if (!sink) return -1;
+    uint64_t filesize;
+    if (request_download(c, "client_download_stream", username, filename, &filesize) < 0)
+        return -1;
+
+    if (receive_payload(c, "client_download_stream", filesize, sink, arg) < 0) {
+        log_message("ERROR", "client_download_stream: transfer failed or aborted by sink");
+        return -1;
+    }
+    return 0;
+}
+
+/* Compressed archive: frames of a 4-byte length and data until an empty
+ * one. Written to fd, or dropped when fd < 0 (returns bytes, -1 on error). */
+static int64_t receive_frames(Client *c, int fd, client_progress_fn progress, void *arg) {
+    unsigned char *buf = malloc(ARCHIVE_FRAME_MAX);
+    if (!buf) return -1;
+
+    int64_t total = 0;
+    int failed = 0;
+    for (;;) {
+        uint32_t len;
+        if (recv_all(c->sockfd, &len, sizeof(len)) != (ssize_t)sizeof(len)) break;
+        len = ntohl(len);
+        if (len == 0) {
+            free(buf);
+            return failed ? -1 : total;
+        }
+        if (len > ARCHIVE_FRAME_MAX || recv_all(c->sockfd, buf, len) != (ssize_t)len) break;
+        if (fd >= 0 && !failed && xfer_write_full(fd, buf, len) != (ssize_t)len) failed = 1;
+        total += len;
+        if (progress) progress((uint64_t)total, 0, arg);
+    }
+    free(buf);
+    log_message("ERROR", "client_download_archive: archive stream broken");
+    return -1;
+}
+
+int client_download_archive(Client *c, const char *username, const char *prefix, int compress,
+                            const char *save_file, client_progress_fn progress, void *arg) {
+    if (!c || !c->is_connected) {
+        log_message("ERROR", "client_download_archive: not connected");
+        return -1;
+    }
+
+    char header[USERNAME_LEN + FILE_NAME_LEN + 8];
+    snprintf(header, sizeof(header), "%s:%s:%s", username, compress ? "tgz" : "tar",
+             prefix ? prefix : "");
+    Packet p;
+    init_packet(&p, CMD_ARCHIVE, header);
+    if (send_packet(c->sockfd, &p) < 0 || recv_packet(c->sockfd, &p) < 0) {
+        log_message("ERROR", "client_download_archive: no reply from server");
+        return -1;
+    }
+    char msg[PATH_LEN + 96];
+    if (p.command != CMD_ACK) {
+        snprintf(msg, sizeof(msg), "client_download_archive: server error: %.200s", p.data);
+        log_message("ERROR", msg);
+        return -1;
+    }
+    unsigned long long size = 0;
+    unsigned long count = 0;
+    if (sscanf(p.data, "%llu:%lu", &size, &count) != 2) {
+        log_message("ERROR", "client_download_archive: bad reply");
+        return -1;
+    }
+    int framed = size == 0;
+
+    int fd = open(save_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        snprintf(msg, sizeof(msg), "client_download_archive: cannot open %s", save_file);
+        log_message("ERROR", msg);
+        if (framed) receive_frames(c, -1, NULL, NULL);
+        else receive_payload(c, "client_download_archive", size, NULL, NULL);
+        return -1;
+    }
+
+    int64_t got;
+    if (framed) {
+        got = receive_frames(c, fd, progress, arg);
+    } else {
+        TunedProgress tp = { .progress = progress, .arg = arg };
+        tcp_tune_begin(&tp.tune, c->sockfd, size, 0);
+        int rc = xfer_pipe(c->sockfd, xfer_recv, fd, xfer_write_full, size, tuned_progress, &tp);
+        tcp_tune_end(&tp.tune, save_file);
+        got = rc == 0 ? (int64_t)size : -1;
+    }
+    if (close(fd) < 0) got = -1;
+    if (got < 0) {
+        log_message("ERROR", "client_download_archive: transfer failed");
+        return -1;
+    }
+
+    snprintf(msg, sizeof(msg), "Archive download complete: %s (%lu files, %lld bytes%s)",
+             save_file, count, (long long)got, framed ? ", gzip" : "");
+    log_message("INFO", msg);
+    return (int)count;
+}
+
+int client_watch(Client *c, const char *username, const char *prefix) {
+    if (!c || !c->is_connected) {
+        log_message("ERROR", "client_watch: not connected");
+        return -1;
+    }
+
+    char header[USERNAME_LEN + FILE_NAME_LEN + 8];
+    snprintf(header, sizeof(header), "%s:%s", username, prefix ? prefix : "");
+    Packet p;
+    init_packet(&p, CMD_WATCH, header);
+    if (send_packet(c->sockfd, &p) < 0 || recv_packet(c->sockfd, &p) < 0) {
+        log_message("ERROR", "client_watch: no reply from server");
+        return -1;
+    }
+    if (p.command != CMD_ACK) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "client_watch: server error: %.200s", p.data);
+        log_message("ERROR", msg);
+        return -1;
+    }
+    return 0;
+}
+
+int client_watch_poll(Client *c, int timeout_ms, client_watch_fn fn, void *arg) {
+    if (!c || !c->is_connected) return -1;
+
+    struct pollfd pfd = { c->sockfd, POLLIN, 0 };
+    int ready;
+    do {
+        ready = poll(&pfd, 1, timeout_ms);
+    } while (ready < 0 && errno == EINTR);
+    if (ready < 0) return -1;
+    if (ready == 0) return 0;
+
+    Packet p;
+    if (recv_packet(c->sockfd, &p) < 0 || p.command != CMD_WATCH_EVENT) {
+        log_message("ERROR", "client_watch_poll: watch connection lost");
+        return -1;
+    }
+    p.data[p.data_length < MAX_PAYLOAD ? p.data_length : MAX_PAYLOAD - 1] = '\0';
+
+    int count = 0;
+    char *save = NULL;
+    for (char *line = strtok_r(p.data, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+        char kind;
+        unsigned long long size;
+        char md5[40];
+        int name_at = 0;
+        if (sscanf(line, "%c %llu %39s %n", &kind, &size, md5, &name_at) != 3 || name_at == 0)
+            continue;
+        if (fn) fn(kind, (uint64_t)size, md5, line + name_at, arg);
+        count++;
+    }
+    return count;
+}
+
+int client_list(Client *c, const char *username, const char *prefix, client_list_fn fn,
+                void *arg) {
+    if (!c || !c->is_connected) {
+        log_message("ERROR", "client_list: not connected");
+        return -1;
+    }
+
+    char header[USERNAME_LEN + FILE_NAME_LEN + 8];
+    snprintf(header, sizeof(header), "%s:%s", username, prefix ? prefix : "");
+    Packet p;
+    init_packet(&p, CMD_LIST, header);
+    if (send_packet(c->sockfd, &p) < 0) {
+        log_message("ERROR", "client_list: send_packet failed");
+        return -1;
+    }
+
+    /* Lines arrive in CMD_LIST packets until the ACK with the count */
+    int count = 0;
+    for (;;) {
+        if (recv_packet(c->sockfd, &p) < 0) {
+            log_message("ERROR", "client_list: connection lost");
+            return -1;
+        }
+        if (p.command != CMD_LIST) break;
+        p.data[p.data_length < MAX_PAYLOAD ? p.data_length : MAX_PAYLOAD - 1] = '\0';
+
+        char *save = NULL;
+        for (char *line = strtok_r(p.data, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+            unsigned long long size;
+            long long mtime;
+            int name_at = 0;
+            if (sscanf(line, "%llu %lld%n", &size, &mtime, &name_at) != 2 || line[name_at] != ' ')
+                continue;
+            if (fn) fn(line + name_at + 1, (uint64_t)size, (int64_t)mtime, arg);
+            count++;
+        }
+    }
+    if (p.command != CMD_ACK) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "client_list: server error: %.200s", p.data);
+        log_message("ERROR", msg);
+        return -1;
+    }
+    return count;
+}
+
+int client_delete(Client *c, const char *username, const char *filename) {
+    if (!c || !c->is_connected) {
+        log_message("ERROR", "client_delete: not connected");
+        return -1;
+    }
+
+    char header[USERNAME_LEN + FILE_NAME_LEN + 8];
+    snprintf(header, sizeof(header), "%s:%s", username, filename);
+
+    Packet req;
+    init_packet(&req, CMD_DELETE, header);
+    if (send_packet(c->sockfd, &req) < 0) {
+        log_message("ERROR", "client_delete: send_packet failed");
+        return -1;
+    }
+
+    Packet resp;
+    if (recv_packet(c->sockfd, &resp) < 0) {
+        log_message("WARN", "client_delete: no reply from server");
+        return -1;
+    }
+    if (resp.command != CMD_ACK) {
+        char msg[256];
+        snprintf(msg, sizeof(msg), "client_delete: server error: %.200s", resp.data);
+        log_message("WARN", msg);
+        return CLIENT_REFUSED;
     }
-    fclose(fp);
 
-    snprintf(msg, sizeof(msg), "File download complete: %s (%zu bytes)", filename, total);
+    char msg[FILE_NAME_LEN + 32];
+    snprintf(msg, sizeof(msg), "Deleted file: %s", filename);
     log_message("INFO", msg);
     return 0;
 }
@@ -4,16 +4,34 @@
 #include "../common/common.h"
 #include "../common/protocol.h"
 
+/* Returned by downloads and deletes instead of -1 when the server answered
+ * with an error (e.g. FILE_NOT_FOUND): the connection is still usable */
+#define CLIENT_REFUSED -2
+
 /* Client connection context */
 typedef struct {
     int sockfd;
     struct sockaddr_in server_addr;
     int is_connected;
+    int is_local;       /* connected through the server's Unix socket */
 } Client;
 
+/* Transfer progress hook, called after every chunk with bytes done so far */
+typedef void (*client_progress_fn)(uint64_t done, uint64_t total, void *arg);
+
+/* Streaming upload source: point *data at the next piece and return its
+ * length (0 or -1 ends the upload). The piece must stay valid until the
+ * next call; it is sent as-is without copying. */
+typedef ssize_t (*client_source_fn)(const void **data, void *arg);
+
+/* Streaming download sink: consume len bytes, return 0 to continue or
+ * non-zero to abort (the remaining payload is then discarded) */
+typedef int (*client_sink_fn)(const void *data, size_t len, void *arg);
+
 /* === Public API (for Python FFI) === */
 
-/* Initialize client and connect to server (returns 0 on success) */
+/* Initialize client and connect to server (returns 0 on success). For a
+ * loopback host the server's local Unix socket is used when it exists. */
 int client_connect(Client *c, const char *host, int port);
 
 /* Authenticate user credentials (returns 0 on success) */
@@ -22,9 +40,79 @@ int client_auth(Client *c, const char *username, const char *password);
 /* Upload file to server (returns 0 on success) */
 int client_upload(Client *c, const char *username, const char *filepath);
 
-/* Download file from server (returns 0 on success) */
+/* Same as client_upload, reporting progress through an optional hook */
+int client_upload_ex(Client *c, const char *username, const char *filepath,
+                     client_progress_fn progress, void *arg);
+
+/* Same as client_upload_ex, storing the file under filename instead of its
+ * base name (e.g. a relative path such as "src/main.c") */
+int client_upload_as(Client *c, const char *username, const char *filepath,
+                     const char *filename, client_progress_fn progress, void *arg);
+
+/* Upload len bytes from caller memory as `filename` (returns 0 on success) */
+int client_upload_buffer(Client *c, const char *username, const char *filename,
+                         const void *data, size_t len);
+
+/* Upload exactly size bytes produced piecewise by source (returns 0 on success).
+ * If the source ends early the connection is out of sync: disconnect. */
+int client_upload_stream(Client *c, const char *username, const char *filename, uint64_t size,
+                         client_source_fn source, void *arg);
+
+/* Upload file sending only blocks that differ from the server's copy (returns 0 on success) */
+int client_upload_delta(Client *c, const char *username, const char *filepath);
+
+/* Download file from server (returns 0 on success, CLIENT_REFUSED or -1) */
 int client_download(Client *c, const char *username, const char *filename, const char *save_path);
 
+/* Same as client_download, reporting progress through an optional hook */
+int client_download_ex(Client *c, const char *username, const char *filename,
+                       const char *save_path, client_progress_fn progress, void *arg);
+
+/* Download a file into caller memory of cap bytes (returns 0 on success).
+ * *size_out gets the file size; if it exceeds cap the data is discarded,
+ * -1 is returned and the caller can retry with a large enough buffer. */
+int client_download_buffer(Client *c, const char *username, const char *filename,
+                           void *buf, size_t cap, uint64_t *size_out);
+
+/* Download a file handing each received piece to sink (returns 0 on success) */
+int client_download_stream(Client *c, const char *username, const char *filename,
+                           client_sink_fn sink, void *arg);
+
+/* Download every file of username whose name starts with prefix ("" or
+ * NULL for all) as one tar archive saved to save_file. With compress the
+ * server gzips it on the fly (servers built with ZLIB=1 only) and progress
+ * reports a total of 0. Returns the number of files, -1 on error. */
+int client_download_archive(Client *c, const char *username, const char *prefix, int compress,
+                            const char *save_file, client_progress_fn progress, void *arg);
+
+/* Change event from client_watch_poll: kind 'U' new file, 'O' overwritten,
+ * 'D' deleted (size 0, md5 "-"), or 'R' (name "*"): events were dropped,
+ * rescan whatever you keep in sync */
+typedef void (*client_watch_fn)(char kind, uint64_t size, const char *md5, const char *name,
+                                void *arg);
+
+/* Subscribe to changes of username's files whose names start with prefix
+ * ("" or NULL for all). From then on the connection only delivers events;
+ * client_disconnect ends the subscription. Returns 0 on success. */
+int client_watch(Client *c, const char *username, const char *prefix);
+
+/* Wait up to timeout_ms (-1 = forever) for the next batch of events and
+ * call fn for each. Returns the number of events, 0 on timeout, -1 if
+ * the connection is gone. */
+int client_watch_poll(Client *c, int timeout_ms, client_watch_fn fn, void *arg);
+
+/* Listed file from client_list; mtime is the local file's modification time
+ * sent with its upload (or when the server stored it, if none was sent) */
+typedef void (*client_list_fn)(const char *name, uint64_t size, int64_t mtime, void *arg);
+
+/* Call fn for each of username's files whose name starts with prefix ("" or
+ * NULL for all), in name order. Returns the number of files, -1 on error. */
+int client_list(Client *c, const char *username, const char *prefix, client_list_fn fn,
+                void *arg);
+
+/* Delete file from server (returns 0 on success, CLIENT_REFUSED or -1) */
+int client_delete(Client *c, const char *username, const char *filename);
+
 /* Disconnect gracefully */
 void client_disconnect(Client *c);
 
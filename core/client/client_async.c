@@ -0,0 +1,285 @@
+#include "client_async.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum { JOB_UPLOAD, JOB_DOWNLOAD } JobKind;
+
+typedef struct AsyncJob {
+    int handle;
+    JobKind kind;
+    char path[PATH_LEN];          /* upload: local file, download: save dir */
+    char name[FILE_NAME_LEN];     /* download: remote file name */
+    async_progress_fn progress;
+    async_done_fn done;
+    void *user_data;
+    struct AsyncJob *next;
+} AsyncJob;
+
+struct AsyncClient {
+    char host[256];
+    int port;
+    char username[USERNAME_LEN];
+    char password[PASSWORD_LEN];
+
+    pthread_t workers[ASYNC_MAX_CONNECTIONS];
+    int nworkers;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work;          /* queue became non-empty or stopping */
+    pthread_cond_t finished;      /* some job reached a final state */
+    AsyncJob *head, *tail;
+    int stopping;
+
+    int *states;                  /* handle - 1 -> ASYNC_* state */
+    int nstates, cap;
+};
+
+/* Called with ac->lock held */
+static void set_state(AsyncClient *ac, int handle, int state) {
+    ac->states[handle - 1] = state;
+    if (state <= ASYNC_OK) pthread_cond_broadcast(&ac->finished);
+}
+
+static void job_progress(uint64_t done, uint64_t total, void *arg) {
+    AsyncJob *job = (AsyncJob*)arg;
+    job->progress(job->handle, done, total, job->user_data);
+}
+
+static int worker_connect(AsyncClient *ac, Client *c) {
+    if (client_connect(c, ac->host, ac->port) != 0) return -1;
+    if (client_auth(c, ac->username, ac->password) != 0) {
+        client_disconnect(c);
+        return -1;
+    }
+    return 0;
+}
+
+static void *async_worker(void *arg) {
+    AsyncClient *ac = (AsyncClient*)arg;
+    Client c;
+    memset(&c, 0, sizeof(c));
+
+    for (;;) {
+        pthread_mutex_lock(&ac->lock);
+        while (!ac->head && !ac->stopping)
+            pthread_cond_wait(&ac->work, &ac->lock);
+        if (!ac->head) {
+            pthread_mutex_unlock(&ac->lock);
+            break;
+        }
+        AsyncJob *job = ac->head;
+        ac->head = job->next;
+        if (!ac->head) ac->tail = NULL;
+        set_state(ac, job->handle, ASYNC_RUNNING);
+        pthread_mutex_unlock(&ac->lock);
+
+        /* A pooled connection may have been closed by the server's idle
+         * reaper since its last job, so a job failing on one is retried
+         * once on a fresh connection */
+        int rc = -1;
+        for (int tries = c.is_connected ? 2 : 1; tries > 0 && rc != 0; tries--) {
+            if (!c.is_connected && worker_connect(ac, &c) != 0) break;
+            client_progress_fn hook = job->progress ? job_progress : NULL;
+            if (job->kind == JOB_UPLOAD)
+                rc = client_upload_ex(&c, ac->username, job->path, hook, job);
+            else
+                rc = client_download_ex(&c, ac->username, job->name, job->path, hook, job);
+
+            /* A failed transfer may leave the stream mid-payload; start over
+             * with a fresh connection */
+            if (rc != 0) client_disconnect(&c);
+        }
+
+        int state = rc == 0 ? ASYNC_OK : ASYNC_FAILED;
+        if (job->done) job->done(job->handle, state, job->user_data);
+
+        pthread_mutex_lock(&ac->lock);
+        set_state(ac, job->handle, state);
+        pthread_mutex_unlock(&ac->lock);
+        free(job);
+    }
+
+    client_disconnect(&c);
+    return NULL;
+}
+
+AsyncClient *async_client_create(const char *host, int port, const char *username,
+                                 const char *password, int connections) {
+    if (!host || !username || !password) return NULL;
+    if (connections < 1) connections = 1;
+    if (connections > ASYNC_MAX_CONNECTIONS) connections = ASYNC_MAX_CONNECTIONS;
+
+    AsyncClient *ac = calloc(1, sizeof(AsyncClient));
+    if (!ac) return NULL;
+    snprintf(ac->host, sizeof(ac->host), "%s", host);
+    snprintf(ac->username, sizeof(ac->username), "%s", username);
+    snprintf(ac->password, sizeof(ac->password), "%s", password);
+    ac->port = port;
+    pthread_mutex_init(&ac->lock, NULL);
+    pthread_cond_init(&ac->work, NULL);
+    pthread_cond_init(&ac->finished, NULL);
+
+    for (int i = 0; i < connections; i++) {
+        if (pthread_create(&ac->workers[i], NULL, async_worker, ac) != 0) break;
+        ac->nworkers++;
+    }
+    if (ac->nworkers == 0) {
+        log_message("ERROR", "async_client_create: cannot start worker threads");
+        async_client_destroy(ac);
+        return NULL;
+    }
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Async client started with %d connection(s)", ac->nworkers);
+    log_message("INFO", msg);
+    return ac;
+}
+
+static int submit(AsyncClient *ac, AsyncJob *job) {
+    pthread_mutex_lock(&ac->lock);
+    if (ac->stopping) {
+        pthread_mutex_unlock(&ac->lock);
+        free(job);
+        return -1;
+    }
+    if (ac->nstates == ac->cap) {
+        int cap = ac->cap ? ac->cap * 2 : 64;
+        int *grown = realloc(ac->states, (size_t)cap * sizeof(int));
+        if (!grown) {
+            pthread_mutex_unlock(&ac->lock);
+            free(job);
+            return -1;
+        }
+        ac->states = grown;
+        ac->cap = cap;
+    }
+    job->handle = ++ac->nstates;
+    ac->states[job->handle - 1] = ASYNC_QUEUED;
+
+    if (ac->tail) ac->tail->next = job;
+    else ac->head = job;
+    ac->tail = job;
+    pthread_cond_signal(&ac->work);
+    int handle = job->handle;
+    pthread_mutex_unlock(&ac->lock);
+    return handle;
+}
+
+int async_upload(AsyncClient *ac, const char *filepath,
+                 async_progress_fn progress, async_done_fn done, void *user_data) {
+    if (!ac || !filepath) return -1;
+    AsyncJob *job = calloc(1, sizeof(AsyncJob));
+    if (!job) return -1;
+    job->kind = JOB_UPLOAD;
+    snprintf(job->path, sizeof(job->path), "%s", filepath);
+    job->progress = progress;
+    job->done = done;
+    job->user_data = user_data;
+    return submit(ac, job);
+}
+
+int async_download(AsyncClient *ac, const char *filename, const char *save_path,
+                   async_progress_fn progress, async_done_fn done, void *user_data) {
+    if (!ac || !filename || !save_path) return -1;
+    AsyncJob *job = calloc(1, sizeof(AsyncJob));
+    if (!job) return -1;
+    job->kind = JOB_DOWNLOAD;
+    snprintf(job->name, sizeof(job->name), "%s", filename);
+    snprintf(job->path, sizeof(job->path), "%s", save_path);
+    job->progress = progress;
+    job->done = done;
+    job->user_data = user_data;
+    return submit(ac, job);
+}
+
+int async_status(AsyncClient *ac, int handle) {
+    if (!ac) return ASYNC_FAILED;
+    pthread_mutex_lock(&ac->lock);
+    int state = (handle > 0 && handle <= ac->nstates) ? ac->states[handle - 1] : ASYNC_FAILED;
+    pthread_mutex_unlock(&ac->lock);
+    return state;
+}
+
+int async_wait(AsyncClient *ac, int handle, int timeout_ms) {
+    if (!ac) return ASYNC_FAILED;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    if (timeout_ms > 0) {
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&ac->lock);
+    if (handle <= 0 || handle > ac->nstates) {
+        pthread_mutex_unlock(&ac->lock);
+        return ASYNC_FAILED;
+    }
+    while (ac->states[handle - 1] > ASYNC_OK && timeout_ms != 0) {
+        if (timeout_ms < 0) {
+            pthread_cond_wait(&ac->finished, &ac->lock);
+        } else if (pthread_cond_timedwait(&ac->finished, &ac->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    int state = ac->states[handle - 1];
+    pthread_mutex_unlock(&ac->lock);
+    return state;
+}
+
+int async_cancel(AsyncClient *ac, int handle) {
+    if (!ac) return -1;
+
+    pthread_mutex_lock(&ac->lock);
+    AsyncJob *prev = NULL, *job = ac->head;
+    while (job && job->handle != handle) {
+        prev = job;
+        job = job->next;
+    }
+    if (!job) {
+        pthread_mutex_unlock(&ac->lock);
+        return -1;
+    }
+    if (prev) prev->next = job->next;
+    else ac->head = job->next;
+    if (ac->tail == job) ac->tail = prev;
+    set_state(ac, handle, ASYNC_CANCELLED);
+    pthread_mutex_unlock(&ac->lock);
+
+    if (job->done) job->done(handle, ASYNC_CANCELLED, job->user_data);
+    free(job);
+    return 0;
+}
+
+void async_client_destroy(AsyncClient *ac) {
+    if (!ac) return;
+
+    pthread_mutex_lock(&ac->lock);
+    ac->stopping = 1;
+    AsyncJob *pending = ac->head;
+    ac->head = ac->tail = NULL;
+    for (AsyncJob *job = pending; job; job = job->next)
+        set_state(ac, job->handle, ASYNC_CANCELLED);
+    pthread_cond_broadcast(&ac->work);
+    pthread_mutex_unlock(&ac->lock);
+
+    while (pending) {
+        AsyncJob *next = pending->next;
+        if (pending->done) pending->done(pending->handle, ASYNC_CANCELLED, pending->user_data);
+        free(pending);
+        pending = next;
+    }
+
+    for (int i = 0; i < ac->nworkers; i++)
+        pthread_join(ac->workers[i], NULL);
+
+    pthread_mutex_destroy(&ac->lock);
+    pthread_cond_destroy(&ac->work);
+    pthread_cond_destroy(&ac->finished);
+    free(ac->states);
+    free(ac);
+}
@@ -0,0 +1,56 @@
+#ifndef CLIENT_ASYNC_H
+#define CLIENT_ASYNC_H
+
+#include "client.h"
+
+/*
+ * Non-blocking client API. An AsyncClient owns a pool of worker threads,
+ * each holding its own authenticated connection that is reused across
+ * transfers (and re-established after a failure; a job that fails on a
+ * reused connection is retried once on a new one). Submit calls queue a
+ * job and return a handle immediately.
+ *
+ * Callbacks run on the worker thread doing the transfer. They only take
+ * plain integers and the caller's user_data pointer, so they can be ctypes
+ * CFUNCTYPE objects; keep those alive until the completion callback fires.
+ */
+
+#define ASYNC_MAX_CONNECTIONS 16
+
+/* Job states reported by async_status/async_wait */
+#define ASYNC_OK         0
+#define ASYNC_FAILED    -1
+#define ASYNC_CANCELLED -2
+#define ASYNC_QUEUED     1
+#define ASYNC_RUNNING    2
+
+typedef struct AsyncClient AsyncClient;
+
+typedef void (*async_progress_fn)(int handle, uint64_t done, uint64_t total, void *user_data);
+typedef void (*async_done_fn)(int handle, int status, void *user_data);
+
+/* Start a pool of `connections` workers for one user. Connections are made
+ * on first use; returns NULL if the pool cannot be created. */
+AsyncClient *async_client_create(const char *host, int port, const char *username,
+                                 const char *password, int connections);
+
+/* Queue a transfer (returns handle > 0, -1 on error). Callbacks may be NULL. */
+int async_upload(AsyncClient *ac, const char *filepath,
+                 async_progress_fn progress, async_done_fn done, void *user_data);
+int async_download(AsyncClient *ac, const char *filename, const char *save_path,
+                   async_progress_fn progress, async_done_fn done, void *user_data);
+
+/* Current state of a job (ASYNC_* value, -1 for an unknown handle too) */
+int async_status(AsyncClient *ac, int handle);
+
+/* Wait up to timeout_ms (< 0 = forever) for a job to finish; returns its
+ * state, which is still ASYNC_QUEUED/ASYNC_RUNNING on timeout */
+int async_wait(AsyncClient *ac, int handle, int timeout_ms);
+
+/* Cancel a job that has not started yet (returns 0 if it was cancelled) */
+int async_cancel(AsyncClient *ac, int handle);
+
+/* Finish running jobs, cancel queued ones, close all connections */
+void async_client_destroy(AsyncClient *ac);
+
+#endif /* CLIENT_ASYNC_H */
@@ -0,0 +1,111 @@
+#include "client_cluster.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Nodes tried for a download or delete: the owner, then the next distinct
+ * node clockwise on the ring, which held the key before the owner joined */
+#define CLUSTER_READ_TRIES 2
+
+struct ClusterClient {
+    HashRing ring;
+    Client conns[HASHRING_MAX_NODES];
+    char username[USERNAME_LEN];
+    char password[PASSWORD_LEN];
+};
+
+/* Authenticated connection to node, made if needed (NULL on failure) */
+static Client *node_conn(ClusterClient *cc, int node) {
+    Client *c = &cc->conns[node];
+    if (c->is_connected) return c;
+
+    char host[256];
+    int port;
+    if (hashring_split_addr(cc->ring.nodes[node], host, sizeof(host), &port) != 0) return NULL;
+    if (client_connect(c, host, port) != 0) return NULL;
+    if (client_auth(c, cc->username, cc->password) != 0) {
+        client_disconnect(c);
+        return NULL;
+    }
+    return c;
+}
+
+ClusterClient *cluster_client_create(const char *config_path, const char *username,
+                                     const char *password) {
+    if (!username || !password) return NULL;
+
+    ClusterClient *cc = calloc(1, sizeof(ClusterClient));
+    if (!cc) return NULL;
+    hashring_init(&cc->ring);
+    if (hashring_load(&cc->ring, config_path ? config_path : HASHRING_CONFIG_FILE) <= 0) {
+        log_message("ERROR", "cluster_client_create: cannot load cluster node list");
+        hashring_free(&cc->ring);
+        free(cc);
+        return NULL;
+    }
+    snprintf(cc->username, sizeof(cc->username), "%s", username);
+    snprintf(cc->password, sizeof(cc->password), "%s", password);
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Cluster client using %d node(s)", cc->ring.node_count);
+    log_message("INFO", msg);
+    return cc;
+}
+
+int cluster_upload(ClusterClient *cc, const char *filepath) {
+    if (!cc || !filepath) return -1;
+    const char *filename = strrchr(filepath, '/');
+    filename = filename ? filename + 1 : filepath;
+
+    int node = hashring_lookup(&cc->ring, cc->username, filename);
+    Client *c = node < 0 ? NULL : node_conn(cc, node);
+    if (!c) return -1;
+
+    int rc = client_upload(c, cc->username, filepath);
+    /* A failed transfer may leave the stream mid-payload */
+    if (rc != 0) client_disconnect(c);
+    return rc;
+}
+
+int cluster_download(ClusterClient *cc, const char *filename, const char *save_path) {
+    if (!cc || !filename) return -1;
+    int nodes[CLUSTER_READ_TRIES];
+    int n = hashring_lookup_n(&cc->ring, cc->username, filename, nodes, CLUSTER_READ_TRIES);
+    for (int i = 0; i < n; i++) {
+        Client *c = node_conn(cc, nodes[i]);
+        if (!c) continue;
+        int rc = client_download(c, cc->username, filename, save_path);
+        if (rc == 0) return 0;
+        /* Not on this node is an answer; only a broken stream needs a new connection */
+        if (rc != CLIENT_REFUSED) client_disconnect(c);
+    }
+    return -1;
+}
+
+int cluster_delete(ClusterClient *cc, const char *filename) {
+    if (!cc || !filename) return -1;
+    int nodes[CLUSTER_READ_TRIES];
+    int n = hashring_lookup_n(&cc->ring, cc->username, filename, nodes, CLUSTER_READ_TRIES);
+    for (int i = 0; i < n; i++) {
+        Client *c = node_conn(cc, nodes[i]);
+        if (!c) continue;
+        int rc = client_delete(c, cc->username, filename);
+        if (rc == 0) return 0;
+        /* Not on this node is an answer; only a broken stream needs a new connection */
+        if (rc != CLIENT_REFUSED) client_disconnect(c);
+    }
+    return -1;
+}
+
+const char *cluster_owner(ClusterClient *cc, const char *filename) {
+    if (!cc || !filename) return NULL;
+    int node = hashring_lookup(&cc->ring, cc->username, filename);
+    return node < 0 ? NULL : cc->ring.nodes[node];
+}
+
+void cluster_client_destroy(ClusterClient *cc) {
+    if (!cc) return;
+    for (int i = 0; i < cc->ring.node_count; i++)
+        if (cc->conns[i].is_connected) client_disconnect(&cc->conns[i]);
+    hashring_free(&cc->ring);
+    free(cc);
+}
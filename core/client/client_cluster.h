@@ -0,0 +1,37 @@
+#ifndef CLIENT_CLUSTER_H
+#define CLIENT_CLUSTER_H
+
+#include "client.h"
+#include "../common/hashring.h"
+
+/*
+ * Cluster client. Routes every request straight to the node owning its
+ * user/filename on the consistent-hash ring built from the cluster node
+ * list (see hashring.h), keeping one authenticated connection per node,
+ * made on first use and re-made after a failure.
+ *
+ * While the cluster rebalances after a node was added, a file may still be
+ * on the node that owned it before; downloads and deletes that miss on the
+ * owner are retried on that node. A ClusterClient is not thread-safe.
+ */
+
+typedef struct ClusterClient ClusterClient;
+
+/* Load the node list (NULL = data/cluster.conf) for one user; returns NULL
+ * if the list is missing or empty */
+ClusterClient *cluster_client_create(const char *config_path, const char *username,
+                                     const char *password);
+
+/* Same as client_upload/client_download/client_delete, on the owning node
+ * (return 0 on success) */
+int cluster_upload(ClusterClient *cc, const char *filepath);
+int cluster_download(ClusterClient *cc, const char *filename, const char *save_path);
+int cluster_delete(ClusterClient *cc, const char *filename);
+
+/* "host:port" of the node owning filename (NULL if the ring is empty) */
+const char *cluster_owner(ClusterClient *cc, const char *filename);
+
+/* Close all connections and free the client */
+void cluster_client_destroy(ClusterClient *cc);
+
+#endif /* CLIENT_CLUSTER_H */
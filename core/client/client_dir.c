@@ -0,0 +1,409 @@
+#include "client_dir.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Server copy of one file, from the listing */
+typedef struct {
+    char *name;
+    uint64_t size;
+    int64_t mtime;
+} RemoteFile;
+
+/* Open-addressing table of the listing, read-only once the walk starts */
+typedef struct {
+    RemoteFile *slots;
+    size_t cap;             /* power of two */
+    size_t count;
+    int failed;
+} RemoteIndex;
+
+typedef struct {
+    char local[PATH_LEN];
+    char remote[FILE_NAME_LEN];
+} DirFile;
+
+typedef struct {
+    const char *host;
+    int port;
+    const char *username;
+    const char *password;
+    const char *root;
+    const char *prefix;
+    RemoteIndex remote;
+
+    pthread_mutex_t lock;
+    pthread_cond_t dirs_ready;      /* a directory was pushed or the walk ended */
+    pthread_cond_t files_ready;     /* a file was queued or the walk ended */
+    pthread_cond_t files_space;     /* a queued file was taken */
+    pthread_cond_t finished;        /* an upload worker exited */
+
+    char **dirs;                    /* directories still to read, relative */
+    size_t ndirs, dirs_cap;
+    int walking;                    /* walkers reading a directory right now */
+    int walk_done;
+    int stopping;                   /* no upload worker: stop queueing */
+
+    DirFile queue[DIR_UPLOAD_QUEUE];
+    size_t head, queued;
+    int workers_left;
+
+    DirUploadStats stats;           /* counters only; rates filled in on report */
+    uint64_t bytes_sent;            /* atomic, updated from upload progress */
+} DirUpload;
+
+static size_t remote_slot(const RemoteIndex *ix, const char *name) {
+    return fnv1a64(name, strlen(name), FNV64_OFFSET) & (ix->cap - 1);
+}
+
+static int remote_grow(RemoteIndex *ix) {
+    size_t cap = ix->cap ? ix->cap * 2 : 1024;
+    RemoteFile *slots = calloc(cap, sizeof(RemoteFile));
+    if (!slots) return -1;
+    RemoteIndex grown = { slots, cap, ix->count, 0 };
+    for (size_t i = 0; i < ix->cap; i++) {
+        if (!ix->slots[i].name) continue;
+        size_t s = remote_slot(&grown, ix->slots[i].name);
+        while (slots[s].name) s = (s + 1) & (cap - 1);
+        slots[s] = ix->slots[i];
+    }
+    free(ix->slots);
+    *ix = grown;
+    return 0;
+}
+
+static void remote_add(const char *name, uint64_t size, int64_t mtime, void *arg) {
+    RemoteIndex *ix = (RemoteIndex*)arg;
+    if (ix->failed) return;
+    if ((ix->count + 1) * 2 > ix->cap && remote_grow(ix) < 0) {
+        ix->failed = 1;
+        return;
+    }
+    size_t s = remote_slot(ix, name);
+    while (ix->slots[s].name) s = (s + 1) & (ix->cap - 1);
+    ix->slots[s].name = strdup(name);
+    if (!ix->slots[s].name) {
+        ix->failed = 1;
+        return;
+    }
+    ix->slots[s].size = size;
+    ix->slots[s].mtime = mtime;
+    ix->count++;
+}
+
+static const RemoteFile *remote_find(const RemoteIndex *ix, const char *name) {
+    if (!ix->cap) return NULL;
+    for (size_t s = remote_slot(ix, name); ix->slots[s].name; s = (s + 1) & (ix->cap - 1)) {
+        if (strcmp(ix->slots[s].name, name) == 0) return &ix->slots[s];
+    }
+    return NULL;
+}
+
+static void remote_free(RemoteIndex *ix) {
+    for (size_t i = 0; i < ix->cap; i++) free(ix->slots[i].name);
+    free(ix->slots);
+    memset(ix, 0, sizeof(*ix));
+}
+
+/* Called with u->lock held */
+static int push_dir(DirUpload *u, const char *rel) {
+    if (u->ndirs == u->dirs_cap) {
+        size_t cap = u->dirs_cap ? u->dirs_cap * 2 : 64;
+        char **dirs = realloc(u->dirs, cap * sizeof(char*));
+        if (!dirs) return -1;
+        u->dirs = dirs;
+        u->dirs_cap = cap;
+    }
+    char *copy = strdup(rel);
+    if (!copy) return -1;
+    u->dirs[u->ndirs++] = copy;
+    pthread_cond_signal(&u->dirs_ready);
+    return 0;
+}
+
+/* Count a regular file, then skip it or queue it for the upload workers */
+static void found_file(DirUpload *u, const char *rel, const struct stat *st) {
+    DirFile f;
+    int n = snprintf(f.remote, sizeof(f.remote), "%s%s", u->prefix, rel);
+    int too_long = n < 0 || (size_t)n >= sizeof(f.remote);
+    snprintf(f.local, sizeof(f.local), "%s/%s", u->root, rel);
+
+    const RemoteFile *r = too_long ? NULL : remote_find(&u->remote, f.remote);
+    int unchanged = r && r->size == (uint64_t)st->st_size && r->mtime == (int64_t)st->st_mtime;
+
+    pthread_mutex_lock(&u->lock);
+    u->stats.files_found++;
+    if (too_long || u->stopping) {
+        u->stats.files_failed++;
+    } else if (unchanged) {
+        u->stats.files_skipped++;
+    } else {
+        while (u->queued == DIR_UPLOAD_QUEUE)
+            pthread_cond_wait(&u->files_space, &u->lock);
+        u->queue[(u->head + u->queued) % DIR_UPLOAD_QUEUE] = f;
+        u->queued++;
+        pthread_cond_signal(&u->files_ready);
+    }
+    pthread_mutex_unlock(&u->lock);
+
+    if (too_long) {
+        char msg[PATH_LEN + 64];
+        snprintf(msg, sizeof(msg), "client_upload_dir: name too long, not uploaded: %.400s", rel);
+        log_message("WARN", msg);
+    }
+}
+
+static void read_dir(DirUpload *u, const char *rel) {
+    char path[PATH_LEN];
+    if (*rel) snprintf(path, sizeof(path), "%s/%s", u->root, rel);
+    else snprintf(path, sizeof(path), "%s", u->root);
+
+    DIR *d = opendir(path);
+    if (!d) {
+        char msg[PATH_LEN + 64];
+        snprintf(msg, sizeof(msg), "client_upload_dir: cannot read %s", path);
+        log_message("WARN", msg);
+        return;
+    }
+
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0) continue;
+
+        char child[PATH_LEN];
+        int n = *rel ? snprintf(child, sizeof(child), "%s/%s", rel, e->d_name)
+                     : snprintf(child, sizeof(child), "%s", e->d_name);
+        struct stat st;
+        if (n < 0 || (size_t)n >= sizeof(child) ||
+            fstatat(dirfd(d), e->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+            continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            pthread_mutex_lock(&u->lock);
+            int rc = push_dir(u, child);
+            pthread_mutex_unlock(&u->lock);
+            if (rc < 0) log_message("ERROR", "client_upload_dir: out of memory");
+        } else if (S_ISREG(st.st_mode)) {
+            found_file(u, child, &st);
+        }
+    }
+    closedir(d);
+}
+
+/* Walkers share the directory stack; the walk is over once it is empty
+ * and no walker is still reading a directory that could add to it */
+static void *walk_thread(void *arg) {
+    DirUpload *u = (DirUpload*)arg;
+
+    pthread_mutex_lock(&u->lock);
+    for (;;) {
+        while (u->ndirs == 0 && u->walking > 0)
+            pthread_cond_wait(&u->dirs_ready, &u->lock);
+        if (u->ndirs == 0) {
+            u->walk_done = 1;
+            pthread_cond_broadcast(&u->dirs_ready);
+            pthread_cond_broadcast(&u->files_ready);
+            break;
+        }
+        char *rel = u->dirs[--u->ndirs];
+        u->walking++;
+        int stopping = u->stopping;
+        pthread_mutex_unlock(&u->lock);
+
+        if (!stopping) read_dir(u, rel);
+        free(rel);
+
+        pthread_mutex_lock(&u->lock);
+        u->walking--;
+        if (u->ndirs == 0 && u->walking == 0) pthread_cond_broadcast(&u->dirs_ready);
+    }
+    pthread_mutex_unlock(&u->lock);
+    return NULL;
+}
+
+typedef struct {
+    DirUpload *u;
+    uint64_t last;
+} SentProgress;
+
+static void sent_progress(uint64_t done, uint64_t total, void *arg) {
+    UNUSED(total);
+    SentProgress *sp = (SentProgress*)arg;
+    __atomic_add_fetch(&sp->u->bytes_sent, done - sp->last, __ATOMIC_RELAXED);
+    sp->last = done;
+}
+
+static int worker_connect(DirUpload *u, Client *c) {
+    if (client_connect(c, u->host, u->port) != 0) return -1;
+    if (client_auth(c, u->username, u->password) != 0) {
+        client_disconnect(c);
+        return -1;
+    }
+    return 0;
+}
+
+static void *upload_thread(void *arg) {
+    DirUpload *u = (DirUpload*)arg;
+    Client c;
+    memset(&c, 0, sizeof(c));
+
+    pthread_mutex_lock(&u->lock);
+    for (;;) {
+        while (u->queued == 0 && !u->walk_done)
+            pthread_cond_wait(&u->files_ready, &u->lock);
+        if (u->queued == 0) break;
+        DirFile f = u->queue[u->head];
+        u->head = (u->head + 1) % DIR_UPLOAD_QUEUE;
+        u->queued--;
+        pthread_cond_signal(&u->files_space);
+        pthread_mutex_unlock(&u->lock);
+
+        int rc = -1;
+        if (c.is_connected || worker_connect(u, &c) == 0) {
+            SentProgress sp = { u, 0 };
+            rc = client_upload_as(&c, u->username, f.local, f.remote, sent_progress, &sp);
+            /* A failed upload may leave the stream mid-payload */
+            if (rc != 0) client_disconnect(&c);
+        }
+
+        pthread_mutex_lock(&u->lock);
+        if (rc == 0) u->stats.files_uploaded++;
+        else u->stats.files_failed++;
+    }
+    u->workers_left--;
+    pthread_cond_broadcast(&u->finished);
+    pthread_mutex_unlock(&u->lock);
+
+    client_disconnect(&c);
+    return NULL;
+}
+
+/* Called with u->lock held */
+static DirUploadStats snapshot(DirUpload *u, const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    DirUploadStats s = u->stats;
+    s.bytes_sent = __atomic_load_n(&u->bytes_sent, __ATOMIC_RELAXED);
+    s.elapsed = (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+    if (s.elapsed > 0) {
+        s.files_per_sec = (s.files_uploaded + s.files_skipped) / s.elapsed;
+        s.mb_per_sec = s.bytes_sent / 1e6 / s.elapsed;
+    }
+    return s;
+}
+
+int client_upload_dir(const char *host, int port, const char *username, const char *password,
+                      const char *local_dir, const char *remote_prefix, int workers,
+                      client_dir_report_fn report, void *arg) {
+    if (!host || !username || !password || !local_dir) return -1;
+    if (workers < 1) workers = 1;
+    if (workers > DIR_MAX_WORKERS) workers = DIR_MAX_WORKERS;
+
+    struct stat st;
+    if (stat(local_dir, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        char msg[PATH_LEN + 64];
+        snprintf(msg, sizeof(msg), "client_upload_dir: not a directory: %s", local_dir);
+        log_message("ERROR", msg);
+        return -1;
+    }
+
+    DirUpload *u = calloc(1, sizeof(DirUpload));
+    if (!u) return -1;
+    u->host = host;
+    u->port = port;
+    u->username = username;
+    u->password = password;
+    u->root = local_dir;
+    u->prefix = remote_prefix ? remote_prefix : "";
+
+    /* One listing up front decides which files are already there */
+    Client c;
+    memset(&c, 0, sizeof(c));
+    int listed = worker_connect(u, &c) == 0
+                 ? client_list(&c, username, u->prefix, remote_add, &u->remote) : -1;
+    client_disconnect(&c);
+    if (listed < 0 || u->remote.failed) {
+        log_message("ERROR", "client_upload_dir: cannot list the server's files");
+        remote_free(&u->remote);
+        free(u);
+        return -1;
+    }
+
+    pthread_mutex_init(&u->lock, NULL);
+    pthread_cond_init(&u->dirs_ready, NULL);
+    pthread_cond_init(&u->files_ready, NULL);
+    pthread_cond_init(&u->files_space, NULL);
+    pthread_cond_init(&u->finished, NULL);
+    push_dir(u, "");
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pthread_t walkers[DIR_WALK_THREADS], uploaders[DIR_MAX_WORKERS];
+    int nwalkers = 0, nuploaders = 0;
+    pthread_mutex_lock(&u->lock);
+    for (; nwalkers < DIR_WALK_THREADS; nwalkers++) {
+        if (pthread_create(&walkers[nwalkers], NULL, walk_thread, u) != 0) break;
+    }
+    for (; nuploaders < workers; nuploaders++) {
+        if (pthread_create(&uploaders[nuploaders], NULL, upload_thread, u) != 0) break;
+        u->workers_left++;
+    }
+    if (nwalkers == 0 || nuploaders == 0) {
+        /* nothing can make progress: let whatever started wind down */
+        log_message("ERROR", "client_upload_dir: cannot start threads");
+        u->stopping = 1;
+        if (nwalkers == 0) {
+            for (size_t i = 0; i < u->ndirs; i++) free(u->dirs[i]);
+            u->ndirs = 0;
+            u->walk_done = 1;
+            pthread_cond_broadcast(&u->files_ready);
+        }
+    }
+
+    /* Report while the workers run */
+    while (u->workers_left > 0) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += DIR_REPORT_MS / 1000;
+        until.tv_nsec += (long)(DIR_REPORT_MS % 1000) * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        if (pthread_cond_timedwait(&u->finished, &u->lock, &until) == ETIMEDOUT && report) {
+            DirUploadStats s = snapshot(u, &start);
+            pthread_mutex_unlock(&u->lock);
+            report(&s, arg);
+            pthread_mutex_lock(&u->lock);
+        }
+    }
+    pthread_mutex_unlock(&u->lock);
+
+    for (int i = 0; i < nwalkers; i++) pthread_join(walkers[i], NULL);
+    for (int i = 0; i < nuploaders; i++) pthread_join(uploaders[i], NULL);
+
+    DirUploadStats s = snapshot(u, &start);
+    s.done = 1;
+    if (report) report(&s, arg);
+
+    char msg[PATH_LEN + 192];
+    snprintf(msg, sizeof(msg), "Directory upload %s: %llu uploaded, %llu skipped, %llu failed, "
+             "%.1f MB in %.2f s (%.0f files/s, %.1f MB/s)", local_dir,
+             (unsigned long long)s.files_uploaded, (unsigned long long)s.files_skipped,
+             (unsigned long long)s.files_failed, s.bytes_sent / 1e6, s.elapsed,
+             s.files_per_sec, s.mb_per_sec);
+    log_message("INFO", msg);
+
+    int failed = nwalkers == 0 || nuploaders == 0 ? -1 : (int)s.files_failed;
+    pthread_mutex_destroy(&u->lock);
+    pthread_cond_destroy(&u->dirs_ready);
+    pthread_cond_destroy(&u->files_ready);
+    pthread_cond_destroy(&u->files_space);
+    pthread_cond_destroy(&u->finished);
+    free(u->dirs);
+    remote_free(&u->remote);
+    free(u);
+    return failed;
+}
@@ -0,0 +1,54 @@
+#ifndef CLIENT_DIR_H
+#define CLIENT_DIR_H
+
+#include "client.h"
+
+/*
+ * Recursive directory upload. client_upload_dir mirrors a local tree into
+ * a user's files, named by their path relative to the tree (plus an
+ * optional prefix), e.g. build/bin/app is stored as "bin/app" or
+ * "<prefix>bin/app".
+ *
+ * One listing of the server's copies is fetched first; a file whose size
+ * and mtime both match its server copy is skipped (uploads carry the local
+ * mtime, so this does not depend on the two clocks agreeing).
+ * DIR_WALK_THREADS walker threads read directories in parallel
+ * (subdirectories go on a shared stack) and feed the files still to send
+ * into a queue of DIR_UPLOAD_QUEUE entries, which blocks the walkers when
+ * the uploads fall behind. Upload workers each hold their own connection
+ * and take files from the queue until the walk is done.
+ *
+ * Symlinks and special files are not followed or uploaded. A name longer
+ * than the server allows counts as a failure.
+ */
+
+#define DIR_WALK_THREADS    4
+#define DIR_MAX_WORKERS     16
+#define DIR_UPLOAD_QUEUE    256
+#define DIR_REPORT_MS       1000
+
+/* Progress snapshot passed to the report callback */
+typedef struct {
+    uint64_t files_found;       /* regular files seen by the walkers so far */
+    uint64_t files_uploaded;
+    uint64_t files_skipped;     /* unchanged on the server */
+    uint64_t files_failed;
+    uint64_t bytes_sent;        /* file data sent so far */
+    double   elapsed;           /* seconds since the walk started */
+    double   files_per_sec;     /* uploaded + skipped */
+    double   mb_per_sec;
+    int      done;              /* last report, everything finished */
+} DirUploadStats;
+
+typedef void (*client_dir_report_fn)(const DirUploadStats *stats, void *arg);
+
+/* Upload every regular file under local_dir with `workers` connections
+ * (1..DIR_MAX_WORKERS). report, if set, is called every DIR_REPORT_MS and
+ * once more at the end, on the calling thread. Returns the number of files
+ * that failed (0 = everything uploaded or skipped), -1 if the upload could
+ * not start (local_dir unreadable, no connection or listing). */
+int client_upload_dir(const char *host, int port, const char *username, const char *password,
+                      const char *local_dir, const char *remote_prefix, int workers,
+                      client_dir_report_fn report, void *arg);
+
+#endif /* CLIENT_DIR_H */
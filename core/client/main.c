@@ -1,14 +1,70 @@
 #include "client.h"
+#include "client_dir.h"
 
-int main() {
+/* One status line, rewritten in place until the last report */
+static void print_dir_report(const DirUploadStats *s, void *arg) {
+    UNUSED(arg);
+    printf("\r[upload-dir] %llu files: %llu uploaded, %llu unchanged, %llu failed | "
+           "%.1f MB | %.0f files/s, %.1f MB/s   ",
+           (unsigned long long)s->files_found, (unsigned long long)s->files_uploaded,
+           (unsigned long long)s->files_skipped, (unsigned long long)s->files_failed,
+           s->bytes_sent / 1e6, s->files_per_sec, s->mb_per_sec);
+    if (s->done) printf("\n[upload-dir] done in %.2f s\n", s->elapsed);
+    fflush(stdout);
+}
+
+static int usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s                      upload and download test.txt\n"
+            "       %s --upload-dir DIR [--to PREFIX] [--workers N]\n"
+            "              [--host HOST] [--port PORT] [--user USER] [--password PASSWORD]\n",
+            prog, prog);
+    return 2;
+}
+
+int main(int argc, char *argv[]) {
     init_logging();
+
+    const char *host = "127.0.0.1";
+    int port = 8080;
+    const char *user = "testuser";
+    const char *password = "password";
+    const char *upload_dir = NULL;
+    const char *prefix = "";
+    int workers = 4;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) return usage(argv[0]);
+        if (strcmp(argv[i], "--upload-dir") == 0)
+            upload_dir = argv[++i];
+        else if (strcmp(argv[i], "--to") == 0)
+            prefix = argv[++i];
+        else if (strcmp(argv[i], "--workers") == 0)
+            workers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--host") == 0)
+            host = argv[++i];
+        else if (strcmp(argv[i], "--port") == 0)
+            port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--user") == 0)
+            user = argv[++i];
+        else if (strcmp(argv[i], "--password") == 0)
+            password = argv[++i];
+        else
+            return usage(argv[0]);
+    }
+
+    if (upload_dir) {
+        int failed = client_upload_dir(host, port, user, password, upload_dir, prefix, workers,
+                                       print_dir_report, NULL);
+        return failed == 0 ? 0 : 1;
+    }
+
     Client c;
 
-    if (client_connect(&c, "127.0.0.1", 8080) != 0) return 1;
+    if (client_connect(&c, host, port) != 0) return 1;
 
-    if (client_auth(&c, "testuser", "password") == 0) {
-        client_upload(&c, "testuser", "test.txt");
-        client_download(&c, "testuser", "test.txt", ".");
+    if (client_auth(&c, user, password) == 0) {
+        client_upload(&c, user, "test.txt");
+        client_download(&c, user, "test.txt", ".");
     }
 
     client_disconnect(&c);
@@ -0,0 +1,204 @@
+#include "transfer.h"
+#include <stdlib.h>
+#include <sys/mman.h>
+
+/* Fixed ring of XFER_SLOTS buffers. The reader thread owns slots
+ * [tail + filled, tail + XFER_SLOTS), the draining thread owns the rest. */
+typedef struct {
+    unsigned char *slab;
+    size_t len[XFER_SLOTS];
+    uint64_t head;           /* slots filled so far */
+    uint64_t tail;           /* slots drained so far */
+    int done;                /* reader finished (or failed) */
+    int failed;              /* reader hit a short read or error */
+    int abort;               /* writer failed, reader should stop */
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+    pthread_cond_t drained;
+
+    int in_fd;
+    xfer_io_fn rd;
+    uint64_t remaining;
+} XferRing;
+
+ssize_t xfer_read_full(int fd, void *buf, size_t len) {
+    size_t total = 0;
+    while (total < len) {
+        ssize_t n = read(fd, (char*)buf + total, len - total);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) break;
+        total += (size_t)n;
+    }
+    return (ssize_t)total;
+}
+
+ssize_t xfer_write_full(int fd, void *buf, size_t len) {
+    size_t total = 0;
+    while (total < len) {
+        ssize_t n = write(fd, (const char*)buf + total, len - total);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        total += (size_t)n;
+    }
+    return (ssize_t)total;
+}
+
+ssize_t xfer_send(int sockfd, void *buf, size_t len) {
+    return send_all(sockfd, buf, len);
+}
+
+ssize_t xfer_recv(int sockfd, void *buf, size_t len) {
+    return recv_all(sockfd, buf, len);
+}
+
+static void *ring_reader(void *arg) {
+    XferRing *r = (XferRing*)arg;
+
+    while (r->remaining > 0) {
+        pthread_mutex_lock(&r->lock);
+        while (r->head - r->tail == XFER_SLOTS && !r->abort)
+            pthread_cond_wait(&r->drained, &r->lock);
+        int stop = r->abort;
+        pthread_mutex_unlock(&r->lock);
+        if (stop) break;
+
+        /* The slot is ours until head is advanced, so fill it unlocked */
+        size_t slot = (size_t)(r->head % XFER_SLOTS);
+        size_t want = r->remaining < XFER_CHUNK ? (size_t)r->remaining : XFER_CHUNK;
+        ssize_t n = r->rd(r->in_fd, r->slab + slot * XFER_CHUNK, want);
+        if (n < 0 || (size_t)n != want) {
+            pthread_mutex_lock(&r->lock);
+            r->failed = 1;
+            pthread_mutex_unlock(&r->lock);
+            break;
+        }
+
+        pthread_mutex_lock(&r->lock);
+        r->len[slot] = want;
+        r->head++;
+        pthread_cond_signal(&r->filled);
+        pthread_mutex_unlock(&r->lock);
+        r->remaining -= want;
+    }
+
+    pthread_mutex_lock(&r->lock);
+    r->done = 1;
+    pthread_cond_signal(&r->filled);
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+int xfer_pipe(int in_fd, xfer_io_fn rd, int out_fd, xfer_io_fn wr, uint64_t len,
+              xfer_progress_fn progress, void *arg) {
+    if (len == 0) return 0;
+
+    XferRing r;
+    memset(&r, 0, sizeof(r));
+    r.slab = malloc((size_t)XFER_SLOTS * XFER_CHUNK);
+    if (!r.slab) {
+        log_message("ERROR", "xfer_pipe: out of memory for ring buffers");
+        return -1;
+    }
+    r.in_fd = in_fd;
+    r.rd = rd;
+    r.remaining = len;
+    pthread_mutex_init(&r.lock, NULL);
+    pthread_cond_init(&r.filled, NULL);
+    pthread_cond_init(&r.drained, NULL);
+
+    pthread_t reader;
+    if (pthread_create(&reader, NULL, ring_reader, &r) != 0) {
+        log_message("ERROR", "xfer_pipe: cannot start reader thread");
+        pthread_mutex_destroy(&r.lock);
+        pthread_cond_destroy(&r.filled);
+        pthread_cond_destroy(&r.drained);
+        free(r.slab);
+        return -1;
+    }
+
+    uint64_t written = 0;
+    for (;;) {
+        pthread_mutex_lock(&r.lock);
+        while (r.tail == r.head && !r.done)
+            pthread_cond_wait(&r.filled, &r.lock);
+        if (r.tail == r.head) {
+            pthread_mutex_unlock(&r.lock);
+            break;
+        }
+        size_t slot = (size_t)(r.tail % XFER_SLOTS);
+        size_t n = r.len[slot];
+        pthread_mutex_unlock(&r.lock);
+
+        ssize_t w = wr(out_fd, r.slab + slot * XFER_CHUNK, n);
+
+        pthread_mutex_lock(&r.lock);
+        if (w < 0 || (size_t)w != n) {
+            r.abort = 1;
+            pthread_cond_signal(&r.drained);
+            pthread_mutex_unlock(&r.lock);
+            break;
+        }
+        r.tail++;
+        pthread_cond_signal(&r.drained);
+        pthread_mutex_unlock(&r.lock);
+        written += n;
+        if (progress) progress(written, len, arg);
+    }
+
+    pthread_join(reader, NULL);
+    int rc = (!r.failed && written == len) ? 0 : -1;
+    if (rc < 0) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "xfer_pipe: %s failed after %llu of %llu bytes",
+                 r.failed ? "read" : "write", (unsigned long long)written,
+                 (unsigned long long)len);
+        log_message("ERROR", msg);
+    }
+
+    pthread_mutex_destroy(&r.lock);
+    pthread_cond_destroy(&r.filled);
+    pthread_cond_destroy(&r.drained);
+    free(r.slab);
+    return rc;
+}
+
+int xfer_send_file(int sockfd, int fd, uint64_t len, xfer_progress_fn progress, void *arg) {
+    if (len == 0) return 0;
+
+    unsigned char *map = mmap(NULL, (size_t)len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        lseek(fd, 0, SEEK_SET);
+        return xfer_pipe(fd, xfer_read_full, sockfd, xfer_send, len, progress, arg);
+    }
+    madvise(map, (size_t)len, MADV_SEQUENTIAL);
+
+    /* Keep a couple of chunks of page-cache read-ahead in flight while the
+     * current chunk is being pushed into the socket */
+    int rc = 0;
+    for (uint64_t off = 0; off < len; off += XFER_CHUNK) {
+        uint64_t ahead = off + 2 * (uint64_t)XFER_CHUNK;
+        if (ahead < len) {
+            uint64_t span = len - ahead < XFER_CHUNK ? len - ahead : XFER_CHUNK;
+            madvise(map + ahead, (size_t)span, MADV_WILLNEED);
+        }
+        size_t n = len - off < XFER_CHUNK ? (size_t)(len - off) : XFER_CHUNK;
+        ssize_t sent = send_all(sockfd, map + off, n);
+        if (sent < 0 || (size_t)sent != n) {
+            char msg[128];
+            snprintf(msg, sizeof(msg), "xfer_send_file: send failed after %llu of %llu bytes",
+                     (unsigned long long)off, (unsigned long long)len);
+            log_message("ERROR", msg);
+            rc = -1;
+            break;
+        }
+        if (progress) progress(off + n, len, arg);
+    }
+
+    munmap(map, (size_t)len);
+    return rc;
+}
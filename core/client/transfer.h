@@ -0,0 +1,35 @@
+#ifndef TRANSFER_H
+#define TRANSFER_H
+
+#include "../common/common.h"
+
+/*
+ * Bulk data movers for the client. Disk and socket I/O run concurrently:
+ * uploads stream straight from an mmap of the file with read-ahead hints,
+ * and xfer_pipe() runs a reader thread that fills a ring of large buffers
+ * while the calling thread drains it.
+ */
+
+#define XFER_CHUNK (1024 * 1024)   /* bytes per ring slot / per send */
+#define XFER_SLOTS 4               /* ring depth */
+
+/* Read or write exactly len bytes (returns len, less on EOF, -1 on error) */
+typedef ssize_t (*xfer_io_fn)(int fd, void *buf, size_t len);
+
+/* Called on the transferring thread after every chunk (may be NULL) */
+typedef void (*xfer_progress_fn)(uint64_t done, uint64_t total, void *arg);
+
+ssize_t xfer_read_full(int fd, void *buf, size_t len);
+ssize_t xfer_write_full(int fd, void *buf, size_t len);
+ssize_t xfer_send(int sockfd, void *buf, size_t len);
+ssize_t xfer_recv(int sockfd, void *buf, size_t len);
+
+/* Move len bytes from in_fd to out_fd through the ring (returns 0 on success) */
+int xfer_pipe(int in_fd, xfer_io_fn rd, int out_fd, xfer_io_fn wr, uint64_t len,
+              xfer_progress_fn progress, void *arg);
+
+/* Send len bytes of a regular file: mmap + send, falling back to
+ * xfer_pipe() when the file cannot be mapped (returns 0 on success) */
+int xfer_send_file(int sockfd, int fd, uint64_t len, xfer_progress_fn progress, void *arg);
+
+#endif /* TRANSFER_H */
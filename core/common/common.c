@@ -1,3 +1,4 @@
+#define _GNU_SOURCE     /* copy_file_range */
 #include "common.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -68,7 +69,8 @@ ssize_t send_all(int sockfd, const void *buf, size_t len) {
     size_t total = 0;
     const char *p = (const char*)buf;
     while (total < len) {
-        ssize_t n = send(sockfd, p + total, len - total, 0);
+        /* A peer that has gone away is an error return, not a SIGPIPE */
+        ssize_t n = send(sockfd, p + total, len - total, MSG_NOSIGNAL);
         if (n < 0) {
             if (errno == EINTR) continue;
             return -1;
@@ -93,3 +95,54 @@ ssize_t recv_all(int sockfd, void *buf, size_t len) {
     }
     return (ssize_t)total;
 }
+
+ssize_t copy_range(int in_fd, off_t in_off, int out_fd, size_t len) {
+    size_t total = 0;
+    int in_kernel = 1;
+    char *buf = NULL;
+    while (total < len) {
+        size_t want = len - total < COPY_RANGE_CHUNK ? len - total : COPY_RANGE_CHUNK;
+        ssize_t n;
+        if (in_kernel) {
+            loff_t off = (loff_t)in_off + (loff_t)total;
+            n = copy_file_range(in_fd, &off, out_fd, NULL, want, 0);
+            /* Not supported for this pair of files: copy through user space */
+            if (n < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+                          errno == EOPNOTSUPP)) {
+                in_kernel = 0;
+                continue;
+            }
+        } else {
+            if (!buf && !(buf = malloc(COPY_RANGE_CHUNK))) return -1;
+            n = pread(in_fd, buf, want, in_off + (off_t)total);
+            for (ssize_t w = 0; n > 0 && w < n; ) {
+                ssize_t k = write(out_fd, buf + w, (size_t)(n - w));
+                if (k < 0 && errno == EINTR) continue;
+                if (k <= 0) {
+                    n = -1;
+                    break;
+                }
+                w += k;
+            }
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            free(buf);
+            return -1;
+        }
+        if (n == 0) break;
+        total += (size_t)n;
+    }
+    free(buf);
+    return (ssize_t)total;
+}
+
+uint64_t fnv1a64(const void *data, size_t len, uint64_t seed) {
+    const unsigned char *p = (const unsigned char*)data;
+    uint64_t h = seed;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
@@ -37,4 +37,14 @@ void get_log_filename(char *buffer, size_t len);
 ssize_t send_all(int sockfd, const void *buf, size_t len);
 ssize_t recv_all(int sockfd, void *buf, size_t len);
 
+/* Copy len bytes from in_fd at in_off to out_fd's current position, inside
+ * the kernel when the filesystems allow it (returns bytes copied, less on
+ * EOF, -1 on error) */
+#define COPY_RANGE_CHUNK (4 * 1024 * 1024)
+ssize_t copy_range(int in_fd, off_t in_off, int out_fd, size_t len);
+
+/* 64-bit FNV-1a; pass FNV64_OFFSET as seed, or a previous result to chain */
+#define FNV64_OFFSET    0xcbf29ce484222325ULL
+uint64_t fnv1a64(const void *data, size_t len, uint64_t seed);
+
 #endif /* COMMON_H */
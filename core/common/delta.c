@@ -0,0 +1,112 @@
+#include "delta.h"
+#include <string.h>
+#include <arpa/inet.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+size_t delta_block_size(uint64_t filesize) {
+    uint64_t b = 1;
+    while (b * b < filesize) b <<= 1;
+    /* round the power-of-two estimate down towards sqrt(filesize) in 1 KB steps */
+    while (b > 1024 && (b - 1024) * (b - 1024) >= filesize) b -= 1024;
+    if (b < DELTA_MIN_BLOCK) b = DELTA_MIN_BLOCK;
+    if (b > DELTA_MAX_BLOCK) b = DELTA_MAX_BLOCK;
+    return (size_t)b;
+}
+
+uint32_t delta_weak_sum(const unsigned char *p, size_t len) {
+    uint32_t s1 = 0, s2 = 0;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    /* For 16-byte chunks c = 0..n-1 (m = 16n bytes):
+     *   s2 over the first m bytes = 16 * sum_c (n-1-c) * S_c + sum_c sum_t (16-t) * a[c][t]
+     * The first term is accumulated by adding the running byte total before
+     * each chunk; the second with a 16-bit multiply-add against 16..1. */
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w_lo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+    const __m128i w_hi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+    __m128i run = zero, prefix = zero, weighted = zero;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+        prefix = _mm_add_epi32(prefix, run);
+        run = _mm_add_epi32(run, _mm_sad_epu8(v, zero));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        weighted = _mm_add_epi32(weighted, _mm_madd_epi16(lo, w_lo));
+        weighted = _mm_add_epi32(weighted, _mm_madd_epi16(hi, w_hi));
+    }
+
+    uint32_t r[4], pf[4], w[4];
+    _mm_storeu_si128((__m128i*)r, run);
+    _mm_storeu_si128((__m128i*)pf, prefix);
+    _mm_storeu_si128((__m128i*)w, weighted);
+    s1 = r[0] + r[2];
+    s2 = 16 * (pf[0] + pf[2]) + w[0] + w[1] + w[2] + w[3];
+
+    /* s2 above is weighted relative to m; shift it to the full length */
+    s2 += (uint32_t)(len - i) * s1;
+#endif
+
+    for (; i < len; i++) {
+        s1 += p[i];
+        s2 += (uint32_t)(len - i) * p[i];
+    }
+    return (s1 & 0xffff) | (s2 << 16);
+}
+
+void delta_weak_sums(const unsigned char *p, size_t count, size_t block,
+                     uint32_t *out, uint16_t *scratch) {
+    /* Prefix sums make every window independent of its neighbour:
+     *   s1(k) = P[k+L] - P[k]
+     *   s2(k) = (k+L) * s1(k) - (Q[k+L] - Q[k])
+     * with P[n] = sum a[i], Q[n] = sum i*a[i] over i < n. Everything is only
+     * needed mod 2^16, so 16-bit lanes suffice and wrap-around is harmless. */
+    size_t span = count + block - 1;   /* the last window ends here */
+    uint16_t *P = scratch;
+    uint16_t *Q = scratch + span + 1;
+
+    P[0] = Q[0] = 0;
+    for (size_t n = 0; n < span; n++) {
+        P[n + 1] = (uint16_t)(P[n] + p[n]);
+        Q[n + 1] = (uint16_t)(Q[n] + (uint16_t)n * p[n]);
+    }
+
+    size_t k = 0;
+#if defined(__SSE2__)
+    __m128i kl = _mm_add_epi16(_mm_set1_epi16((short)block),
+                               _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7));
+    const __m128i step = _mm_set1_epi16(8);
+    for (; k + 8 <= count; k += 8) {
+        __m128i s1 = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(P + k + block)),
+                                   _mm_loadu_si128((const __m128i*)(P + k)));
+        __m128i dq = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(Q + k + block)),
+                                   _mm_loadu_si128((const __m128i*)(Q + k)));
+        __m128i s2 = _mm_sub_epi16(_mm_mullo_epi16(kl, s1), dq);
+        _mm_storeu_si128((__m128i*)(out + k), _mm_unpacklo_epi16(s1, s2));
+        _mm_storeu_si128((__m128i*)(out + k + 4), _mm_unpackhi_epi16(s1, s2));
+        kl = _mm_add_epi16(kl, step);
+    }
+#endif
+    for (; k < count; k++) {
+        uint16_t s1 = (uint16_t)(P[k + block] - P[k]);
+        uint16_t s2 = (uint16_t)((uint16_t)(k + block) * s1 - (uint16_t)(Q[k + block] - Q[k]));
+        out[k] = (uint32_t)s1 | ((uint32_t)s2 << 16);
+    }
+}
+
+void delta_sig_pack(const BlockSig *sig, unsigned char out[DELTA_SIG_SIZE]) {
+    uint32_t w = htonl(sig->weak);
+    memcpy(out, &w, 4);
+    memcpy(out + 4, sig->strong, MD5_DIGEST_LEN);
+}
+
+void delta_sig_unpack(const unsigned char in[DELTA_SIG_SIZE], BlockSig *sig) {
+    uint32_t w;
+    memcpy(&w, in, 4);
+    sig->weak = ntohl(w);
+    memcpy(sig->strong, in + 4, MD5_DIGEST_LEN);
+}
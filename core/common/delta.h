@@ -0,0 +1,45 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "md5.h"
+
+/*
+ * rsync-style block matching shared by client and server.
+ *
+ * The server splits its copy of a file into fixed blocks and sends one
+ * signature per block: a weak rolling checksum plus an MD5. The client slides
+ * a window over the new file, looks the weak sum of every offset up in a hash
+ * of the signatures and confirms hits with MD5.
+ *
+ * Weak sum of a[0..L-1] (same as rsync, unsigned bytes):
+ *   s1 = sum a[j]            (mod 2^16)
+ *   s2 = sum (L - j) * a[j]  (mod 2^16)
+ *   weak = s1 | (s2 << 16)
+ */
+
+#define DELTA_MIN_BLOCK   2048
+#define DELTA_MAX_BLOCK   (128 * 1024)
+#define DELTA_SIG_SIZE    (4 + MD5_DIGEST_LEN)   /* wire size of one block signature */
+
+typedef struct {
+    uint32_t weak;
+    unsigned char strong[MD5_DIGEST_LEN];
+} BlockSig;
+
+/* Block length for a basis file of the given size (~sqrt(size), clamped) */
+size_t delta_block_size(uint64_t filesize);
+
+/* Weak checksum of one block */
+uint32_t delta_weak_sum(const unsigned char *p, size_t len);
+
+/* Weak checksums of `count` consecutive windows: out[k] = delta_weak_sum(p + k, block).
+ * Reads the count + block - 1 bytes at p. scratch must hold 2 * (count + block + 1) entries. */
+void delta_weak_sums(const unsigned char *p, size_t count, size_t block,
+                     uint32_t *out, uint16_t *scratch);
+
+void delta_sig_pack(const BlockSig *sig, unsigned char out[DELTA_SIG_SIZE]);
+void delta_sig_unpack(const unsigned char in[DELTA_SIG_SIZE], BlockSig *sig);
+
+#endif /* DELTA_H */
@@ -0,0 +1,127 @@
+#include "hashring.h"
+
+/* FNV-1a spreads short, similar strings ("host:port#17") poorly across the
+ * top bits; a 64-bit finalizer fixes that */
+static uint64_t mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t key_hash(const char *user, const char *filename) {
+    uint64_t h = fnv1a64(user, strlen(user) + 1, FNV64_OFFSET);
+    return mix64(fnv1a64(filename, strlen(filename), h));
+}
+
+static int point_cmp(const void *a, const void *b) {
+    const HashRingPoint *pa = (const HashRingPoint*)a;
+    const HashRingPoint *pb = (const HashRingPoint*)b;
+    if (pa->hash != pb->hash) return pa->hash < pb->hash ? -1 : 1;
+    return pa->node - pb->node;
+}
+
+void hashring_init(HashRing *ring) {
+    memset(ring, 0, sizeof(*ring));
+}
+
+void hashring_free(HashRing *ring) {
+    free(ring->points);
+    hashring_init(ring);
+}
+
+int hashring_find(const HashRing *ring, const char *addr) {
+    for (int i = 0; i < ring->node_count; i++) {
+        if (strcmp(ring->nodes[i], addr) == 0) return i;
+    }
+    return -1;
+}
+
+int hashring_add(HashRing *ring, const char *addr) {
+    int existing = hashring_find(ring, addr);
+    if (existing >= 0) return existing;
+    if (ring->node_count == HASHRING_MAX_NODES || strlen(addr) >= HASHRING_ADDR_LEN) return -1;
+
+    HashRingPoint *pts = realloc(ring->points,
+                                 (ring->point_count + HASHRING_VNODES) * sizeof(HashRingPoint));
+    if (!pts) return -1;
+    ring->points = pts;
+
+    int node = ring->node_count++;
+    strcpy(ring->nodes[node], addr);
+    /* Points depend only on the address, so every member computes the same ring */
+    for (int v = 0; v < HASHRING_VNODES; v++) {
+        char label[HASHRING_ADDR_LEN + 16];
+        int len = snprintf(label, sizeof(label), "%s#%d", addr, v);
+        HashRingPoint *p = &ring->points[ring->point_count++];
+        p->hash = mix64(fnv1a64(label, (size_t)len, FNV64_OFFSET));
+        p->node = node;
+    }
+    qsort(ring->points, ring->point_count, sizeof(HashRingPoint), point_cmp);
+    return node;
+}
+
+int hashring_load(HashRing *ring, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+
+    hashring_free(ring);
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char addr[HASHRING_ADDR_LEN];
+        if (sscanf(line, "%271s", addr) != 1) continue;
+        if (hashring_add(ring, addr) < 0) {
+            char msg[HASHRING_ADDR_LEN + 64];
+            snprintf(msg, sizeof(msg), "hashring_load: cannot add node %s", addr);
+            log_message("WARN", msg);
+        }
+    }
+    fclose(fp);
+    return ring->node_count;
+}
+
+/* First point at or after h, wrapping around */
+static size_t successor(const HashRing *ring, uint64_t h) {
+    size_t lo = 0, hi = ring->point_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ring->points[mid].hash < h) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo == ring->point_count ? 0 : lo;
+}
+
+int hashring_lookup(const HashRing *ring, const char *user, const char *filename) {
+    if (ring->point_count == 0) return -1;
+    return ring->points[successor(ring, key_hash(user, filename))].node;
+}
+
+int hashring_lookup_n(const HashRing *ring, const char *user, const char *filename,
+                      int *out, int n) {
+    if (ring->point_count == 0 || n <= 0) return 0;
+    int found = 0;
+    size_t start = successor(ring, key_hash(user, filename));
+    for (size_t k = 0; k < ring->point_count && found < n && found < ring->node_count; k++) {
+        int node = ring->points[(start + k) % ring->point_count].node;
+        int seen = 0;
+        for (int j = 0; j < found; j++) seen |= out[j] == node;
+        if (!seen) out[found++] = node;
+    }
+    return found;
+}
+
+int hashring_split_addr(const char *addr, char *host, size_t host_len, int *port) {
+    const char *colon = strrchr(addr, ':');
+    if (!colon || colon == addr || (size_t)(colon - addr) >= host_len) return -1;
+    char *end;
+    long p = strtol(colon + 1, &end, 10);
+    if (*end != '\0' || p <= 0 || p > 65535) return -1;
+    memcpy(host, addr, (size_t)(colon - addr));
+    host[colon - addr] = '\0';
+    *port = (int)p;
+    return 0;
+}
@@ -0,0 +1,60 @@
+#ifndef HASHRING_H
+#define HASHRING_H
+
+#include "common.h"
+
+/*
+ * Consistent-hash ring for cluster mode, shared by the client (routing) and
+ * the server (rebalancing). Every node owns HASHRING_VNODES points on a
+ * 64-bit ring; a user/filename key belongs to the first point at or after
+ * its hash. Adding a node only moves the keys that land on its new points,
+ * all of which previously belonged to the next node clockwise.
+ *
+ * The node list is a text file (data/cluster.conf by default), one
+ * host:port per line, '#' starts a comment. Every node and client must use
+ * the same list; its order does not matter.
+ */
+
+#define HASHRING_CONFIG_FILE "data/cluster.conf"
+#define HASHRING_MAX_NODES   64
+#define HASHRING_VNODES      160
+#define HASHRING_ADDR_LEN    272     /* host (255) + ':' + port */
+
+typedef struct {
+    uint64_t hash;
+    int node;
+} HashRingPoint;
+
+typedef struct {
+    char nodes[HASHRING_MAX_NODES][HASHRING_ADDR_LEN];
+    int node_count;
+    HashRingPoint *points;     /* sorted by hash */
+    size_t point_count;
+} HashRing;
+
+void hashring_init(HashRing *ring);
+void hashring_free(HashRing *ring);
+
+/* Add a "host:port" node (returns its index, -1 if full or out of memory;
+ * adding an existing node returns its index) */
+int hashring_add(HashRing *ring, const char *addr);
+
+/* Build the ring from a node list file (returns node count, -1 on error) */
+int hashring_load(HashRing *ring, const char *path);
+
+/* Index of the node owning user/filename (-1 if the ring is empty) */
+int hashring_lookup(const HashRing *ring, const char *user, const char *filename);
+
+/* Up to n distinct nodes for user/filename in ring order: the owner first,
+ * then the nodes that would own it if the ones before were removed.
+ * Returns how many were stored in out. */
+int hashring_lookup_n(const HashRing *ring, const char *user, const char *filename,
+                      int *out, int n);
+
+/* Index of the node with this "host:port" (-1 if absent) */
+int hashring_find(const HashRing *ring, const char *addr);
+
+/* Split "host:port" (returns 0 on success) */
+int hashring_split_addr(const char *addr, char *host, size_t host_len, int *port);
+
+#endif /* HASHRING_H */
@@ -0,0 +1,26 @@
+#ifndef MD5_H
+#define MD5_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MD5_DIGEST_LEN 16
+#define MD5_HEX_LEN    33   /* 32 hex chars + NUL */
+
+typedef struct {
+    uint32_t state[4];
+    uint64_t length;
+    unsigned char buffer[64];
+} Md5Ctx;
+
+void md5_init(Md5Ctx *ctx);
+void md5_update(Md5Ctx *ctx, const void *data, size_t len);
+void md5_final(Md5Ctx *ctx, unsigned char digest[MD5_DIGEST_LEN]);
+
+/* One-shot digest of a buffer */
+void md5_digest(const void *data, size_t len, unsigned char digest[MD5_DIGEST_LEN]);
+
+/* Format a digest as lowercase hex into out (at least MD5_HEX_LEN bytes) */
+void md5_to_hex(const unsigned char digest[MD5_DIGEST_LEN], char *out);
+
+#endif /* MD5_H */
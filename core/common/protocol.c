@@ -2,6 +2,7 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/socket.h>
 
 /* Initialize a packet (local representation uses host order in fields) */
 void init_packet(Packet *pkt, CommandType cmd, const char *data) {
@@ -24,19 +25,102 @@ void xor_crypt(unsigned char *data, size_t len,
     }
 }
 
-/* Send packet: write header in network order, then payload */
-int send_packet(int sockfd, const Packet *pkt) {
+size_t pack_packet(char *buf, const Packet *pkt) {
+    uint32_t len = pkt->data_length > MAX_PAYLOAD ? MAX_PAYLOAD : pkt->data_length;
     uint32_t net_cmd = htonl(pkt->command);
-    uint32_t net_len = htonl(pkt->data_length);
+    uint32_t net_len = htonl(len);
+
+    memcpy(buf, &net_cmd, sizeof(net_cmd));
+    memcpy(buf + sizeof(net_cmd), &net_len, sizeof(net_len));
+    memcpy(buf + 2 * sizeof(uint32_t), pkt->data, len);
+    return 2 * sizeof(uint32_t) + len;
+}
+
+/* Send packet in one write so Nagle never holds the payload back waiting
+ * for a delayed ACK */
+int send_packet(int sockfd, const Packet *pkt) {
+    char buf[PACKET_WIRE_MAX];
+    size_t n = pack_packet(buf, pkt);
+    if (send_all(sockfd, buf, n) < 0) return -1;
+    return 0;
+}
+
+int send_packet_fd(int sockfd, const Packet *pkt, int fd) {
+    if (fd < 0) return send_packet(sockfd, pkt);
 
-    /* send header */
-    if (send_all(sockfd, &net_cmd, sizeof(net_cmd)) < 0) return -1;
-    if (send_all(sockfd, &net_len, sizeof(net_len)) < 0) return -1;
+    char buf[PACKET_WIRE_MAX];
+    size_t n = pack_packet(buf, pkt);
+
+    union {
+        struct cmsghdr hdr;
+        char space[CMSG_SPACE(sizeof(int))];
+    } ctl;
+    memset(&ctl, 0, sizeof(ctl));
+    struct iovec iov = { buf, n };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.space;
+    msg.msg_controllen = sizeof(ctl.space);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+
+    /* The fd travels with the first byte; anything left is plain data */
+    ssize_t sent;
+    do {
+        sent = sendmsg(sockfd, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent <= 0) return -1;
+    if ((size_t)sent < n && send_all(sockfd, buf + sent, n - (size_t)sent) < 0) return -1;
+    return 0;
+}
+
+/* Read exactly len bytes, keeping an fd passed along with them */
+static int recv_all_fd(int sockfd, void *buf, size_t len, int *fd) {
+    size_t total = 0;
+    while (total < len) {
+        union {
+            struct cmsghdr hdr;
+            char space[CMSG_SPACE(sizeof(int))];
+        } ctl;
+        struct iovec iov = { (char*)buf + total, len - total };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctl.space;
+        msg.msg_controllen = sizeof(ctl.space);
+
+        ssize_t n = recvmsg(sockfd, &msg, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+            int got;
+            memcpy(&got, CMSG_DATA(cm), sizeof(int));
+            if (*fd >= 0) close(*fd);
+            *fd = got;
+        }
+        total += (size_t)n;
+    }
+    return 0;
+}
+
+/* Parse a received header and read the payload that follows */
+static int recv_payload(int sockfd, Packet *pkt, uint32_t net_cmd, uint32_t net_len) {
+    pkt->command = ntohl(net_cmd);
+    pkt->data_length = ntohl(net_len);
 
-    /* send payload if any */
     if (pkt->data_length > 0) {
-        if (send_all(sockfd, pkt->data, pkt->data_length) < 0) return -1;
+        if (pkt->data_length > MAX_PAYLOAD) return -1;
+        if (recv_all(sockfd, pkt->data, pkt->data_length) <= 0) return -1;
     }
+    /* text payloads are parsed with sscanf/strtoull: terminate when there is room */
+    if (pkt->data_length < MAX_PAYLOAD) pkt->data[pkt->data_length] = '\0';
     return 0;
 }
 
@@ -47,13 +131,17 @@ int recv_packet(int sockfd, Packet *pkt) {
 
     if (recv_all(sockfd, &net_cmd, sizeof(net_cmd)) <= 0) return -1;
     if (recv_all(sockfd, &net_len, sizeof(net_len)) <= 0) return -1;
+    return recv_payload(sockfd, pkt, net_cmd, net_len);
+}
 
-    pkt->command = ntohl(net_cmd);
-    pkt->data_length = ntohl(net_len);
-
-    if (pkt->data_length > 0) {
-        if (pkt->data_length > MAX_PAYLOAD) return -1;
-        if (recv_all(sockfd, pkt->data, pkt->data_length) <= 0) return -1;
+int recv_packet_fd(int sockfd, Packet *pkt, int *fd) {
+    *fd = -1;
+    uint32_t hdr[2];
+    if (recv_all_fd(sockfd, hdr, sizeof(hdr), fd) < 0 ||
+        recv_payload(sockfd, pkt, hdr[0], hdr[1]) < 0) {
+        if (*fd >= 0) close(*fd);
+        *fd = -1;
+        return -1;
     }
     return 0;
 }
@@ -68,6 +156,20 @@ const char *command_to_string(uint32_t cmd) {
         case CMD_EXIT: return "EXIT";
         case CMD_ACK: return "ACK";
         case CMD_ERROR: return "ERROR";
+        case CMD_DELTA: return "DELTA";
+        case CMD_DELTA_DATA: return "DELTA_DATA";
+        case CMD_DELTA_COPY: return "DELTA_COPY";
+        case CMD_DELTA_END: return "DELTA_END";
+        case CMD_REPL_HELLO: return "REPL_HELLO";
+        case CMD_REPL_PUT: return "REPL_PUT";
+        case CMD_REPL_DELETE: return "REPL_DELETE";
+        case CMD_REPL_SYNC: return "REPL_SYNC";
+        case CMD_REPL_RESYNC: return "REPL_RESYNC";
+        case CMD_UPLOAD_FD: return "UPLOAD_FD";
+        case CMD_DOWNLOAD_FD: return "DOWNLOAD_FD";
+        case CMD_ARCHIVE: return "ARCHIVE";
+        case CMD_WATCH: return "WATCH";
+        case CMD_WATCH_EVENT: return "WATCH_EVENT";
         default: return "UNKNOWN";
     }
 }
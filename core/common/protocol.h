@@ -10,15 +10,40 @@ typedef enum {
     CMD_AUTH    = 1,
     CMD_UPLOAD  = 2,
     CMD_DOWNLOAD= 3,
-    CMD_LIST    = 4,
+    CMD_LIST    = 4,       /* "user:prefix"; "size mtime name" lines, then ACK "count" */
     CMD_DELETE  = 5,
     CMD_EXIT    = 6,
     CMD_ACK     = 7,
-    CMD_ERROR   = 8
+    CMD_ERROR   = 8,
+    CMD_DELTA      = 9,    /* start a delta upload: "user:filename:size" */
+    CMD_DELTA_DATA = 10,   /* literal bytes of the new file */
+    CMD_DELTA_COPY = 11,   /* "start:count" run of basis blocks to copy */
+    CMD_DELTA_END  = 12,   /* MD5 hex of the reconstructed file */
+    CMD_REPL_HELLO  = 13,  /* primary -> secondary: "token:logid" */
+    CMD_REPL_PUT    = 14,  /* "seq:user:filename:size", then size raw bytes */
+    CMD_REPL_DELETE = 15,  /* "seq:user:filename" */
+    CMD_REPL_SYNC   = 16,  /* "seq" (empty mid-resync): end of a batch, answered by ACK */
+    CMD_UPLOAD_FD   = 17,  /* local socket: "user:filename:size" + the open file (SCM_RIGHTS) */
+    CMD_DOWNLOAD_FD = 18,  /* local socket: "user:filename", ACK "size" + the stored file or data */
+    CMD_ARCHIVE     = 19,  /* "user:tar|tgz:prefix", ACK "size:count" + a tar of the matching files */
+    CMD_WATCH       = 20,  /* "user:prefix", ACK "WATCHING"; the connection then only gets events */
+    CMD_WATCH_EVENT = 21,  /* server -> watcher: one "kind size md5 name" line per change */
+    CMD_REPL_RESYNC = 22   /* primary -> secondary: a full copy follows; files it leaves out are deleted */
 } CommandType;
 
 #define MAX_PAYLOAD (BUFFER_SIZE)
 
+/* A compressed CMD_ARCHIVE stream (ACK size 0) is sent as frames of a
+ * 4-byte length (network order) and at most this many bytes; a frame of
+ * length 0 ends it */
+#define ARCHIVE_FRAME_MAX (256 * 1024)
+
+/* Same-host clients reach the server on port P through this Unix socket
+ * (relative to the working directory, like the rest of data/). Setting
+ * LOCALBIN_LOCAL_SOCKET=0 makes clients use TCP anyway. */
+#define LOCAL_SOCKET_FMT "data/localbin-%d.sock"
+#define LOCAL_SOCKET_ENV "LOCALBIN_LOCAL_SOCKET"
+
 typedef struct {
     uint32_t command;      /* network order when sent */
     uint32_t data_length;  /* network order when sent */
@@ -29,6 +54,20 @@ typedef struct {
 void init_packet(Packet *pkt, CommandType cmd, const char *data);
 int send_packet(int sockfd, const Packet *pkt);
 int recv_packet(int sockfd, Packet *pkt);
+
+/* Wire form of a packet: header in network order, then the payload
+ * (returns bytes used, at most PACKET_WIRE_MAX) */
+#define PACKET_WIRE_MAX (2 * sizeof(uint32_t) + MAX_PAYLOAD)
+size_t pack_packet(char *buf, const Packet *pkt);
+
+/* Unix sockets only: send a packet with an open fd attached (fd < 0 sends
+ * none), and receive one that may carry an fd (*fd = -1 if it did not).
+ * The sender keeps its own copy of the fd. */
+int send_packet_fd(int sockfd, const Packet *pkt, int fd);
+int recv_packet_fd(int sockfd, Packet *pkt, int *fd);
 const char *command_to_string(uint32_t cmd);
 
+/* XOR data in place with a repeating key (obfuscation, not encryption) */
+void xor_crypt(unsigned char *data, size_t len, const unsigned char *key, size_t key_len);
+
 #endif /* PROTOCOL_H */
@@ -0,0 +1,154 @@
+#include "tcp_tune.h"
+#include <stddef.h>
+#include <sys/socket.h>
+/* glibc's <netinet/tcp.h> struct tcp_info predates tcpi_delivery_rate */
+#include <linux/tcp.h>
+
+/* Kernel buffer limits, [0] receive / [1] send: how far autotuning grows a
+ * buffer on its own (tcp_rmem/tcp_wmem max) and the cap on an explicit
+ * SO_RCVBUF/SO_SNDBUF (rmem_max/wmem_max) */
+static uint64_t auto_max[2], set_max[2];
+static pthread_once_t limits_once = PTHREAD_ONCE_INIT;
+
+static uint64_t read_sysctl(const char *path, int field) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return 0;
+    unsigned long long v[3] = {0, 0, 0};
+    int n = fscanf(fp, "%llu %llu %llu", &v[0], &v[1], &v[2]);
+    fclose(fp);
+    return n > field ? v[field] : 0;
+}
+
+static void load_limits(void) {
+    auto_max[0] = read_sysctl("/proc/sys/net/ipv4/tcp_rmem", 2);
+    auto_max[1] = read_sysctl("/proc/sys/net/ipv4/tcp_wmem", 2);
+    set_max[0] = read_sysctl("/proc/sys/net/core/rmem_max", 0);
+    set_max[1] = read_sysctl("/proc/sys/net/core/wmem_max", 0);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int buf_opt(const TcpTune *t) {
+    return t->sending ? SO_SNDBUF : SO_RCVBUF;
+}
+
+static int get_buf(const TcpTune *t) {
+    int val = 0;
+    socklen_t len = sizeof(val);
+    if (getsockopt(t->sockfd, SOL_SOCKET, buf_opt(t), &val, &len) < 0) return 0;
+    return val;
+}
+
+/* Sample TCP_INFO and resize the buffer and chunk to the new BDP estimate */
+static void probe(TcpTune *t) {
+    struct tcp_info ti;
+    memset(&ti, 0, sizeof(ti));
+    socklen_t len = sizeof(ti);
+    if (getsockopt(t->sockfd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0) return;
+    t->probes++;
+
+    /* A receiver mostly sends ACKs, so its own RTT sample is the one it
+     * takes from the data stream */
+    t->rtt_us = ti.tcpi_rtt;
+    if (!t->sending && ti.tcpi_rcv_rtt > t->rtt_us) t->rtt_us = ti.tcpi_rcv_rtt;
+    t->cwnd = ti.tcpi_snd_cwnd;
+    t->mss = t->sending ? ti.tcpi_snd_mss : ti.tcpi_rcv_mss;
+
+    uint64_t rate = 0;
+    if (t->sending && len >= offsetof(struct tcp_info, tcpi_delivery_rate) + sizeof(ti.tcpi_delivery_rate))
+        rate = ti.tcpi_delivery_rate;
+    uint64_t elapsed = now_ns() - t->start_ns;
+    if (elapsed > 0) {
+        uint64_t observed = t->done * 1000000000ULL / elapsed;
+        if (observed > rate) rate = observed;
+    }
+    t->rate = rate;
+    t->bdp = rate * t->rtt_us / 1000000;
+
+    /* While the buffer is what limits the window, the measured rate is
+     * buf / RTT and the target doubles each sample until the link is full.
+     * Setting a size switches off the kernel's autotuning for that buffer
+     * and the kernel grants at most twice [rw]mem_max, so only do it when
+     * that beats both the current size and what autotuning would reach. */
+    uint64_t want = 2 * t->bdp;
+    if (want > TCP_TUNE_MAX_BUF) want = TCP_TUNE_MAX_BUF;
+    uint64_t granted = want;
+    if (set_max[t->sending] && granted > set_max[t->sending]) granted = set_max[t->sending];
+    granted *= 2;
+    if (granted > (uint64_t)t->buf && granted > auto_max[t->sending]) {
+        int val = (int)want;
+        if (setsockopt(t->sockfd, SOL_SOCKET, buf_opt(t), &val, sizeof(val)) == 0) {
+            t->buf = get_buf(t);
+            t->resizes++;
+        }
+    }
+
+    size_t chunk = TCP_TUNE_MIN_CHUNK;
+    while (chunk < t->bdp / 4 && chunk < TCP_TUNE_MAX_CHUNK) chunk *= 2;
+    t->chunk = chunk < t->chunk_cap ? chunk : t->chunk_cap;
+
+    if (t->sending) {
+        int lowat = (int)(2 * t->chunk);
+        if (lowat != t->lowat &&
+            setsockopt(t->sockfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat)) == 0)
+            t->lowat = lowat;
+    }
+}
+
+void tcp_tune_begin(TcpTune *t, int sockfd, uint64_t total, int sending) {
+    pthread_once(&limits_once, load_limits);
+    memset(t, 0, sizeof(*t));
+    t->sockfd = sockfd;
+    t->sending = sending;
+    t->total = total;
+    t->start_ns = now_ns();
+    t->chunk_cap = total < TCP_TUNE_MAX_CHUNK ? (size_t)total : TCP_TUNE_MAX_CHUNK;
+    if (t->chunk_cap == 0) t->chunk_cap = 1;
+    t->chunk = t->chunk_cap < TCP_TUNE_MIN_CHUNK ? t->chunk_cap : TCP_TUNE_MIN_CHUNK;
+    t->buf_initial = t->buf = get_buf(t);
+    t->next_probe = TCP_TUNE_FIRST_PROBE;
+
+    if (sending) {
+        int on = 1;
+        setsockopt(sockfd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+    }
+    /* A reused connection already knows its RTT and rate */
+    if (total >= TCP_TUNE_FIRST_PROBE) probe(t);
+}
+
+void tcp_tune_step(TcpTune *t, size_t n) {
+    t->done += n;
+    if (t->done < t->next_probe || t->done >= t->total) return;
+    probe(t);
+    uint64_t interval = t->done < TCP_TUNE_MAX_INTERVAL ? t->done : TCP_TUNE_MAX_INTERVAL;
+    t->next_probe = t->done + interval;
+}
+
+size_t tcp_tune_chunk(const TcpTune *t, uint64_t left) {
+    return left < t->chunk ? (size_t)left : t->chunk;
+}
+
+void tcp_tune_end(TcpTune *t, const char *label) {
+    if (t->sending) {
+        int off = 0;
+        setsockopt(t->sockfd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    }
+    if (t->total < TCP_TUNE_LOG_MIN) return;
+
+    double secs = (double)(now_ns() - t->start_ns) / 1e9;
+    char msg[512];
+    snprintf(msg, sizeof(msg),
+             "tcp_tune: %s %s %llu bytes in %.3f s (%.1f MB/s): rtt %.2f ms, cwnd %u x %u, "
+             "rate %.1f MB/s, bdp %llu KB; %s %d -> %d (%d resizes), chunk %zu KB, "
+             "notsent_lowat %d KB, %d samples",
+             t->sending ? "sent" : "received", label, (unsigned long long)t->done, secs,
+             secs > 0 ? (double)t->done / secs / 1e6 : 0.0, t->rtt_us / 1000.0, t->cwnd, t->mss,
+             (double)t->rate / 1e6, (unsigned long long)(t->bdp / 1024),
+             t->sending ? "sndbuf" : "rcvbuf", t->buf_initial, t->buf, t->resizes,
+             t->chunk / 1024, t->lowat / 1024, t->probes);
+    log_message("INFO", msg);
+}
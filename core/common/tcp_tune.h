@@ -0,0 +1,63 @@
+#ifndef TCP_TUNE_H
+#define TCP_TUNE_H
+
+#include "common.h"
+
+/*
+ * Per-transfer TCP tuning. While a file moves over a connection the tuner
+ * samples TCP_INFO (RTT, congestion window, delivery rate) at growing
+ * intervals, estimates the bandwidth-delay product, and:
+ *
+ *  - raises SO_SNDBUF (sending) or SO_RCVBUF (receiving) to twice the BDP
+ *    when the kernel's current size would cap the window, never lowering it
+ *  - picks the application chunk size (bytes per send/recv call) from it
+ *  - on the sending side corks the socket for the whole transfer, so the
+ *    reply header and the first data go out together and no partial
+ *    segments are sent mid-stream, and caps the unsent backlog with
+ *    TCP_NOTSENT_LOWAT so the send buffer holds data in flight rather than
+ *    data waiting behind it
+ *
+ * What it measured and decided is logged when the transfer ends.
+ */
+
+#define TCP_TUNE_MIN_CHUNK    (64 * 1024)
+#define TCP_TUNE_MAX_CHUNK    (1024 * 1024)
+#define TCP_TUNE_MAX_BUF      (32 * 1024 * 1024)   /* kernel caps this at [rw]mem_max */
+#define TCP_TUNE_FIRST_PROBE  (256 * 1024)        /* bytes before the first sample */
+#define TCP_TUNE_MAX_INTERVAL (64 * 1024 * 1024)  /* bytes between later samples */
+#define TCP_TUNE_LOG_MIN      (1024 * 1024)       /* smaller transfers are not logged */
+
+typedef struct {
+    int sockfd;
+    int sending;
+    uint64_t total;
+    uint64_t done;
+    uint64_t next_probe;
+    uint64_t start_ns;
+    size_t chunk;          /* current bytes per send/recv call */
+    size_t chunk_cap;      /* chunk never exceeds this (size the buffer by it) */
+    int buf_initial;       /* SO_SNDBUF/SO_RCVBUF when the transfer started */
+    int buf;
+    int lowat;
+    uint32_t rtt_us;
+    uint32_t cwnd;
+    uint32_t mss;
+    uint64_t rate;         /* bytes/s, best of kernel estimate and observed */
+    uint64_t bdp;
+    int probes;
+    int resizes;
+} TcpTune;
+
+/* Start tuning a transfer of total bytes on sockfd (sending or receiving) */
+void tcp_tune_begin(TcpTune *t, int sockfd, uint64_t total, int sending);
+
+/* Account for n more bytes moved; samples and adjusts when due */
+void tcp_tune_step(TcpTune *t, size_t n);
+
+/* Bytes to move in the next send/recv call, at most `left` */
+size_t tcp_tune_chunk(const TcpTune *t, uint64_t left);
+
+/* Uncork and log the decisions for this transfer (label: e.g. file name) */
+void tcp_tune_end(TcpTune *t, const char *label);
+
+#endif /* TCP_TUNE_H */
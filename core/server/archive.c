@@ -0,0 +1,425 @@
+#include "archive.h"
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include "../common/protocol.h"
+#include "../common/tcp_tune.h"
+#include "file_ops.h"
+#include "metadata.h"
+#include "session.h"
+#include "trace.h"
+#ifdef LOCALBIN_ZLIB
+#include <zlib.h>
+#endif
+
+#define TAR_BLOCK 512
+
+typedef struct {
+    char name[FILE_NAME_LEN];
+    uint64_t size;
+    int64_t mtime;
+} ArchiveEntry;
+
+typedef struct {
+    ArchiveEntry *items;
+    size_t count;
+    size_t cap;
+    const char *prefix;
+    size_t prefix_len;
+    int failed;
+} EntryList;
+
+/* Where the tar bytes go: the socket directly, or through deflate into
+ * length-prefixed frames */
+typedef struct {
+    int sockfd;
+    TcpTune tune;
+    unsigned char *buf;     /* file read buffer (compressed mode) */
+    size_t buf_len;
+    int gz;
+#ifdef LOCALBIN_ZLIB
+    z_stream z;
+    unsigned char *zout;
+    size_t zused;
+#endif
+} ArchiveOut;
+
+static const char zero_block[TAR_BLOCK];
+
+static uint64_t tar_pad(uint64_t n) {
+    return (TAR_BLOCK - n % TAR_BLOCK) % TAR_BLOCK;
+}
+
+static void collect_entry(const FileMeta *meta, void *arg) {
+    EntryList *list = (EntryList*)arg;
+    if (list->failed || strncmp(meta->name, list->prefix, list->prefix_len) != 0) return;
+    if (list->count == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        ArchiveEntry *items = realloc(list->items, cap * sizeof(ArchiveEntry));
+        if (!items) {
+            list->failed = 1;
+            return;
+        }
+        list->items = items;
+        list->cap = cap;
+    }
+    ArchiveEntry *e = &list->items[list->count++];
+    memcpy(e->name, meta->name, FILE_NAME_LEN);
+    e->name[FILE_NAME_LEN - 1] = '\0';
+    e->size = meta->size;
+    e->mtime = meta->mtime;
+}
+
+static int entry_cmp(const void *a, const void *b) {
+    return strcmp(((const ArchiveEntry*)a)->name, ((const ArchiveEntry*)b)->name);
+}
+
+/* Archive bytes taken by one entry: headers, data and padding */
+static uint64_t entry_bytes(const char *user, const ArchiveEntry *e) {
+    size_t name_len = strlen(user) + 1 + strlen(e->name);
+    uint64_t n = TAR_BLOCK + e->size + tar_pad(e->size);
+    if (name_len > ARCHIVE_NAME_FIELD)
+        n += TAR_BLOCK + name_len + 1 + tar_pad(name_len + 1);
+    return n;
+}
+
+/* Octal, NUL-terminated; values too large for the field use the GNU
+ * base-256 form (high bit set, big-endian binary) */
+static void tar_number(char *field, size_t width, uint64_t v) {
+    if (v < (1ULL << (3 * (width - 1)))) {
+        snprintf(field, width, "%0*llo", (int)(width - 1), (unsigned long long)v);
+        return;
+    }
+    memset(field, 0, width);
+    field[0] = (char)0x80;
+    for (size_t i = width - 1; i > 0 && v; i--, v >>= 8)
+        field[i] = (char)(v & 0xff);
+}
+
+static void tar_header(char *hdr, const char *name, char type, uint64_t size, int64_t mtime,
+                       const char *owner) {
+    memset(hdr, 0, TAR_BLOCK);
+    strncpy(hdr, name, ARCHIVE_NAME_FIELD);
+    tar_number(hdr + 100, 8, 0644);
+    tar_number(hdr + 108, 8, 0);
+    tar_number(hdr + 116, 8, 0);
+    tar_number(hdr + 124, 12, size);
+    tar_number(hdr + 136, 12, mtime > 0 ? (uint64_t)mtime : 0);
+    hdr[156] = type;
+    memcpy(hdr + 257, "ustar  ", 8);     /* GNU magic: allows long-name entries */
+    strncpy(hdr + 265, owner, 31);
+    strncpy(hdr + 297, owner, 31);
+
+    memset(hdr + 148, ' ', 8);
+    unsigned sum = 0;
+    for (int i = 0; i < TAR_BLOCK; i++) sum += (unsigned char)hdr[i];
+    snprintf(hdr + 148, 8, "%06o", sum);
+}
+
+static int out_send(ArchiveOut *o, const void *data, size_t len) {
+    TRACE_BEGIN(t_send);
+    if (send_all(o->sockfd, data, len) < 0) return -1;
+    TRACE_END(t_send, TRACE_NET_SEND, len);
+    tcp_tune_step(&o->tune, len);
+    session_progress();
+    return 0;
+}
+
+#ifdef LOCALBIN_ZLIB
+static int gz_flush_frame(ArchiveOut *o) {
+    if (o->zused == 0) return 0;
+    uint32_t len = htonl((uint32_t)o->zused);
+    if (out_send(o, &len, sizeof(len)) < 0 || out_send(o, o->zout, o->zused) < 0) return -1;
+    o->zused = 0;
+    return 0;
+}
+
+/* Compress len bytes (flush = Z_FINISH ends the stream), sending every
+ * frame that fills up */
+static int gz_pump(ArchiveOut *o, const void *data, size_t len, int flush) {
+    o->z.next_in = (Bytef*)data;
+    o->z.avail_in = (uInt)len;
+    for (;;) {
+        o->z.next_out = o->zout + o->zused;
+        o->z.avail_out = (uInt)(ARCHIVE_FRAME_MAX - o->zused);
+        int rc = deflate(&o->z, flush);
+        if (rc == Z_STREAM_ERROR) return -1;
+        o->zused = ARCHIVE_FRAME_MAX - o->z.avail_out;
+        int full = o->z.avail_out == 0;
+        if (full && gz_flush_frame(o) < 0) return -1;
+        if (flush == Z_FINISH ? rc == Z_STREAM_END : (o->z.avail_in == 0 && !full)) return 0;
+    }
+}
+#endif
+
+static int out_bytes(ArchiveOut *o, const void *data, size_t len) {
+#ifdef LOCALBIN_ZLIB
+    if (o->gz) return gz_pump(o, data, len, Z_NO_FLUSH);
+#endif
+    return out_send(o, data, len);
+}
+
+static int out_zeros(ArchiveOut *o, uint64_t len) {
+    while (len > 0) {
+        size_t n = len < TAR_BLOCK ? (size_t)len : TAR_BLOCK;
+        if (out_bytes(o, zero_block, n) < 0) return -1;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Up to len bytes of fd from off: sendfile() straight to the socket, or
+ * read into the window and compressed. Returns bytes sent (less if the
+ * file ended early), -1 if the stream broke. */
+static int64_t out_file(ArchiveOut *o, int fd, off_t off, uint64_t len) {
+    uint64_t done = 0;
+    while (done < len) {
+        ssize_t n;
+        if (!o->gz) {
+            size_t want = tcp_tune_chunk(&o->tune, len - done);
+            TRACE_BEGIN(t_send);
+            n = sendfile(o->sockfd, fd, &off, want);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return -1;
+            if (n == 0) break;
+            TRACE_END(t_send, TRACE_NET_SEND, n);
+            tcp_tune_step(&o->tune, (size_t)n);
+            session_progress();
+        } else {
+            size_t want = len - done < o->buf_len ? (size_t)(len - done) : o->buf_len;
+            TRACE_BEGIN(t_read);
+            n = pread(fd, o->buf, want, off);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            TRACE_END(t_read, TRACE_DISK_READ, n);
+            if (out_bytes(o, o->buf, (size_t)n) < 0) return -1;
+            off += n;
+        }
+        done += (uint64_t)n;
+    }
+    return (int64_t)done;
+}
+
+/* One entry: long-name record if needed, header, then exactly e->size
+ * bytes. Returns 1 if the stored file no longer matched the listing, so
+ * its data was cut or zero-filled to keep the announced layout. */
+static int send_entry(ArchiveOut *o, const char *user, const ArchiveEntry *e) {
+    char name[USERNAME_LEN + FILE_NAME_LEN];
+    snprintf(name, sizeof(name), "%s/%s", user, e->name);
+    size_t name_len = strlen(name);
+
+    char hdr[TAR_BLOCK];
+    if (name_len > ARCHIVE_NAME_FIELD) {
+        tar_header(hdr, "././@LongLink", 'L', name_len + 1, 0, "root");
+        if (out_bytes(o, hdr, TAR_BLOCK) < 0 ||
+            out_bytes(o, name, name_len + 1) < 0 ||
+            out_zeros(o, tar_pad(name_len + 1)) < 0)
+            return -1;
+    }
+    tar_header(hdr, name, '0', e->size, e->mtime, user);
+    if (out_bytes(o, hdr, TAR_BLOCK) < 0) return -1;
+
+    off_t start = 0;
+    uint64_t stored = 0;
+    TRACE_BEGIN(t_open);
+    int fd = storage_open(user, e->name, &start, &stored);
+    TRACE_END(t_open, TRACE_FILE_OPEN, 0);
+
+    int64_t sent = 0;
+    if (fd >= 0) {
+        sent = out_file(o, fd, start, stored < e->size ? stored : e->size);
+        close(fd);
+        if (sent < 0) return -1;
+    }
+    if (out_zeros(o, e->size - (uint64_t)sent + tar_pad(e->size)) < 0) return -1;
+    return fd < 0 || stored != e->size || (uint64_t)sent != e->size;
+}
+
+static void send_error(int sockfd, const char *code) {
+    Packet err;
+    init_packet(&err, CMD_ERROR, code);
+    send_packet(sockfd, &err);
+}
+
+int handle_archive_download(int sockfd, const char *data) {
+    char user[USERNAME_LEN] = {0};
+    char format[8] = {0};
+    const char *prefix = "";
+
+    const char *colon = strchr(data, ':');
+    if (!colon || colon == data || (size_t)(colon - data) >= sizeof(user)) {
+        log_message("ERROR", "handle_archive_download: bad request");
+        send_error(sockfd, "ARCHIVE_BAD_REQUEST");
+        return FILE_OP_REPLIED;
+    }
+    memcpy(user, data, (size_t)(colon - data));
+    const char *fmt = colon + 1;
+    const char *end = strchr(fmt, ':');
+    size_t fmt_len = end ? (size_t)(end - fmt) : strlen(fmt);
+    if (end) prefix = end + 1;
+    if (fmt_len < sizeof(format)) memcpy(format, fmt, fmt_len);
+
+    int gz;
+    if (strcmp(format, "tar") == 0) {
+        gz = 0;
+    } else if (strcmp(format, "tgz") == 0) {
+#ifdef LOCALBIN_ZLIB
+        gz = 1;
+#else
+        send_error(sockfd, "COMPRESSION_UNAVAILABLE");
+        return FILE_OP_REPLIED;
+#endif
+    } else {
+        send_error(sockfd, "ARCHIVE_BAD_FORMAT");
+        return FILE_OP_REPLIED;
+    }
+
+    EntryList list = { .prefix = prefix, .prefix_len = strlen(prefix) };
+    meta_foreach(user, collect_entry, &list);
+    if (list.failed) {
+        free(list.items);
+        log_message("ERROR", "handle_archive_download: out of memory listing files");
+        return -1;
+    }
+    if (list.count > 1) qsort(list.items, list.count, sizeof(ArchiveEntry), entry_cmp);
+
+    uint64_t total = 2 * TAR_BLOCK;     /* end-of-archive marker */
+    for (size_t i = 0; i < list.count; i++) total += entry_bytes(user, &list.items[i]);
+
+    /* Corked from here, so the ACK leaves with the first header */
+    ArchiveOut o;
+    memset(&o, 0, sizeof(o));
+    o.sockfd = sockfd;
+    o.gz = gz;
+    tcp_tune_begin(&o.tune, sockfd, total, 1);
+#ifdef LOCALBIN_ZLIB
+    if (gz) {
+        o.buf_len = o.tune.chunk_cap;
+        o.buf = malloc(o.buf_len);
+        o.zout = malloc(ARCHIVE_FRAME_MAX);
+        /* Fastest level: this runs inline with the transfer; windowBits
+         * 15 + 16 writes a gzip wrapper */
+        if (!o.buf || !o.zout ||
+            deflateInit2(&o.z, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            free(o.buf);
+            free(o.zout);
+            free(list.items);
+            tcp_tune_end(&o.tune, "archive");
+            log_message("ERROR", "handle_archive_download: compressor setup failed");
+            return -1;
+        }
+    }
+#endif
+
+    char header[64];
+    snprintf(header, sizeof(header), "%llu:%zu", (unsigned long long)(gz ? 0 : total), list.count);
+    Packet ack;
+    init_packet(&ack, CMD_ACK, header);
+    int rc = send_packet(sockfd, &ack) < 0 ? -1 : 0;
+
+    size_t changed = 0;
+    for (size_t i = 0; rc == 0 && i < list.count; i++) {
+        int r = send_entry(&o, user, &list.items[i]);
+        if (r < 0) rc = -1;
+        else changed += (size_t)r;
+    }
+    if (rc == 0 && out_zeros(&o, 2 * TAR_BLOCK) < 0) rc = -1;
+#ifdef LOCALBIN_ZLIB
+    if (gz) {
+        if (rc == 0 && (gz_pump(&o, NULL, 0, Z_FINISH) < 0 || gz_flush_frame(&o) < 0)) rc = -1;
+        uint32_t last = 0;
+        if (rc == 0 && out_send(&o, &last, sizeof(last)) < 0) rc = -1;
+        deflateEnd(&o.z);
+        free(o.zout);
+    }
+#endif
+    char label[USERNAME_LEN + FILE_NAME_LEN + 16];
+    snprintf(label, sizeof(label), "archive %s/%.*s", user, FILE_NAME_LEN - 1, prefix);
+    tcp_tune_end(&o.tune, label);
+    free(o.buf);
+    free(list.items);
+
+    char msg[512];
+    if (rc < 0) {
+        snprintf(msg, sizeof(msg), "handle_archive_download: stream of %s broken", label);
+        log_message("ERROR", msg);
+        return FILE_OP_REPLIED;     /* the ACK went out; nothing more can be said */
+    }
+    if (changed) {
+        snprintf(msg, sizeof(msg), "%s: %zu files changed while sending; their entries were "
+                 "cut or zero-filled to the listed size", label, changed);
+        log_message("WARN", msg);
+    }
+    snprintf(msg, sizeof(msg), "Sent %s (%zu files, %llu tar bytes%s)", label, list.count,
+             (unsigned long long)total, gz ? ", gzip" : "");
+    log_message("INFO", msg);
+    return 0;
+}
+
+/* Flush the listing lines gathered so far as one CMD_LIST packet */
+static int flush_list(int sockfd, char *buf, size_t *used) {
+    if (*used == 0) return 0;
+    buf[*used] = '\0';
+    Packet p;
+    init_packet(&p, CMD_LIST, buf);
+    *used = 0;
+    return send_packet(sockfd, &p);
+}
+
+int handle_folder_list(int sockfd, const char *data) {
+    char user[USERNAME_LEN] = {0};
+    const char *prefix = "";
+
+    const char *colon = strchr(data, ':');
+    size_t user_len = colon ? (size_t)(colon - data) : strlen(data);
+    if (user_len == 0 || user_len >= sizeof(user)) {
+        log_message("ERROR", "handle_folder_list: bad request");
+        send_error(sockfd, "LIST_BAD_REQUEST");
+        return FILE_OP_REPLIED;
+    }
+    memcpy(user, data, user_len);
+    if (colon) prefix = colon + 1;
+
+    EntryList list = { .prefix = prefix, .prefix_len = strlen(prefix) };
+    meta_foreach(user, collect_entry, &list);
+    if (list.failed) {
+        free(list.items);
+        log_message("ERROR", "handle_folder_list: out of memory listing files");
+        return -1;
+    }
+    if (list.count > 1) qsort(list.items, list.count, sizeof(ArchiveEntry), entry_cmp);
+
+    /* Whole lines per packet, leaving room for the client's terminator */
+    char buf[MAX_PAYLOAD];
+    size_t used = 0;
+    int rc = 0;
+    for (size_t i = 0; rc == 0 && i < list.count; i++) {
+        char line[FILE_NAME_LEN + 64];
+        int n = snprintf(line, sizeof(line), "%llu %lld %s\n",
+                         (unsigned long long)list.items[i].size,
+                         (long long)list.items[i].mtime, list.items[i].name);
+        if (used + (size_t)n >= sizeof(buf) && flush_list(sockfd, buf, &used) < 0) {
+            rc = -1;
+            break;
+        }
+        memcpy(buf + used, line, (size_t)n);
+        used += (size_t)n;
+    }
+    if (rc == 0 && flush_list(sockfd, buf, &used) < 0) rc = -1;
+
+    char count[32];
+    snprintf(count, sizeof(count), "%zu", list.count);
+    Packet ack;
+    init_packet(&ack, CMD_ACK, count);
+    if (rc == 0 && send_packet(sockfd, &ack) < 0) rc = -1;
+    free(list.items);
+
+    if (rc < 0) {
+        log_message("ERROR", "handle_folder_list: sending the listing failed");
+        return FILE_OP_REPLIED;
+    }
+    char msg[USERNAME_LEN + FILE_NAME_LEN + 64];
+    snprintf(msg, sizeof(msg), "Listed %zu files of %s/%.*s", list.count, user,
+             FILE_NAME_LEN - 1, prefix);
+    log_message("INFO", msg);
+    return 0;
+}
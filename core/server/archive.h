@@ -0,0 +1,35 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "../common/common.h"
+
+/*
+ * Whole-folder reads: listings (CMD_LIST) and downloads (CMD_ARCHIVE). The server lists a user's files
+ * (optionally only names starting with a prefix) from the index and
+ * streams them as one tar archive built on the fly: headers are generated
+ * in memory and file contents go straight from storage to the socket with
+ * sendfile(), so nothing is staged on disk and nothing is held beyond one
+ * header at a time.
+ *
+ * Entries are named <user>/<filename> and come in name order. A plain tar
+ * has a size known up front, announced in the ACK. With "tgz" (servers
+ * built with ZLIB=1) the tar is gzip-compressed while it is sent, through
+ * a buffer of one transfer chunk, and goes out in length-prefixed frames
+ * since its size is not known in advance.
+ */
+
+/* Longest name a plain ustar header holds; longer names get a GNU
+ * long-name entry in front */
+#define ARCHIVE_NAME_FIELD 100
+
+/* "user:format:prefix" (format "tar" or "tgz", prefix may be empty).
+ * Answers ACK "size:count" (size 0 for a framed stream) and sends the
+ * archive, or sends its own error reply (returns FILE_OP_REPLIED). */
+int handle_archive_download(int sockfd, const char *data);
+
+/* "user:prefix" (or just "user"): sends the matching files in name order
+ * as "size mtime name" lines, as many whole lines per CMD_LIST packet as
+ * fit, then ACK "count". mtime is when the stored copy was written. */
+int handle_folder_list(int sockfd, const char *data);
+
+#endif /* ARCHIVE_H */
@@ -1,8 +1,35 @@
 #include "client_handler.h"
+#include "archive.h"
+#include "replication.h"
+#include "trace.h"
+#include "watch.h"
+
+static TraceSpan command_span(uint32_t cmd) {
+    switch (cmd) {
+        case CMD_AUTH: return TRACE_CMD_AUTH;
+        case CMD_UPLOAD:
+        case CMD_UPLOAD_FD: return TRACE_CMD_UPLOAD;
+        case CMD_DOWNLOAD:
+        case CMD_DOWNLOAD_FD:
+        case CMD_ARCHIVE: return TRACE_CMD_DOWNLOAD;
+        case CMD_DELTA: return TRACE_CMD_DELTA;
+        case CMD_DELETE: return TRACE_CMD_DELETE;
+        default: return TRACE_CMD_OTHER;
+    }
+}
+
+/* Requests name their user first ("user:..."); a connection may only act
+ * on the files of the user it authenticated as */
+static int owns_request(const char *data, const char *user) {
+    size_t n = strlen(user);
+    return strncmp(data, user, n) == 0 && data[n] == ':';
+}
 
 void *client_thread(void *arg) {
     ClientThreadArgs *ctx = (ClientThreadArgs*)arg;
     int sock = ctx->client_sock;
+    int passed_fd = -1;         /* fd sent along with the current request */
+    int watching = 0;           /* hand the connection to the watch hub on exit */
 
     char msgbuf[128];
     snprintf(msgbuf, sizeof(msgbuf), "Client thread started FD=%d", sock);
@@ -12,13 +39,35 @@ void *client_thread(void *arg) {
     int authenticated = 0;
     char current_user[USERNAME_LEN] = {0};
 
+    /* Unauthenticated connections keep their original auth deadline */
+    Session session;
+    session_register(&session, sock);
+
     while (1) {
+        if (authenticated) session_set_phase(&session, SESSION_IDLE);
+
         memset(&req, 0, sizeof(req));
-        if (recv_packet(sock, &req) < 0) {
+        TRACE_BEGIN(t_recv);
+        int got = ctx->local ? recv_packet_fd(sock, &req, &passed_fd) : recv_packet(sock, &req);
+        if (got < 0) {
+            if (session.expired) break;
             log_message("INFO", "client_thread: recv_packet failed or client disconnected");
             break;
         }
 
+        /* Before auth these are refused, and must not trade the auth
+         * deadline for a fresh stall timer */
+        if (authenticated &&
+            (req.command == CMD_UPLOAD || req.command == CMD_DOWNLOAD || req.command == CMD_DELTA ||
+             req.command == CMD_UPLOAD_FD || req.command == CMD_DOWNLOAD_FD ||
+             req.command == CMD_ARCHIVE))
+            session_set_phase(&session, SESSION_TRANSFER);
+
+        /* One trace id per command; the recv span includes client think time */
+        trace_new_request();
+        TRACE_END(t_recv, TRACE_RECV_PACKET, req.data_length);
+        TRACE_BEGIN(t_cmd);
+
         switch (req.command) {
             case CMD_AUTH: {
                 char user[USERNAME_LEN], pass[PASSWORD_LEN];
@@ -27,7 +76,10 @@ void *client_thread(void *arg) {
                     send_packet(sock, &resp);
                     break;
                 }
-                if (authenticate_user(user, pass)) {
+                TRACE_BEGIN(t_auth);
+                int ok = authenticate_user(user, pass);
+                TRACE_END(t_auth, TRACE_AUTH_CHECK, ok);
+                if (ok) {
                     authenticated = 1;
                     strncpy(current_user, user, USERNAME_LEN - 1);
                     init_packet(&resp, CMD_ACK, "AUTH_OK");
@@ -48,40 +100,172 @@ void *client_thread(void *arg) {
                     send_packet(sock, &resp);
                     break;
                 }
-                if (handle_file_upload(sock, &req) == 0) {
+                if (repl_is_secondary()) {
+                    init_packet(&resp, CMD_ERROR, "READ_ONLY");
+                    send_packet(sock, &resp);
+                    break;
+                }
+                int rc = handle_file_upload(sock, &req);
+                if (rc == 0) {
                     init_packet(&resp, CMD_ACK, "UPLOAD_OK");
                     send_packet(sock, &resp);
-                } else {
+                } else if (rc != FILE_OP_REPLIED) {
+                    init_packet(&resp, CMD_ERROR, "UPLOAD_FAIL");
+                    send_packet(sock, &resp);
+                }
+                break;
+            }
+
+            case CMD_UPLOAD_FD: {
+                if (!authenticated) {
+                    init_packet(&resp, CMD_ERROR, "NOT_AUTH");
+                    send_packet(sock, &resp);
+                    break;
+                }
+                if (repl_is_secondary()) {
+                    init_packet(&resp, CMD_ERROR, "READ_ONLY");
+                    send_packet(sock, &resp);
+                    break;
+                }
+                int rc = handle_file_upload_fd(sock, &req, passed_fd);
+                if (rc == 0) {
+                    init_packet(&resp, CMD_ACK, "UPLOAD_OK");
+                    send_packet(sock, &resp);
+                } else if (rc != FILE_OP_REPLIED) {
                     init_packet(&resp, CMD_ERROR, "UPLOAD_FAIL");
                     send_packet(sock, &resp);
                 }
                 break;
             }
 
+            case CMD_DELTA: {
+                if (!authenticated) {
+                    init_packet(&resp, CMD_ERROR, "NOT_AUTH");
+                    send_packet(sock, &resp);
+                    break;
+                }
+                if (repl_is_secondary()) {
+                    init_packet(&resp, CMD_ERROR, "READ_ONLY");
+                    send_packet(sock, &resp);
+                    break;
+                }
+                int rc = handle_delta_upload(sock, &req);
+                if (rc == FILE_OP_REPLIED) break;
+                if (rc == 0) {
+                    init_packet(&resp, CMD_ACK, "DELTA_OK");
+                } else {
+                    init_packet(&resp, CMD_ERROR, "DELTA_FAIL");
+                }
+                send_packet(sock, &resp);
+                break;
+            }
+
             case CMD_DOWNLOAD: {
                 if (!authenticated) {
                     init_packet(&resp, CMD_ERROR, "NOT_AUTH");
                     send_packet(sock, &resp);
                     break;
                 }
-                if (handle_file_download(sock, req.data) == 0) {
+                int rc = handle_file_download(sock, req.data);
+                if (rc == 0) {
                     /* success already logged */
-                } else {
+                } else if (rc != FILE_OP_REPLIED) {
                     init_packet(&resp, CMD_ERROR, "DOWNLOAD_FAIL");
                     send_packet(sock, &resp);
                 }
                 break;
             }
 
-            case CMD_LIST:
-                init_packet(&resp, CMD_ERROR, "LIST_NOT_IMPLEMENTED");
-                send_packet(sock, &resp);
+            case CMD_DOWNLOAD_FD: {
+                if (!authenticated || !ctx->local) {
+                    init_packet(&resp, CMD_ERROR, authenticated ? "NOT_LOCAL" : "NOT_AUTH");
+                    send_packet(sock, &resp);
+                    break;
+                }
+                int rc = handle_file_download_fd(sock, req.data);
+                if (rc != 0 && rc != FILE_OP_REPLIED) {
+                    init_packet(&resp, CMD_ERROR, "DOWNLOAD_FAIL");
+                    send_packet(sock, &resp);
+                }
                 break;
+            }
 
-            case CMD_DELETE:
-                init_packet(&resp, CMD_ERROR, "DELETE_NOT_IMPLEMENTED");
+            case CMD_ARCHIVE: {
+                if (!authenticated) {
+                    init_packet(&resp, CMD_ERROR, "NOT_AUTH");
+                    send_packet(sock, &resp);
+                    break;
+                }
+                if (!owns_request(req.data, current_user)) {
+                    init_packet(&resp, CMD_ERROR, "NOT_OWNER");
+                    send_packet(sock, &resp);
+                    break;
+                }
+                int rc = handle_archive_download(sock, req.data);
+                if (rc != 0 && rc != FILE_OP_REPLIED) {
+                    init_packet(&resp, CMD_ERROR, "ARCHIVE_FAIL");
+                    send_packet(sock, &resp);
+                }
+                break;
+            }
+
+            case CMD_LIST: {
+                if (!authenticated) {
+                    init_packet(&resp, CMD_ERROR, "NOT_AUTH");
+                    send_packet(sock, &resp);
+                    break;
+                }
+                if (!owns_request(req.data, current_user)) {
+                    init_packet(&resp, CMD_ERROR, "NOT_OWNER");
+                    send_packet(sock, &resp);
+                    break;
+                }
+                int rc = handle_folder_list(sock, req.data);
+                if (rc != 0 && rc != FILE_OP_REPLIED) {
+                    init_packet(&resp, CMD_ERROR, "LIST_FAIL");
+                    send_packet(sock, &resp);
+                }
+                break;
+            }
+
+            case CMD_DELETE: {
+                if (!authenticated) {
+                    init_packet(&resp, CMD_ERROR, "NOT_AUTH");
+                    send_packet(sock, &resp);
+                    break;
+                }
+                if (repl_is_secondary()) {
+                    init_packet(&resp, CMD_ERROR, "READ_ONLY");
+                } else if (!owns_request(req.data, current_user)) {
+                    init_packet(&resp, CMD_ERROR, "NOT_OWNER");
+                } else if (handle_file_delete(req.data) == 0) {
+                    init_packet(&resp, CMD_ACK, "DELETE_OK");
+                } else {
+                    init_packet(&resp, CMD_ERROR, "DELETE_FAIL");
+                }
                 send_packet(sock, &resp);
                 break;
+            }
+
+            case CMD_WATCH:
+                if (!authenticated) {
+                    init_packet(&resp, CMD_ERROR, "NOT_AUTH");
+                    send_packet(sock, &resp);
+                    break;
+                }
+                if (!owns_request(req.data, current_user)) {
+                    init_packet(&resp, CMD_ERROR, "NOT_OWNER");
+                    send_packet(sock, &resp);
+                    break;
+                }
+                /* Subscribed below, once this thread lets go of the socket */
+                watching = 1;
+                goto end_loop;
+
+            case CMD_REPL_HELLO:
+                /* The connection belongs to the replication stream from here on */
+                repl_serve(sock, &session, req.data);
+                goto end_loop;
 
             case CMD_EXIT:
                 log_message("INFO", "Client requested exit");
@@ -93,10 +277,18 @@ void *client_thread(void *arg) {
                 log_message("WARN", "Unknown command");
                 break;
         }
+        TRACE_END(t_cmd, command_span(req.command), req.command);
+        if (passed_fd >= 0) {
+            close(passed_fd);
+            passed_fd = -1;
+        }
     }
 
 end_loop:
-    close(sock);
+    if (passed_fd >= 0) close(passed_fd);
+    session_unregister(&session);
+    if (watching) watch_subscribe(sock, req.data);
+    else close(sock);
     free(ctx);
     log_message("INFO", "Client thread exiting");
     return NULL;
@@ -5,10 +5,12 @@
 #include "../common/protocol.h"
 #include "auth.h"
 #include "file_ops.h"
+#include "session.h"
 
 typedef struct {
     int client_sock;
     struct sockaddr_in client_addr;
+    int local;                  /* accepted on the same-host Unix socket */
 } ClientThreadArgs;
 
 void *client_thread(void *arg);
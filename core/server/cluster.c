@@ -0,0 +1,192 @@
+#include "cluster.h"
+#include "file_ops.h"
+#include "metadata.h"
+#include "replication.h"
+#include <signal.h>
+
+typedef struct {
+    ReplKey  key;
+    uint64_t size;
+    int64_t  mtime;
+    int      owner;
+} Misplaced;
+
+typedef struct {
+    const HashRing *ring;
+    int self;
+    Misplaced *items;
+    size_t count;
+    size_t cap;
+} MisplacedList;
+
+static char config_file[PATH_LEN];
+static char self_addr[HASHRING_ADDR_LEN];
+
+/* SIGHUP only writes to this pipe; the rebalancer does the work */
+static int hup_pipe[2] = { -1, -1 };
+static pthread_t rebalance_tid;
+static volatile int cluster_running = 0;
+
+static void collect_misplaced(const FileMeta *meta, void *arg) {
+    MisplacedList *ml = (MisplacedList*)arg;
+    int owner = hashring_lookup(ml->ring, meta->user, meta->name);
+    if (owner < 0 || owner == ml->self) return;
+
+    if (ml->count == ml->cap) {
+        size_t nc = ml->cap ? ml->cap * 2 : 256;
+        Misplaced *ni = realloc(ml->items, nc * sizeof(Misplaced));
+        if (!ni) return;
+        ml->items = ni;
+        ml->cap = nc;
+    }
+    Misplaced *m = &ml->items[ml->count++];
+    memset(m, 0, sizeof(*m));
+    strncpy(m->key.user, meta->user, USERNAME_LEN - 1);
+    strncpy(m->key.name, meta->name, FILE_NAME_LEN - 1);
+    m->size = meta->size;
+    m->mtime = meta->mtime;
+    m->owner = owner;
+}
+
+/* Hand every key this node holds but does not own to its owner */
+static void rebalance(void) {
+    HashRing ring;
+    hashring_init(&ring);
+    if (hashring_load(&ring, config_file) <= 0) {
+        log_message("ERROR", "rebalance: cannot load cluster node list");
+        hashring_free(&ring);
+        return;
+    }
+
+    MisplacedList ml = { &ring, hashring_find(&ring, self_addr), NULL, 0, 0 };
+    if (ml.self < 0) log_message("WARN", "rebalance: this node is not in the node list, handing off all files");
+    meta_foreach(NULL, collect_misplaced, &ml);
+
+    ReplKey *keys = ml.count ? malloc(ml.count * sizeof(ReplKey)) : NULL;
+    size_t moved = 0, failed = 0, kept = 0;
+    for (int node = 0; node < ring.node_count && keys && cluster_running; node++) {
+        size_t n = 0;
+        for (size_t i = 0; i < ml.count; i++)
+            if (ml.items[i].owner == node) keys[n++] = ml.items[i].key;
+        if (n == 0) continue;
+
+        if (repl_push(ring.nodes[node], keys, n, &cluster_running) < 0) {
+            char msg[HASHRING_ADDR_LEN + 96];
+            snprintf(msg, sizeof(msg), "rebalance: pushing %zu files to %s failed, keeping them", n,
+                     ring.nodes[node]);
+            log_message("WARN", msg);
+            failed += n;
+            continue;
+        }
+
+        /* The owner has a copy; drop ours unless it was rewritten meanwhile */
+        for (size_t i = 0; i < ml.count; i++) {
+            Misplaced *m = &ml.items[i];
+            if (m->owner != node) continue;
+            FileMeta now;
+            char req[USERNAME_LEN + FILE_NAME_LEN + 2];
+            snprintf(req, sizeof(req), "%s:%s", m->key.user, m->key.name);
+            if (meta_lookup(m->key.user, m->key.name, &now) == 0 && now.size == m->size &&
+                now.mtime == m->mtime && handle_file_delete(req) == 0)
+                moved++;
+            else
+                kept++;
+        }
+    }
+    if (ml.count && !keys) failed = ml.count;
+
+    char msg[192];
+    snprintf(msg, sizeof(msg),
+             "Rebalance done: %d nodes, %zu misplaced, %zu moved, %zu changed during transfer, %zu failed",
+             ring.node_count, ml.count, moved, kept, failed);
+    log_message(failed ? "WARN" : "INFO", msg);
+
+    free(keys);
+    free(ml.items);
+    hashring_free(&ring);
+}
+
+static void sighup_handler(int sig) {
+    UNUSED(sig);
+    char c = 'r';
+    ssize_t n = write(hup_pipe[1], &c, 1);
+    UNUSED(n);
+}
+
+static void *rebalance_thread(void *arg) {
+    UNUSED(arg);
+
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+    rebalance();
+    for (;;) {
+        char c;
+        ssize_t n = read(hup_pipe[0], &c, 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n != 1 || c == 'q') break;
+        log_message("INFO", "SIGHUP: reloading cluster node list");
+        rebalance();
+    }
+    return NULL;
+}
+
+int cluster_init(const char *config_path, const char *self) {
+    if (cluster_running) return 0;
+    strncpy(config_file, config_path, sizeof(config_file) - 1);
+    strncpy(self_addr, self, sizeof(self_addr) - 1);
+
+    HashRing ring;
+    hashring_init(&ring);
+    int nodes = hashring_load(&ring, config_file);
+    int found = hashring_find(&ring, self_addr);
+    hashring_free(&ring);
+    if (nodes <= 0) {
+        log_message("ERROR", "cluster_init: cannot load cluster node list");
+        return -1;
+    }
+
+    char msg[HASHRING_ADDR_LEN + PATH_LEN + 64];
+    snprintf(msg, sizeof(msg), "Cluster mode: node %s, %d nodes in %s%s", self_addr, nodes,
+             config_file, found < 0 ? " (not listed)" : "");
+    log_message(found < 0 ? "WARN" : "INFO", msg);
+
+    repl_allow_push();
+
+    if (pipe(hup_pipe) < 0) {
+        log_message("ERROR", "cluster_init: pipe failed");
+        return -1;
+    }
+    cluster_running = 1;
+    if (pthread_create(&rebalance_tid, NULL, rebalance_thread, NULL) != 0) {
+        log_message("ERROR", "cluster_init: cannot start rebalancer");
+        cluster_running = 0;
+        close(hup_pipe[0]);
+        close(hup_pipe[1]);
+        hup_pipe[0] = hup_pipe[1] = -1;
+        return -1;
+    }
+
+    /* SA_RESTART keeps the signal from failing recv()/send() in client threads */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sighup_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGHUP, &sa, NULL);
+    return 0;
+}
+
+void cluster_shutdown(void) {
+    if (!cluster_running) return;
+    signal(SIGHUP, SIG_IGN);
+    cluster_running = 0;
+    char c = 'q';
+    ssize_t n = write(hup_pipe[1], &c, 1);
+    UNUSED(n);
+    pthread_join(rebalance_tid, NULL);
+    close(hup_pipe[0]);
+    close(hup_pipe[1]);
+    hup_pipe[0] = hup_pipe[1] = -1;
+}
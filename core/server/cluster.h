@@ -0,0 +1,27 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include "../common/common.h"
+#include "../common/hashring.h"
+
+/*
+ * Cluster mode. Every node reads the same node list (see hashring.h) and
+ * clients route each user/filename to the node that owns it. A node only
+ * keeps the keys it owns: on startup and whenever it gets SIGHUP (after the
+ * node list changed) it reloads the ring and pushes every file it holds
+ * but no longer owns to the new owner over the replication stream, then
+ * deletes its own copy if the file did not change meanwhile.
+ *
+ * Adding a node therefore moves only the keys that now hash to it. To
+ * retire a node, drop it from the list, SIGHUP the others and SIGHUP the
+ * retiring node last; it hands everything off before it is shut down.
+ */
+
+/* Join the cluster described by config_path as node self ("host:port" as
+ * it appears in the list) and start the rebalancer. Call after repl_init. */
+int cluster_init(const char *config_path, const char *self);
+
+/* Stop the rebalancer (before repl_shutdown) */
+void cluster_shutdown(void);
+
+#endif /* CLUSTER_H */
@@ -4,6 +4,37 @@
 #include <errno.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include "../common/delta.h"
+#include "../common/tcp_tune.h"
+#include "quota.h"
+#include "replication.h"
+#include "segment_store.h"
+#include "session.h"
+#include "storage_roots.h"
+#include "trace.h"
+#include "watch.h"
+
+/* Per-root directory of files still being written. Dot-prefixed, so the
+ * index rebuild never mistakes it for a user; emptied on startup. */
+#define TMP_DIR ".tmp"
+
+/* Sentinel for drop_copies: keep nothing */
+#define ROOT_NONE UINT32_MAX
+
+/* Room for base + user + shard dirs + a fully percent-encoded name */
+#define STORAGE_PATH_LEN (PATH_LEN * 2)
+
+/* Writers of one file (upload and delete commits, packing, root moves) take its
+ * stripe of these, so a move never removes a copy that was just replaced */
+#define FILE_LOCK_STRIPES 64
+static pthread_mutex_t file_locks[FILE_LOCK_STRIPES];
+
+static pthread_mutex_t *file_lock(const char *user, const char *filename) {
+    uint64_t h = fnv1a64(user, strlen(user) + 1, FNV64_OFFSET);
+    h = fnv1a64(filename, strlen(filename), h);
+    return &file_locks[h % FILE_LOCK_STRIPES];
+}
 
 static void ensure_base_dir(void) {
     struct stat st;
@@ -12,9 +43,9 @@ static void ensure_base_dir(void) {
     }
 }
 
-static void ensure_user_dir(const char *user) {
+static void ensure_user_dir(uint32_t root, const char *user) {
     char path[PATH_LEN];
-    snprintf(path, sizeof(path), "%s/%s", STORAGE_BASE, user);
+    snprintf(path, sizeof(path), "%s/%s", roots_path(root), user);
     struct stat st;
     if (stat(path, &st) == -1) {
         ensure_base_dir();
@@ -22,110 +53,1138 @@ static void ensure_user_dir(const char *user) {
     }
 }
 
-static void build_path(char *dest, size_t len, const char *user, const char *filename) {
+/*
+ * On-disk layout. A user's files are fanned out over two levels of
+ * hash-prefixed directories so no single directory grows past a few dozen
+ * entries per 65536 files:
+ *
+ *     <root>/<user>/<h0>/<h1>/<encoded name>
+ *
+ * where <root> is data/storage or another storage root (storage_roots.h)
+ * as recorded in the file's index entry.
+ * h0/h1 are the first two bytes (hex) of the FNV-1a hash of the logical
+ * name. '/' and '%' are percent-encoded so any logical name maps to exactly
+ * one file, and "." / ".." cannot escape the shard. Nothing outside this
+ * file knows about physical paths.
+ */
+
+static void encode_name(const char *name, char *out, size_t len) {
+    static const char hex[] = "0123456789ABCDEF";
+    int all_dots = strspn(name, ".") == strlen(name);
+    size_t o = 0;
+    for (const char *p = name; *p && o + 4 < len; p++) {
+        unsigned char ch = (unsigned char)*p;
+        if (ch == '/' || ch == '%' || (all_dots && ch == '.')) {
+            out[o++] = '%';
+            out[o++] = hex[ch >> 4];
+            out[o++] = hex[ch & 15];
+        } else {
+            out[o++] = (char)ch;
+        }
+    }
+    out[o] = '\0';
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static void decode_name(const char *enc, char *out, size_t len) {
+    size_t o = 0;
+    for (const char *p = enc; *p && o + 1 < len; p++) {
+        int hi, lo;
+        if (p[0] == '%' && (hi = hex_value(p[1])) >= 0 && (lo = hex_value(p[2])) >= 0) {
+            out[o++] = (char)(hi << 4 | lo);
+            p += 2;
+        } else {
+            out[o++] = *p;
+        }
+    }
+    out[o] = '\0';
+}
+
+static void shard_dirs(const char *filename, char *h0, char *h1) {
+    uint64_t h = fnv1a64(filename, strlen(filename), FNV64_OFFSET);
+    snprintf(h0, 3, "%02x", (unsigned)(h >> 56));
+    snprintf(h1, 3, "%02x", (unsigned)((h >> 48) & 0xff));
+}
+
+static void build_path(char *dest, size_t len, uint32_t root, const char *user,
+                       const char *filename) {
+    char h0[3], h1[3];
+    char enc[FILE_NAME_LEN * 3];
+    shard_dirs(filename, h0, h1);
+    encode_name(filename, enc, sizeof(enc));
+    snprintf(dest, len, "%s/%s/%s/%s/%s", roots_path(root), user, h0, h1, enc);
+}
+
+/* Flat layout used before sharding; still read until migrated */
+static void build_legacy_path(char *dest, size_t len, const char *user, const char *filename) {
     snprintf(dest, len, "%s/%s/%s", STORAGE_BASE, user, filename);
 }
 
-int handle_file_upload(int sockfd, Packet *initial_request) {
-    char user[USERNAME_LEN] = {0};
-    char filename[FILE_NAME_LEN] = {0};
-    size_t filesize = 0;
+/* Create <root>/<user>/<h0>/<h1> for a file about to be written */
+static void ensure_file_dir(uint32_t root, const char *user, const char *filename) {
+    char h0[3], h1[3];
+    char path[PATH_LEN];
+    shard_dirs(filename, h0, h1);
 
-    if (sscanf(initial_request->data, "%63[^:]:%255[^:]:%zu", user, filename, &filesize) != 3) {
-        log_message("ERROR", "handle_file_upload: bad header");
+    ensure_user_dir(root, user);
+    snprintf(path, sizeof(path), "%s/%s/%s", roots_path(root), user, h0);
+    mkdir(path, 0755);
+    snprintf(path, sizeof(path), "%s/%s/%s/%s", roots_path(root), user, h0, h1);
+    mkdir(path, 0755);
+}
+
+/* Root holding the sharded copy of a file: the indexed one, or any root
+ * if the index is stale, e.g. the --root list was reordered (returns -1
+ * if there is none) */
+static int locate_root(const char *user, const char *filename, char *dest, size_t len) {
+    struct stat st;
+    FileMeta m;
+    uint32_t indexed = ROOT_NONE;
+    if (meta_lookup(user, filename, &m) == 0 && m.segment == 0 && m.root < roots_count()) {
+        indexed = m.root;
+        build_path(dest, len, indexed, user, filename);
+        if (stat(dest, &st) == 0) return (int)indexed;
+    }
+    for (uint32_t r = 0; r < roots_count(); r++) {
+        if (r == indexed) continue;
+        build_path(dest, len, r, user, filename);
+        if (stat(dest, &st) == 0) return (int)r;
+    }
+    return -1;
+}
+
+/* Physical path of an existing file, falling back to the legacy flat
+ * layout (returns -1 if the file exists in neither) */
+static int resolve_path(char *dest, size_t len, const char *user, const char *filename) {
+    struct stat st;
+    if (locate_root(user, filename, dest, len) >= 0) return 0;
+    if (strchr(filename, '/') || strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0)
         return -1;
+    build_legacy_path(dest, len, user, filename);
+    if (stat(dest, &st) == 0 && S_ISREG(st.st_mode)) return 0;
+    return -1;
+}
+
+/* Unlink every individually stored copy except the one on root keep
+ * (ROOT_NONE: all of them), including a legacy flat copy, so no stale
+ * copy can resurface on the next index rebuild. Returns copies removed. */
+static int drop_copies(const char *user, const char *filename, uint32_t keep) {
+    char path[STORAGE_PATH_LEN];
+    int removed = 0;
+    for (uint32_t r = 0; r < roots_count(); r++) {
+        if (r == keep) continue;
+        build_path(path, sizeof(path), r, user, filename);
+        if (unlink(path) == 0) removed++;
+    }
+
+    if (strchr(filename, '/') || strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0)
+        return removed;
+    build_legacy_path(path, sizeof(path), user, filename);
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISREG(st.st_mode) && unlink(path) == 0) removed++;
+    return removed;
+}
+
+/* Create a uniquely named file to write a new copy into, in root's
+ * TMP_DIR so the final rename stays on one filesystem (returns an fd) */
+static int open_temp(uint32_t root, char *path, size_t len) {
+    snprintf(path, len, "%s/" TMP_DIR "/XXXXXX", roots_path(root));
+    int fd = mkstemp(path);
+    if (fd < 0 && errno == ENOENT) {
+        char dir[PATH_LEN];
+        snprintf(dir, sizeof(dir), "%s/" TMP_DIR, roots_path(root));
+        mkdir(dir, 0755);
+        snprintf(path, len, "%s/" TMP_DIR "/XXXXXX", roots_path(root));
+        fd = mkstemp(path);
+    }
+    if (fd >= 0) fchmod(fd, 0644);
+    return fd;
+}
+
+/* Remove temp files left behind by a crash */
+static void clear_temp(uint32_t root) {
+    char dir[PATH_LEN];
+    snprintf(dir, sizeof(dir), "%s/" TMP_DIR, roots_path(root));
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.') continue;
+        char path[PATH_LEN + FILE_NAME_LEN];
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        unlink(path);
+    }
+    closedir(d);
+}
+
+/* Make a fully written temp file the stored copy of user/filename on
+ * root, replacing whatever copy existed (returns 0 on success). The copy
+ * takes mtime on disk too, so an index rebuilt by a directory scan keeps it. */
+static int commit_copy(const char *tmppath, uint32_t root, const char *user, const char *filename,
+                       uint64_t size, int64_t mtime) {
+    char fullpath[STORAGE_PATH_LEN];
+    build_path(fullpath, sizeof(fullpath), root, user, filename);
+
+    struct timespec times[2] = { { 0, UTIME_OMIT }, { (time_t)mtime, 0 } };
+    if (utimensat(AT_FDCWD, tmppath, times, 0) < 0)
+        log_message("WARN", "commit_copy: cannot set the stored file's mtime");
+
+    pthread_mutex_t *lock = file_lock(user, filename);
+    pthread_mutex_lock(lock);
+    int rc = rename(tmppath, fullpath);
+    if (rc == 0) {
+        drop_copies(user, filename, root);
+        seg_forget(user, filename);
+        meta_put(user, filename, size, mtime, root);
+    }
+    pthread_mutex_unlock(lock);
+    if (rc != 0) unlink(tmppath);
+    return rc;
+}
+
+/* Pack user/filename into the segment log, replacing whatever copy
+ * existed. Under the file's lock like commit_copy, so a concurrent large
+ * upload's copy is either replaced here or replaces this one, never
+ * unlinked behind an index entry that points at it. */
+static int commit_packed(const char *user, const char *filename, const void *data, uint32_t len,
+                         int64_t mtime) {
+    pthread_mutex_t *lock = file_lock(user, filename);
+    pthread_mutex_lock(lock);
+    int rc = seg_store_file(user, filename, data, len, mtime);
+    if (rc == 0) drop_copies(user, filename, ROOT_NONE);
+    pthread_mutex_unlock(lock);
+    return rc;
+}
+
+static int pread_full(int fd, void *buf, size_t len, off_t off) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = pread(fd, (char*)buf + got, len - got, off + (off_t)got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        got += (size_t)n;
+    }
+    return 0;
+}
+
+/* Open the stored bytes of user/filename, whether packed in a segment or
+ * stored as a file. Returns an fd; the content is *size bytes at *start. */
+static int open_stored(const char *user, const char *filename, off_t *start, uint64_t *size) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        FileMeta m;
+        if (meta_lookup(user, filename, &m) == 0 && m.segment) {
+            uint64_t data_off;
+            uint32_t len;
+            int fd = seg_open_record(m.segment, m.offset, &data_off, &len);
+            if (fd >= 0) {
+                *start = (off_t)data_off;
+                *size = len;
+                return fd;
+            }
+            continue;   /* compacted away under us: look it up again */
+        }
+
+        char path[STORAGE_PATH_LEN];
+        if (resolve_path(path, sizeof(path), user, filename) < 0) return -1;
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) continue;   /* moved to another root under us */
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            close(fd);
+            return -1;
+        }
+        *start = 0;
+        *size = (uint64_t)st.st_size;
+        return fd;
+    }
+    return -1;
+}
+
+static int is_shard_name(const char *name) {
+    return strlen(name) == 2 && hex_value(name[0]) >= 0 && hex_value(name[1]) >= 0;
+}
+
+typedef void (*storage_visit_fn)(uint32_t root, const char *user, const char *filename,
+                                 const char *path, const struct stat *st, void *arg);
+
+/* Visit every stored file under one user directory, descending into shard
+ * directories. Flat (legacy) names are reported as-is, sharded ones decoded. */
+static size_t walk_dir(uint32_t root, const char *user, const char *dir, int depth,
+                       storage_visit_fn fn, void *arg) {
+    size_t count = 0;
+    DIR *d = opendir(dir);
+    if (!d) return 0;
+
+    struct dirent *fe;
+    while ((fe = readdir(d)) != NULL) {
+        if (strcmp(fe->d_name, ".") == 0 || strcmp(fe->d_name, "..") == 0)
+            continue;
+
+        char fpath[STORAGE_PATH_LEN];
+        snprintf(fpath, sizeof(fpath), "%s/%s", dir, fe->d_name);
+        struct stat st;
+        if (lstat(fpath, &st) < 0) continue;
+
+        if (S_ISDIR(st.st_mode)) {
+            if (depth < 2 && is_shard_name(fe->d_name))
+                count += walk_dir(root, user, fpath, depth + 1, fn, arg);
+            continue;
+        }
+        if (!S_ISREG(st.st_mode)) continue;
+
+        char logical[FILE_NAME_LEN];
+        if (depth == 2)
+            decode_name(fe->d_name, logical, sizeof(logical));
+        else
+            snprintf(logical, sizeof(logical), "%s", fe->d_name);
+        fn(root, user, logical, fpath, &st, arg);
+        count++;
+    }
+    closedir(d);
+    return count;
+}
+
+/* Visit every stored file on every storage root */
+static size_t walk_storage(storage_visit_fn fn, void *arg) {
+    size_t count = 0;
+    for (uint32_t r = 0; r < roots_count(); r++) {
+        DIR *base = opendir(roots_path(r));
+        if (!base) continue;
+
+        struct dirent *ue;
+        while ((ue = readdir(base)) != NULL) {
+            if (ue->d_name[0] == '.') continue;
+            char udir[PATH_LEN];
+            snprintf(udir, sizeof(udir), "%s/%s", roots_path(r), ue->d_name);
+            count += walk_dir(r, ue->d_name, udir, 0, fn, arg);
+        }
+        closedir(base);
+    }
+    return count;
+}
+
+static void index_visit(uint32_t root, const char *user, const char *filename,
+                        const char *path, const struct stat *st, void *arg) {
+    UNUSED(path);
+    UNUSED(arg);
+    /* a crash between packing or moving a file and unlinking its old copy
+     * leaves both; the newer one wins (a moved copy keeps its mtime, so
+     * for a tie the first root found keeps it) */
+    FileMeta m;
+    if (meta_lookup(user, filename, &m) == 0) {
+        if (m.segment && m.mtime > (int64_t)st->st_mtime) return;
+        if (!m.segment && m.root != root && m.mtime >= (int64_t)st->st_mtime) return;
+    }
+    meta_put(user, filename, (uint64_t)st->st_size, (int64_t)st->st_mtime, root);
+}
+
+/* Rebuild the index by replaying the segment log and walking every root.
+ * Only needed when no snapshot from a clean shutdown exists (first start or
+ * after a crash). */
+static size_t rebuild_index(void) {
+    seg_replay();
+    walk_storage(index_visit, NULL);
+    return meta_count();
+}
+
+static void migrate_visit(uint32_t root, const char *user, const char *filename,
+                          const char *path, const struct stat *st, void *arg) {
+    UNUSED(st);
+    size_t *moved = (size_t*)arg;
+    char target[STORAGE_PATH_LEN];
+    build_path(target, sizeof(target), root, user, filename);
+    if (strcmp(path, target) == 0) return;
+
+    ensure_file_dir(root, user, filename);
+    struct stat tst;
+    if (stat(target, &tst) == 0) {
+        /* a sharded copy can only come from a newer upload */
+        unlink(path);
+        return;
+    }
+    if (rename(path, target) == 0) {
+        (*moved)++;
+    } else {
+        char msg[STORAGE_PATH_LEN + 64];
+        snprintf(msg, sizeof(msg), "storage_migrate_layout: cannot move %s", path);
+        log_message("ERROR", msg);
+    }
+}
+
+int storage_migrate_layout(void) {
+    size_t moved = 0;
+    size_t seen = walk_storage(migrate_visit, &moved);
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Storage layout migration: %zu files moved, %zu already sharded",
+             moved, seen - moved);
+    log_message("INFO", msg);
+    printf("[INFO] %s\n", msg);
+    return (int)moved;
+}
+
+int storage_init(void) {
+    for (int i = 0; i < FILE_LOCK_STRIPES; i++) pthread_mutex_init(&file_locks[i], NULL);
+    ensure_base_dir();
+    for (uint32_t r = 0; r < roots_count(); r++) clear_temp(r);
+    seg_init();
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int loaded = meta_load_snapshot(META_SNAPSHOT_FILE);
+    const char *source = "snapshot";
+    if (loaded < 0) {
+        loaded = (int)rebuild_index();
+        source = "directory scan";
     }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
 
-    ensure_user_dir(user);
+    char msg[160];
+    snprintf(msg, sizeof(msg), "Storage index ready: %d files from %s in %.1f ms",
+             loaded, source,
+             (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+    log_message("INFO", msg);
+    return loaded;
+}
 
-    char fullpath[PATH_LEN];
-    build_path(fullpath, sizeof(fullpath), user, filename);
+void storage_shutdown(int persistent) {
+    seg_shutdown();
+    if (persistent) {
+        meta_save_snapshot(META_SNAPSHOT_FILE);
+    } else {
+        cleanup_user_data();
+        unlink(META_SNAPSHOT_FILE);
+    }
+    meta_reset();
+}
 
-    FILE *fp = fopen(fullpath, "wb");
+/* Tell the client it may start sending file data */
+static int send_ready(int sockfd) {
+    Packet ready;
+    init_packet(&ready, CMD_ACK, "READY");
+    return send_packet(sockfd, &ready);
+}
+
+/* Turn an upload away before any data is sent */
+static void send_quota_exceeded(int sockfd) {
+    Packet err;
+    init_packet(&err, CMD_ERROR, "QUOTA_EXCEEDED");
+    send_packet(sockfd, &err);
+}
+
+static void md5_hex_of(const void *data, size_t len, char *hex) {
+    unsigned char digest[MD5_DIGEST_LEN];
+    md5_digest(data, len, digest);
+    md5_to_hex(digest, hex);
+}
+
+/* copy_range() through user space, hashing the bytes on the way */
+static ssize_t copy_hashed(int in_fd, int out_fd, size_t len, char *md5_hex) {
+    char *buf = malloc(CHUNK_SIZE);
+    if (!buf) return -1;
+    Md5Ctx md5;
+    md5_init(&md5);
+    size_t total = 0;
+    while (total < len) {
+        size_t want = len - total < CHUNK_SIZE ? len - total : CHUNK_SIZE;
+        ssize_t n = pread(in_fd, buf, want, (off_t)total);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        ssize_t w = 0;
+        while (w < n) {
+            ssize_t k = write(out_fd, buf + w, (size_t)(n - w));
+            if (k < 0 && errno == EINTR) continue;
+            if (k <= 0) break;
+            w += k;
+        }
+        if (w < n) break;
+        md5_update(&md5, buf, (size_t)n);
+        total += (size_t)n;
+    }
+    free(buf);
+    unsigned char digest[MD5_DIGEST_LEN];
+    md5_final(&md5, digest);
+    md5_to_hex(digest, md5_hex);
+    return (ssize_t)total;
+}
+
+/* With ready set, answer READY once the destination is open (client uploads).
+ * With md5_hex set, the MD5 of the data is worked out as it arrives. */
+static int receive_upload(int sockfd, const char *user, const char *filename, size_t filesize,
+                          int64_t mtime, int ready, char *md5_hex) {
+    /* Small files are packed into the segment log instead of getting an
+     * inode and directory entry each */
+    if (filesize <= SEGMENT_SMALL_FILE) {
+        char *data = malloc(filesize ? filesize : 1);
+        if (!data) {
+            log_message("ERROR", "handle_file_upload: malloc failed");
+            return -1;
+        }
+        if (ready && send_ready(sockfd) < 0) {
+            free(data);
+            return -1;
+        }
+        TRACE_BEGIN(t_recv);
+        if (filesize > 0 && recv_all(sockfd, data, filesize) != (ssize_t)filesize) {
+            log_message("WARN", "handle_file_upload: client closed");
+            free(data);
+            return -1;
+        }
+        TRACE_END(t_recv, TRACE_NET_RECV, filesize);
+        if (md5_hex) md5_hex_of(data, filesize, md5_hex);
+        TRACE_BEGIN(t_seg);
+        int rc = commit_packed(user, filename, data, (uint32_t)filesize, mtime);
+        TRACE_END(t_seg, TRACE_SEG_APPEND, filesize);
+        free(data);
+        if (rc < 0) return -1;
+
+        char msg[256];
+        snprintf(msg, sizeof(msg), "Uploaded %s for %s (%zu bytes, packed)", filename, user, filesize);
+        log_message("INFO", msg);
+        return 0;
+    }
+
+    /* Written aside and renamed into place, so readers and background
+     * moves only ever see complete copies */
+    uint32_t root = roots_place(user, filename);
+    ensure_file_dir(root, user, filename);
+
+    char tmppath[STORAGE_PATH_LEN];
+    TRACE_BEGIN(t_open);
+    int tmpfd = open_temp(root, tmppath, sizeof(tmppath));
+    FILE *fp = tmpfd >= 0 ? fdopen(tmpfd, "wb") : NULL;
     if (!fp) {
-        log_message("ERROR", "handle_file_upload: fopen failed");
+        log_message("ERROR", "handle_file_upload: cannot create the temp file");
+        if (tmpfd >= 0) {
+            close(tmpfd);
+            unlink(tmppath);
+        }
+        return -1;
+    }
+    TRACE_END(t_open, TRACE_FILE_OPEN, 0);
+
+    TcpTune tune;
+    tcp_tune_begin(&tune, sockfd, filesize, 0);
+    char *buf = malloc(tune.chunk_cap);
+    if (!buf) {
+        log_message("ERROR", "handle_file_upload: malloc failed");
+        fclose(fp);
+        unlink(tmppath);
+        return -1;
+    }
+    if (ready && send_ready(sockfd) < 0) {
+        free(buf);
+        fclose(fp);
+        unlink(tmppath);
         return -1;
     }
 
+    Md5Ctx md5;
+    md5_init(&md5);
     size_t total = 0;
-    char buf[CHUNK_SIZE];
     while (total < filesize) {
-        ssize_t r = recv(sockfd, buf, CHUNK_SIZE, 0);
+        size_t want = tcp_tune_chunk(&tune, filesize - total);
+        TRACE_BEGIN(t_recv);
+        ssize_t r = recv(sockfd, buf, want, 0);
         if (r <= 0) {
             if (r == 0) log_message("WARN", "handle_file_upload: client closed");
             else log_message("ERROR", "handle_file_upload: recv error");
+            free(buf);
             fclose(fp);
+            unlink(tmppath);
             return -1;
         }
+        TRACE_END(t_recv, TRACE_NET_RECV, r);
+        TRACE_BEGIN(t_write);
         fwrite(buf, 1, (size_t)r, fp);
+        TRACE_END(t_write, TRACE_DISK_WRITE, r);
+        if (md5_hex) md5_update(&md5, buf, (size_t)r);
         total += (size_t)r;
+        tcp_tune_step(&tune, (size_t)r);
+        session_progress();
+    }
+
+    free(buf);
+    tcp_tune_end(&tune, filename);
+    if (fclose(fp) != 0) {
+        log_message("ERROR", "handle_file_upload: write failed");
+        unlink(tmppath);
+        return -1;
+    }
+    if (commit_copy(tmppath, root, user, filename, total, mtime) < 0) {
+        log_message("ERROR", "handle_file_upload: cannot commit the upload");
+        return -1;
+    }
+    if (md5_hex) {
+        unsigned char digest[MD5_DIGEST_LEN];
+        md5_final(&md5, digest);
+        md5_to_hex(digest, md5_hex);
     }
 
-    fclose(fp);
     char msg[256];
     snprintf(msg, sizeof(msg), "Uploaded %s for %s (%zu bytes)", filename, user, total);
     log_message("INFO", msg);
     return 0;
 }
 
-int handle_file_download(int sockfd, const char *data) {
+/* Store filesize bytes of a file the client passed over the local socket,
+ * copying straight from its fd (in the kernel, unless md5_hex asks for the
+ * MD5, which needs the bytes) */
+static int import_upload(int src_fd, const char *user, const char *filename, size_t filesize,
+                         int64_t mtime, char *md5_hex) {
+    if (filesize <= SEGMENT_SMALL_FILE) {
+        char *data = malloc(filesize ? filesize : 1);
+        if (!data) {
+            log_message("ERROR", "handle_file_upload_fd: malloc failed");
+            return -1;
+        }
+        TRACE_BEGIN(t_read);
+        if (filesize > 0 && pread_full(src_fd, data, filesize, 0) < 0) {
+            log_message("WARN", "handle_file_upload_fd: passed file is shorter than declared");
+            free(data);
+            return -1;
+        }
+        TRACE_END(t_read, TRACE_DISK_READ, filesize);
+        if (md5_hex) md5_hex_of(data, filesize, md5_hex);
+        TRACE_BEGIN(t_seg);
+        int rc = commit_packed(user, filename, data, (uint32_t)filesize, mtime);
+        TRACE_END(t_seg, TRACE_SEG_APPEND, filesize);
+        free(data);
+        if (rc < 0) return -1;
+    } else {
+        uint32_t root = roots_place(user, filename);
+        ensure_file_dir(root, user, filename);
+        char tmppath[STORAGE_PATH_LEN];
+        int fd = open_temp(root, tmppath, sizeof(tmppath));
+        if (fd < 0) {
+            log_message("ERROR", "handle_file_upload_fd: open failed");
+            return -1;
+        }
+        TRACE_BEGIN(t_write);
+        ssize_t n = md5_hex ? copy_hashed(src_fd, fd, filesize, md5_hex)
+                            : copy_range(src_fd, 0, fd, filesize);
+        TRACE_END(t_write, TRACE_DISK_WRITE, n);
+        if (close(fd) < 0 || n != (ssize_t)filesize) {
+            log_message("ERROR", "handle_file_upload_fd: copying the passed file failed");
+            unlink(tmppath);
+            return -1;
+        }
+        if (commit_copy(tmppath, root, user, filename, filesize, mtime) < 0) {
+            log_message("ERROR", "handle_file_upload_fd: cannot commit the upload");
+            return -1;
+        }
+    }
+
+    char msg[256];
+    snprintf(msg, sizeof(msg), "Uploaded %s for %s (%zu bytes, passed fd)", filename, user, filesize);
+    log_message("INFO", msg);
+    return 0;
+}
+
+/* Whether user/filename is stored, asked only when someone watches the
+ * user (tells a new file from an overwrite) */
+static int watched_exists(const char *user, const char *filename) {
+    FileMeta m;
+    return watch_wanted(user) && meta_lookup(user, filename, &m) == 0;
+}
+
+/* Where to put an upload's MD5: only worked out when someone watches the
+ * user, as the watch event carries it */
+static char *watched_md5(const char *user, char *md5_hex) {
+    return watch_wanted(user) ? md5_hex : NULL;
+}
+
+/* Upload headers are "user:filename:size", optionally followed by
+ * ":mtime", the client's modification time of the file in seconds. Without
+ * it the file is stamped with the time it is stored. */
+static int parse_upload_header(const char *data, char *user, char *filename, size_t *filesize,
+                               int64_t *mtime) {
+    long long t = 0;
+    int n = sscanf(data, "%63[^:]:%255[^:]:%zu:%lld", user, filename, filesize, &t);
+    if (n < 3) return -1;
+    *mtime = n == 4 ? (int64_t)t : (int64_t)time(NULL);
+    return 0;
+}
+
+/* A change is committed: queue it for secondaries and watchers */
+static void note_commit(const char *user, const char *filename, WatchKind kind, uint64_t size,
+                        const char *md5_hex) {
+    repl_record(user, filename);
+    watch_notify(user, filename, kind, size, md5_hex);
+}
+
+int handle_file_upload(int sockfd, Packet *initial_request) {
     char user[USERNAME_LEN] = {0};
     char filename[FILE_NAME_LEN] = {0};
+    size_t filesize = 0;
+    int64_t mtime;
 
-    if (sscanf(data, "%63[^:]:%255s", user, filename) != 2) {
-        log_message("ERROR", "handle_file_download: bad request");
+    if (parse_upload_header(initial_request->data, user, filename, &filesize, &mtime) < 0) {
+        log_message("ERROR", "handle_file_upload: bad header");
         return -1;
     }
 
-    char fullpath[PATH_LEN];
-    build_path(fullpath, sizeof(fullpath), user, filename);
+    if (quota_reserve(user, filename, filesize) < 0) {
+        send_quota_exceeded(sockfd);
+        return FILE_OP_REPLIED;
+    }
+    int existed = watched_exists(user, filename);
+    char md5_hex[MD5_HEX_LEN] = "-";
+    int rc = receive_upload(sockfd, user, filename, filesize, mtime, 1, watched_md5(user, md5_hex));
+    quota_release(user, filesize);
+    if (rc == 0)
+        note_commit(user, filename, existed ? WATCH_OVERWRITE : WATCH_UPLOAD, filesize, md5_hex);
+    return rc;
+}
 
-    FILE *fp = fopen(fullpath, "rb");
-    if (!fp) {
+int handle_file_upload_fd(int sockfd, Packet *initial_request, int src_fd) {
+    char user[USERNAME_LEN] = {0};
+    char filename[FILE_NAME_LEN] = {0};
+    size_t filesize = 0;
+    int64_t mtime;
+
+    if (parse_upload_header(initial_request->data, user, filename, &filesize, &mtime) < 0) {
+        log_message("ERROR", "handle_file_upload_fd: bad header");
+        return -1;
+    }
+    if (src_fd < 0) {
+        log_message("WARN", "handle_file_upload_fd: no file passed with the request");
+        return -1;
+    }
+
+    if (quota_reserve(user, filename, filesize) < 0) {
+        send_quota_exceeded(sockfd);
+        return FILE_OP_REPLIED;
+    }
+    int existed = watched_exists(user, filename);
+    char md5_hex[MD5_HEX_LEN] = "-";
+    int rc = import_upload(src_fd, user, filename, filesize, mtime, watched_md5(user, md5_hex));
+    quota_release(user, filesize);
+    if (rc == 0)
+        note_commit(user, filename, existed ? WATCH_OVERWRITE : WATCH_UPLOAD, filesize, md5_hex);
+    return rc;
+}
+
+/* Send a stored file. With pass_fd (local socket) a file stored on its own
+ * goes over as an open fd for the client to copy from; packed files and
+ * TCP clients get the bytes streamed. */
+static int send_download(int sockfd, const char *data, int pass_fd) {
+    char user[USERNAME_LEN] = {0};
+    char filename[FILE_NAME_LEN] = {0};
+
+    if (sscanf(data, "%63[^:]:%255[^\n]", user, filename) != 2) {
+        log_message("ERROR", "handle_file_download: bad request");
+        return -1;
+    }
+
+    off_t start;
+    uint64_t filesize;
+    TRACE_BEGIN(t_open);
+    int fd = open_stored(user, filename, &start, &filesize);
+    TRACE_END(t_open, TRACE_FILE_OPEN, 0);
+    if (fd < 0) {
         log_message("WARN", "handle_file_download: file not found");
         Packet err;
         init_packet(&err, CMD_ERROR, "FILE_NOT_FOUND");
         send_packet(sockfd, &err);
-        return -1;
+        return FILE_OP_REPLIED;
     }
 
-    fseek(fp, 0, SEEK_END);
-    size_t filesize = (size_t)ftell(fp);
-    rewind(fp);
+    if (pass_fd && start == 0) {
+        char header[64];
+        snprintf(header, sizeof(header), "%llu", (unsigned long long)filesize);
+        Packet ack;
+        init_packet(&ack, CMD_ACK, header);
+        TRACE_BEGIN(t_send);
+        int rc = send_packet_fd(sockfd, &ack, fd);
+        TRACE_END(t_send, TRACE_NET_SEND, 0);
+        close(fd);
+        if (rc < 0) {
+            log_message("ERROR", "handle_file_download_fd: passing the file failed");
+            return -1;
+        }
+        meta_record_download(user, filename);
+        roots_note_access(user, filename);
+
+        char msg[256];
+        snprintf(msg, sizeof(msg), "Passed %s to local client (%llu bytes)", filename,
+                 (unsigned long long)filesize);
+        log_message("INFO", msg);
+        return 0;
+    }
+
+    /* Corked from here, so the size header leaves with the first data */
+    TcpTune tune;
+    tcp_tune_begin(&tune, sockfd, filesize, 1);
+    char *buf = malloc(tune.chunk_cap);
+    if (!buf) {
+        close(fd);
+        tcp_tune_end(&tune, filename);
+        log_message("ERROR", "handle_file_download: malloc failed");
+        return -1;
+    }
 
     char header[64];
-    snprintf(header, sizeof(header), "%zu", filesize);
+    snprintf(header, sizeof(header), "%llu", (unsigned long long)filesize);
     Packet ack;
     init_packet(&ack, CMD_ACK, header);
     if (send_packet(sockfd, &ack) < 0) {
-        fclose(fp);
+        free(buf);
+        close(fd);
+        tcp_tune_end(&tune, filename);
         log_message("ERROR", "handle_file_download: send_packet failed");
         return -1;
     }
 
-    char buf[CHUNK_SIZE];
-    size_t sent = 0;
-    size_t n;
-    while ((n = fread(buf, 1, CHUNK_SIZE, fp)) > 0) {
-        if (send_all(sockfd, buf, n) < 0) {
-            fclose(fp);
-            log_message("ERROR", "handle_file_download: send_all failed");
+    uint64_t sent = 0;
+    while (sent < filesize) {
+        size_t want = tcp_tune_chunk(&tune, filesize - sent);
+        TRACE_BEGIN(t_read);
+        ssize_t n = pread(fd, buf, want, start + (off_t)sent);
+        if (n < 0 && errno == EINTR) continue;
+        TRACE_END(t_read, TRACE_DISK_READ, n);
+        TRACE_BEGIN(t_send);
+        if (n <= 0 || send_all(sockfd, buf, (size_t)n) < 0) {
+            free(buf);
+            close(fd);
+            tcp_tune_end(&tune, filename);
+            log_message("ERROR", "handle_file_download: send failed");
             return -1;
         }
-        sent += n;
+        TRACE_END(t_send, TRACE_NET_SEND, n);
+        sent += (uint64_t)n;
+        tcp_tune_step(&tune, (size_t)n);
+        session_progress();
     }
 
-    fclose(fp);
+    free(buf);
+    close(fd);
+    tcp_tune_end(&tune, filename);
+    meta_record_download(user, filename);
+    roots_note_access(user, filename);
+
     char msg[256];
-    snprintf(msg, sizeof(msg), "Sent %s to client (%zu bytes)", filename, sent);
+    snprintf(msg, sizeof(msg), "Sent %s to client (%llu bytes)", filename, (unsigned long long)sent);
     log_message("INFO", msg);
     return 0;
 }
 
-void cleanup_user_data() {
-    const char *storage_dir = "data/storage";
-    const char *user_file = "data/users.json";
+int handle_file_download(int sockfd, const char *data) {
+    return send_download(sockfd, data, 0);
+}
 
+int handle_file_download_fd(int sockfd, const char *data) {
+    return send_download(sockfd, data, 1);
+}
+
+/* Stream one signature per full block of the basis file */
+static int send_block_signatures(int sockfd, int basis_fd, off_t basis_start,
+                                 size_t block, uint64_t nblocks) {
+    unsigned char *buf = malloc(block);
+    if (!buf) return -1;
+
+    unsigned char out[(CHUNK_SIZE / DELTA_SIG_SIZE) * DELTA_SIG_SIZE];
+    size_t used = 0;
+    for (uint64_t b = 0; b < nblocks; b++) {
+        if (pread_full(basis_fd, buf, block, basis_start + (off_t)(b * block)) < 0) {
+            free(buf);
+            return -1;
+        }
+        BlockSig sig;
+        sig.weak = delta_weak_sum(buf, block);
+        md5_digest(buf, block, sig.strong);
+        delta_sig_pack(&sig, out + used);
+        used += DELTA_SIG_SIZE;
+        if (used == sizeof(out)) {
+            if (send_all(sockfd, out, used) < 0) {
+                free(buf);
+                return -1;
+            }
+            used = 0;
+            session_progress();
+        }
+    }
+    free(buf);
+    if (used > 0 && send_all(sockfd, out, used) < 0) return -1;
+    return 0;
+}
+
+/* Returns the MD5 of the rebuilt file (checked against the client's) in md5_hex */
+static int receive_delta(int sockfd, const char *user, const char *filename, size_t filesize,
+                         int64_t mtime, char *md5_hex) {
+    uint32_t root = roots_place(user, filename);
+    ensure_file_dir(root, user, filename);
+
+    /* A missing basis just means every byte arrives as literal data */
+    off_t basis_start = 0;
+    uint64_t basis_size = 0;
+    int basis_fd = open_stored(user, filename, &basis_start, &basis_size);
+    if (basis_fd < 0) basis_size = 0;
+
+    size_t block = delta_block_size(basis_size);
+    uint64_t nblocks = basis_fd >= 0 ? basis_size / block : 0;
+
+    char header[64];
+    snprintf(header, sizeof(header), "%zu:%llu", block, (unsigned long long)nblocks);
+    Packet ack;
+    init_packet(&ack, CMD_ACK, header);
+    TRACE_BEGIN(t_sigs);
+    if (send_packet(sockfd, &ack) < 0 ||
+        send_block_signatures(sockfd, basis_fd, basis_start, block, nblocks) < 0) {
+        log_message("ERROR", "handle_delta_upload: sending signatures failed");
+        if (basis_fd >= 0) close(basis_fd);
+        return -1;
+    }
+    TRACE_END(t_sigs, TRACE_DELTA_SIGS, nblocks);
+
+    char tmppath[STORAGE_PATH_LEN];
+    int tmpfd = open_temp(root, tmppath, sizeof(tmppath));
+    FILE *fp = tmpfd >= 0 ? fdopen(tmpfd, "wb") : NULL;
+    if (tmpfd >= 0 && !fp) close(tmpfd);
+    unsigned char *blockbuf = malloc(block);
+
+    /* After an error keep consuming instructions until DELTA_END so the
+     * connection stays in sync with the client. */
+    int failed = (fp == NULL || blockbuf == NULL);
+    int finished = 0;
+    uint64_t written = 0, literal = 0;
+    Md5Ctx md5;
+    md5_init(&md5);
+
+    Packet pkt;
+    TRACE_BEGIN(t_apply);
+    while (!finished) {
+        memset(&pkt, 0, sizeof(pkt));
+        session_progress();
+        if (recv_packet(sockfd, &pkt) < 0) {
+            log_message("WARN", "handle_delta_upload: client closed mid-transfer");
+            failed = 1;
+            break;
+        }
+
+        switch (pkt.command) {
+            case CMD_DELTA_DATA:
+                if (failed) break;
+                if (fwrite(pkt.data, 1, pkt.data_length, fp) != pkt.data_length) {
+                    failed = 1;
+                    break;
+                }
+                md5_update(&md5, pkt.data, pkt.data_length);
+                written += pkt.data_length;
+                literal += pkt.data_length;
+                break;
+
+            case CMD_DELTA_COPY: {
+                unsigned long long start = 0, count = 0;
+                if (failed) break;
+                if (sscanf(pkt.data, "%llu:%llu", &start, &count) != 2 ||
+                    start + count > nblocks || start + count < start) {
+                    log_message("ERROR", "handle_delta_upload: bad block reference");
+                    failed = 1;
+                    break;
+                }
+                for (unsigned long long b = start; b < start + count && !failed; b++) {
+                    if (pread_full(basis_fd, blockbuf, block, basis_start + (off_t)(b * block)) < 0 ||
+                        fwrite(blockbuf, 1, block, fp) != block) {
+                        failed = 1;
+                        break;
+                    }
+                    md5_update(&md5, blockbuf, block);
+                    written += block;
+                }
+                break;
+            }
+
+            case CMD_DELTA_END: {
+                finished = 1;
+                if (failed) break;
+                unsigned char digest[MD5_DIGEST_LEN];
+                char hex[MD5_HEX_LEN];
+                md5_final(&md5, digest);
+                md5_to_hex(digest, hex);
+                memcpy(md5_hex, hex, MD5_HEX_LEN);
+                if (written != filesize || pkt.data_length < MD5_HEX_LEN - 1 ||
+                    memcmp(pkt.data, hex, MD5_HEX_LEN - 1) != 0) {
+                    log_message("ERROR", "handle_delta_upload: reconstructed file does not match");
+                    failed = 1;
+                }
+                break;
+            }
+
+            default:
+                log_message("ERROR", "handle_delta_upload: unexpected command");
+                failed = 1;
+                finished = 1;
+                break;
+        }
+        if (written > filesize) failed = 1;
+    }
+    TRACE_END(t_apply, TRACE_DELTA_APPLY, literal);
+
+    free(blockbuf);
+    if (basis_fd >= 0) close(basis_fd);
+    if (fp && fclose(fp) != 0) failed = 1;
+
+    if (failed) {
+        if (tmpfd >= 0) unlink(tmppath);
+        return -1;
+    }
+
+    if (written <= SEGMENT_SMALL_FILE) {
+        /* the rebuilt file is small enough to be packed */
+        char *data = malloc(written ? written : 1);
+        int fd = open(tmppath, O_RDONLY);
+        int rc = (data && fd >= 0 && pread_full(fd, data, written, 0) == 0)
+                 ? commit_packed(user, filename, data, (uint32_t)written, mtime) : -1;
+        if (fd >= 0) close(fd);
+        free(data);
+        unlink(tmppath);
+        if (rc < 0) return -1;
+    } else if (commit_copy(tmppath, root, user, filename, written, mtime) < 0) {
+        return -1;
+    }
+
+    char msg[256];
+    snprintf(msg, sizeof(msg), "Delta upload %s for %s: %llu bytes, %llu literal",
+             filename, user, (unsigned long long)written, (unsigned long long)literal);
+    log_message("INFO", msg);
+    return 0;
+}
+
+int handle_delta_upload(int sockfd, Packet *initial_request) {
+    char user[USERNAME_LEN] = {0};
+    char filename[FILE_NAME_LEN] = {0};
+    size_t filesize = 0;
+    int64_t mtime;
+
+    if (parse_upload_header(initial_request->data, user, filename, &filesize, &mtime) < 0) {
+        log_message("ERROR", "handle_delta_upload: bad header");
+        return -1;
+    }
+
+    if (quota_reserve(user, filename, filesize) < 0) {
+        send_quota_exceeded(sockfd);
+        return FILE_OP_REPLIED;
+    }
+    int existed = watched_exists(user, filename);
+    char md5_hex[MD5_HEX_LEN] = "-";
+    int rc = receive_delta(sockfd, user, filename, filesize, mtime, md5_hex);
+    quota_release(user, filesize);
+    if (rc == 0)
+        note_commit(user, filename, existed ? WATCH_OVERWRITE : WATCH_UPLOAD, filesize, md5_hex);
+    return rc;
+}
+
+int handle_file_delete(const char *data) {
+    char user[USERNAME_LEN] = {0};
+    char filename[FILE_NAME_LEN] = {0};
+
+    if (sscanf(data, "%63[^:]:%255[^\n]", user, filename) != 2) {
+        log_message("ERROR", "handle_file_delete: bad request");
+        return -1;
+    }
+
+    if (!seg_forget(user, filename)) {
+        pthread_mutex_t *lock = file_lock(user, filename);
+        pthread_mutex_lock(lock);
+        int removed = drop_copies(user, filename, ROOT_NONE);
+        if (removed) meta_remove(user, filename);
+        pthread_mutex_unlock(lock);
+        if (!removed) {
+            log_message("WARN", "handle_file_delete: file not found");
+            return -1;
+        }
+    }
+
+    note_commit(user, filename, WATCH_DELETE, 0, NULL);
+
+    char msg[256];
+    snprintf(msg, sizeof(msg), "Deleted %s for %s", filename, user);
+    log_message("INFO", msg);
+    return 0;
+}
+
+int storage_open(const char *user, const char *filename, off_t *start, uint64_t *size) {
+    return open_stored(user, filename, start, size);
+}
+
+int storage_receive(int sockfd, const char *user, const char *filename, size_t size,
+                    int64_t mtime) {
+    int existed = watched_exists(user, filename);
+    char md5_hex[MD5_HEX_LEN] = "-";
+    int rc = receive_upload(sockfd, user, filename, size, mtime, 0, watched_md5(user, md5_hex));
+    if (rc == 0)
+        watch_notify(user, filename, existed ? WATCH_OVERWRITE : WATCH_UPLOAD, size, md5_hex);
+    return rc;
+}
+
+int storage_move(const char *user, const char *filename, uint32_t root) {
+    FileMeta m;
+    if (root >= roots_count() || meta_lookup(user, filename, &m) < 0 || m.segment || m.root == root)
+        return -1;
+
+    char src[STORAGE_PATH_LEN], dst[STORAGE_PATH_LEN];
+    char tmppath[STORAGE_PATH_LEN];
+    if (locate_root(user, filename, src, sizeof(src)) < 0) return -1;
+    build_path(dst, sizeof(dst), root, user, filename);
+
+    int in = open(src, O_RDONLY);
+    if (in < 0) return -1;
+    struct stat st;
+    if (fstat(in, &st) < 0 || (uint64_t)st.st_size != m.size) {
+        close(in);
+        return -1;
+    }
+
+    /* Copy without holding anything: uploads replace files by rename, so
+     * the source inode cannot change underneath, only be replaced */
+    ensure_file_dir(root, user, filename);
+    int out = open_temp(root, tmppath, sizeof(tmppath));
+    if (out < 0) {
+        close(in);
+        log_message("ERROR", "storage_move: cannot create the new copy");
+        return -1;
+    }
+    TRACE_BEGIN(t_copy);
+    ssize_t n = copy_range(in, 0, out, m.size);
+    TRACE_END(t_copy, TRACE_DISK_WRITE, n);
+    /* keep the mtime so an index rebuild sees both copies as the same version */
+    struct timespec times[2] = { st.st_atim, st.st_mtim };
+    int ok = n == (ssize_t)m.size && futimens(out, times) == 0 && fsync(out) == 0;
+    close(in);
+    if (close(out) < 0) ok = 0;
+    if (!ok) {
+        unlink(tmppath);
+        log_message("ERROR", "storage_move: copying failed");
+        return -1;
+    }
+
+    pthread_mutex_t *lock = file_lock(user, filename);
+    pthread_mutex_lock(lock);
+    struct stat now;
+    int rc = -1;
+    if (stat(src, &now) == 0 && now.st_ino == st.st_ino && now.st_dev == st.st_dev &&
+        rename(tmppath, dst) == 0) {
+        if (meta_move_root(user, filename, m.root, m.size, m.mtime, root) == 0) {
+            unlink(src);
+            rc = 0;
+        } else {
+            unlink(dst);    /* packed into a segment meanwhile */
+        }
+    }
+    pthread_mutex_unlock(lock);
+    if (rc < 0) unlink(tmppath);
+    return rc;
+}
+
+/* Empty one storage root, keeping the directory itself */
+static void clear_root(const char *storage_dir) {
     DIR *dir = opendir(storage_dir);
     if (dir) {
         struct dirent *entry;
@@ -147,6 +1206,12 @@ void cleanup_user_data() {
         }
         closedir(dir);
     }
+}
+
+void cleanup_user_data() {
+    const char *user_file = "data/users.json";
+
+    for (uint32_t r = 0; r < roots_count(); r++) clear_root(roots_path(r));
 
     if (remove(user_file) == 0) {
         log_message("INFO", "Removed users.json (user profiles cleared).");
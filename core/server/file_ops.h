@@ -3,13 +3,59 @@
 
 #include "../common/common.h"
 #include "../common/protocol.h"
+#include "metadata.h"
 
 #define STORAGE_BASE "data/storage"
 #define CHUNK_SIZE 4096
 
+/* Returned by a handler that has already sent its error reply (e.g.
+ * QUOTA_EXCEEDED, FILE_NOT_FOUND), so the caller must not send another */
+#define FILE_OP_REPLIED (-2)
+
+/* Load the metadata index (snapshot or rescan). Call once before serving. */
+int storage_init(void);
+
+/* Persist the index on shutdown; ephemeral mode wipes all user data instead */
+void storage_shutdown(int persistent);
+
+/* "user:filename:size" header; once the size fits the user's quota the
+ * server answers ACK "READY" and only then receives the file data. */
 int handle_file_upload(int sockfd, Packet *initial_request);
 int handle_file_download(int sockfd, const char *data);
 
+/* Local-socket variants (CMD_UPLOAD_FD/CMD_DOWNLOAD_FD). The upload copies
+ * from src_fd, the client's open file, with no READY handshake. The
+ * download passes the stored file's fd along with ACK "size" when it is
+ * stored on its own; packed files are streamed as usual after the ACK. */
+int handle_file_upload_fd(int sockfd, Packet *initial_request, int src_fd);
+int handle_file_download_fd(int sockfd, const char *data);
+
+/* Delete "user:filename" wherever it is stored (returns 0 on success) */
+int handle_file_delete(const char *data);
+
+/* rsync-style upload: send block signatures of the stored copy, then rebuild
+ * the new version from literal data and block references (CMD_DELTA_*). */
+int handle_delta_upload(int sockfd, Packet *initial_request);
+
+/* Open a stored file for reading; its bytes are [*start, *start + *size)
+ * of the returned fd (returns -1 if not stored) */
+int storage_open(const char *user, const char *filename, off_t *start, uint64_t *size);
+
+/* Store size bytes read from sockfd as user/filename, modified at mtime,
+ * with no handshake and no quota check (replication) */
+int storage_receive(int sockfd, const char *user, const char *filename, size_t size,
+                    int64_t mtime);
+
+/* Move a file stored on its own onto another storage root, copying it
+ * there before the old copy is removed (returns 0 if moved, -1 if it is
+ * packed, already there, or was replaced or deleted meanwhile) */
+int storage_move(const char *user, const char *filename, uint32_t root);
+
+/* Wipe every storage root and the user list (ephemeral mode) */
 void cleanup_user_data(void);
 
+/* Move files from the old flat data/storage/<user>/ layout into hash-sharded
+ * directories (returns number of files moved). Run with the server stopped. */
+int storage_migrate_layout(void);
+
 #endif /* FILE_OPS_H */
@@ -1,5 +1,12 @@
 #include "server.h"
 #include "../common/common.h"
+#include "cluster.h"
+#include "file_ops.h"
+#include "quota.h"
+#include "replication.h"
+#include "storage_roots.h"
+#include "trace.h"
+#include "watch.h"
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,8 +19,31 @@ void handle_signal(int sig) {
 
 int main(int argc, char *argv[]) {
     int port = 8080;
-    if (argc > 1)
-        port = atoi(argv[1]);
+    int persistent = 1;
+    int secondary = 0;
+    char *replicas[REPL_MAX_REPLICAS];
+    int replica_count = 0;
+    const char *cluster_conf = NULL;
+    const char *self = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--ephemeral") == 0)
+            persistent = 0;
+        else if (strcmp(argv[i], "--secondary") == 0)
+            secondary = 1;
+        else if (strcmp(argv[i], "--replica") == 0 && i + 1 < argc) {
+            if (replica_count < REPL_MAX_REPLICAS) replicas[replica_count++] = argv[i + 1];
+            i++;
+        } else if (strcmp(argv[i], "--cluster") == 0 && i + 1 < argc)
+            cluster_conf = argv[++i];
+        else if (strcmp(argv[i], "--self") == 0 && i + 1 < argc)
+            self = argv[++i];
+        else if (strcmp(argv[i], "--root") == 0 && i + 1 < argc) {
+            if (roots_add(argv[++i]) < 0) return 1;
+        } else if (strcmp(argv[i], "--tier-cold") == 0 && i + 1 < argc)
+            roots_set_tiering(atoi(argv[++i]));
+        else
+            port = atoi(argv[i]);
+    }
 
     printf("[INFO] Starting LocalBin server on port %d...\n", port);
 
@@ -21,12 +51,35 @@ int main(int argc, char *argv[]) {
     signal(SIGTERM, handle_signal);
 
     init_logging();
+    trace_init();
+    storage_init();
+    roots_start();
+    quota_init();
+    repl_init(secondary, replicas, replica_count);
+    watch_init();
+
+    /* A node names itself as the node list does; default to loopback */
+    char self_buf[32];
+    if (cluster_conf && !self) {
+        snprintf(self_buf, sizeof(self_buf), "127.0.0.1:%d", port);
+        self = self_buf;
+    }
+    if (cluster_conf && cluster_init(cluster_conf, self) < 0) {
+        log_message("ERROR", "Cluster mode could not start");
+        return 1;
+    }
 
     printf("[INFO] Waiting for client connections...\n");
     start_server(port);
 
     log_message("INFO", "Server shutting down...");
-    cleanup_user_data();
+    trace_shutdown();
+    cluster_shutdown();
+    repl_shutdown();
+    watch_shutdown();
+    quota_shutdown();
+    roots_shutdown();
+    storage_shutdown(persistent);
     log_message("INFO", "Cleanup complete. Goodbye.");
 
 }
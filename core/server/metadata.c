@@ -0,0 +1,626 @@
+#include "metadata.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+
+/*
+ * The index has two layers:
+ *   - base:    an open-addressing table mapped read-only from the snapshot
+ *              written at the last clean shutdown. Nothing is copied at
+ *              startup, so loading costs the same for 10 files or 10 million.
+ *   - overlay: a chained hash table holding every change since startup,
+ *              including tombstones for entries removed from the base.
+ * Lookups consult the overlay first. Saving merges both into a fresh table.
+ */
+
+#define META_SNAPSHOT_MAGIC   "LBINDEX"
+#define META_SNAPSHOT_VERSION 3
+#define OVERLAY_INITIAL       1024
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t bucket_count;   /* power of two */
+    uint64_t file_count;
+    uint64_t user_count;
+    uint64_t users_offset;   /* byte offset of the UserUsage array */
+    char     pad[16];
+} SnapshotHeader;
+
+typedef struct MetaNode {
+    FileMeta meta;
+    int deleted;
+    struct MetaNode *next;
+} MetaNode;
+
+static pthread_rwlock_t meta_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* base layer */
+static void *base_map = NULL;
+static size_t base_map_len = 0;
+static const FileMeta *base_slots = NULL;
+static uint64_t base_buckets = 0;
+static uint64_t base_files = 0;
+
+/* overlay layer */
+static MetaNode **overlay = NULL;
+static size_t overlay_buckets = 0;
+static size_t overlay_nodes = 0;
+
+/* live file count across both layers */
+static size_t live_files = 0;
+
+static UserUsage *usage = NULL;
+static uint64_t *usage_reserved = NULL;   /* in-flight upload bytes, parallel to usage */
+static size_t usage_count = 0;
+static size_t usage_cap = 0;
+
+/* Open-addressing index over usage[]: a slot holds position + 1, 0 = empty */
+static uint32_t *usage_slots = NULL;
+static size_t usage_slot_count = 0;
+
+/* Bumped by every change to sizes or file counts (see meta_reconcile_usage) */
+static uint64_t meta_generation = 0;
+
+static uint64_t meta_hash(const char *user, const char *name) {
+    uint64_t h = fnv1a64(user, strlen(user) + 1, FNV64_OFFSET);
+    return fnv1a64(name, strlen(name), h);
+}
+
+static int meta_matches(const FileMeta *m, const char *user, const char *name) {
+    return strcmp(m->user, user) == 0 && strcmp(m->name, name) == 0;
+}
+
+static const FileMeta *base_find(const char *user, const char *name, uint64_t h) {
+    if (!base_slots) return NULL;
+    uint64_t mask = base_buckets - 1;
+    for (uint64_t i = h & mask; base_slots[i].user[0]; i = (i + 1) & mask) {
+        if (meta_matches(&base_slots[i], user, name)) return &base_slots[i];
+    }
+    return NULL;
+}
+
+static MetaNode *overlay_find(const char *user, const char *name, uint64_t h) {
+    if (!overlay) return NULL;
+    for (MetaNode *n = overlay[h & (overlay_buckets - 1)]; n; n = n->next) {
+        if (meta_matches(&n->meta, user, name)) return n;
+    }
+    return NULL;
+}
+
+static int overlay_grow(void) {
+    size_t nb = overlay_buckets ? overlay_buckets * 2 : OVERLAY_INITIAL;
+    MetaNode **tbl = calloc(nb, sizeof(MetaNode*));
+    if (!tbl) return -1;
+    for (size_t i = 0; i < overlay_buckets; i++) {
+        MetaNode *n = overlay[i];
+        while (n) {
+            MetaNode *next = n->next;
+            uint64_t h = meta_hash(n->meta.user, n->meta.name);
+            n->next = tbl[h & (nb - 1)];
+            tbl[h & (nb - 1)] = n;
+            n = next;
+        }
+    }
+    free(overlay);
+    overlay = tbl;
+    overlay_buckets = nb;
+    return 0;
+}
+
+/* Find or create the overlay node for user/name, seeding it from the base. */
+static MetaNode *overlay_get(const char *user, const char *name, uint64_t h) {
+    MetaNode *n = overlay_find(user, name, h);
+    if (n) return n;
+
+    if (overlay_nodes >= overlay_buckets && overlay_grow() < 0) return NULL;
+
+    n = calloc(1, sizeof(MetaNode));
+    if (!n) return NULL;
+    const FileMeta *b = base_find(user, name, h);
+    if (b) {
+        n->meta = *b;
+    } else {
+        strncpy(n->meta.user, user, USERNAME_LEN - 1);
+        strncpy(n->meta.name, name, FILE_NAME_LEN - 1);
+        n->deleted = 1;
+    }
+    size_t idx = h & (overlay_buckets - 1);
+    n->next = overlay[idx];
+    overlay[idx] = n;
+    overlay_nodes++;
+    return n;
+}
+
+static size_t usage_slot(const char *user) {
+    size_t mask = usage_slot_count - 1;
+    size_t i = (size_t)fnv1a64(user, strlen(user), FNV64_OFFSET) & mask;
+    while (usage_slots[i] && strcmp(usage[usage_slots[i] - 1].user, user) != 0)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static int usage_index_grow(void) {
+    size_t ns = usage_slot_count ? usage_slot_count * 2 : 64;
+    uint32_t *slots = calloc(ns, sizeof(uint32_t));
+    if (!slots) return -1;
+    free(usage_slots);
+    usage_slots = slots;
+    usage_slot_count = ns;
+    for (size_t k = 0; k < usage_count; k++)
+        usage_slots[usage_slot(usage[k].user)] = (uint32_t)(k + 1);
+    return 0;
+}
+
+static UserUsage *usage_get(const char *user, int create) {
+    if (usage_slot_count) {
+        uint32_t pos = usage_slots[usage_slot(user)];
+        if (pos) return &usage[pos - 1];
+    }
+    if (!create) return NULL;
+    if ((usage_count + 1) * 2 > usage_slot_count && usage_index_grow() < 0) return NULL;
+    if (usage_count == usage_cap) {
+        size_t nc = usage_cap ? usage_cap * 2 : 16;
+        UserUsage *nu = realloc(usage, nc * sizeof(UserUsage));
+        if (!nu) return NULL;
+        usage = nu;
+        uint64_t *nr = realloc(usage_reserved, nc * sizeof(uint64_t));
+        if (!nr) return NULL;
+        usage_reserved = nr;
+        usage_cap = nc;
+    }
+    size_t k = usage_count++;
+    UserUsage *u = &usage[k];
+    memset(u, 0, sizeof(*u));
+    strncpy(u->user, user, USERNAME_LEN - 1);
+    usage_reserved[k] = 0;
+    usage_slots[usage_slot(u->user)] = (uint32_t)(k + 1);
+    return u;
+}
+
+int meta_load_snapshot(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        log_message("WARN", "meta_load_snapshot: snapshot truncated, ignoring");
+        return -1;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        log_message("ERROR", "meta_load_snapshot: mmap failed");
+        return -1;
+    }
+
+    const SnapshotHeader *hdr = (const SnapshotHeader*)map;
+    size_t len = (size_t)st.st_size;
+    size_t slots_end = sizeof(SnapshotHeader) + hdr->bucket_count * sizeof(FileMeta);
+    if (memcmp(hdr->magic, META_SNAPSHOT_MAGIC, sizeof(META_SNAPSHOT_MAGIC)) != 0 ||
+        hdr->version != META_SNAPSHOT_VERSION ||
+        hdr->entry_size != sizeof(FileMeta) ||
+        hdr->bucket_count == 0 || (hdr->bucket_count & (hdr->bucket_count - 1)) != 0 ||
+        hdr->file_count >= hdr->bucket_count ||
+        hdr->users_offset < slots_end ||
+        hdr->users_offset + hdr->user_count * sizeof(UserUsage) > len) {
+        munmap(map, len);
+        log_message("WARN", "meta_load_snapshot: snapshot format mismatch, ignoring");
+        return -1;
+    }
+
+    pthread_rwlock_wrlock(&meta_lock);
+    base_map = map;
+    base_map_len = len;
+    base_slots = (const FileMeta*)((const char*)map + sizeof(SnapshotHeader));
+    base_buckets = hdr->bucket_count;
+    base_files = hdr->file_count;
+    live_files = (size_t)base_files;
+
+    const UserUsage *su = (const UserUsage*)((const char*)map + hdr->users_offset);
+    for (uint64_t i = 0; i < hdr->user_count; i++) {
+        UserUsage *u = usage_get(su[i].user, 1);
+        if (u) *u = su[i];
+    }
+    pthread_rwlock_unlock(&meta_lock);
+
+    /* The mapping stays valid after unlink. Removing the file now means a
+     * crash before the next clean shutdown forces a rescan instead of
+     * trusting a stale snapshot. */
+    unlink(path);
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Index snapshot mapped: %llu files, %llu users",
+             (unsigned long long)hdr->file_count, (unsigned long long)hdr->user_count);
+    log_message("INFO", msg);
+    return (int)hdr->file_count;
+}
+
+static void snapshot_insert(FileMeta *slots, uint64_t buckets, const FileMeta *m) {
+    uint64_t mask = buckets - 1;
+    uint64_t i = meta_hash(m->user, m->name) & mask;
+    while (slots[i].user[0]) i = (i + 1) & mask;
+    slots[i] = *m;
+}
+
+int meta_save_snapshot(const char *path) {
+    pthread_rwlock_rdlock(&meta_lock);
+
+    uint64_t buckets = 16;
+    while (buckets < (uint64_t)live_files * 2 + 1) buckets <<= 1;
+
+    size_t users_offset = sizeof(SnapshotHeader) + buckets * sizeof(FileMeta);
+    size_t total = users_offset + usage_count * sizeof(UserUsage);
+
+    char tmp[PATH_LEN];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        pthread_rwlock_unlock(&meta_lock);
+        log_message("ERROR", "meta_save_snapshot: cannot create snapshot");
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)total) < 0) {
+        close(fd);
+        unlink(tmp);
+        pthread_rwlock_unlock(&meta_lock);
+        log_message("ERROR", "meta_save_snapshot: ftruncate failed");
+        return -1;
+    }
+    char *out = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (out == MAP_FAILED) {
+        close(fd);
+        unlink(tmp);
+        pthread_rwlock_unlock(&meta_lock);
+        log_message("ERROR", "meta_save_snapshot: mmap failed");
+        return -1;
+    }
+
+    /* ftruncate zero-fills, so every slot starts out empty */
+    FileMeta *slots = (FileMeta*)(out + sizeof(SnapshotHeader));
+    uint64_t written = 0;
+    for (size_t i = 0; i < overlay_buckets; i++) {
+        for (MetaNode *n = overlay[i]; n; n = n->next) {
+            if (n->deleted) continue;
+            snapshot_insert(slots, buckets, &n->meta);
+            written++;
+        }
+    }
+    for (uint64_t i = 0; i < base_buckets; i++) {
+        const FileMeta *b = &base_slots[i];
+        if (!b->user[0]) continue;
+        if (overlay_find(b->user, b->name, meta_hash(b->user, b->name))) continue;
+        snapshot_insert(slots, buckets, b);
+        written++;
+    }
+    if (usage_count > 0)
+        memcpy(out + users_offset, usage, usage_count * sizeof(UserUsage));
+
+    SnapshotHeader *hdr = (SnapshotHeader*)out;
+    memcpy(hdr->magic, META_SNAPSHOT_MAGIC, sizeof(META_SNAPSHOT_MAGIC));
+    hdr->version = META_SNAPSHOT_VERSION;
+    hdr->entry_size = sizeof(FileMeta);
+    hdr->bucket_count = buckets;
+    hdr->file_count = written;
+    hdr->user_count = usage_count;
+    hdr->users_offset = users_offset;
+
+    pthread_rwlock_unlock(&meta_lock);
+
+    int rc = msync(out, total, MS_SYNC);
+    munmap(out, total);
+    if (rc == 0) rc = fsync(fd);
+    close(fd);
+    if (rc == 0) rc = rename(tmp, path);
+    if (rc != 0) {
+        unlink(tmp);
+        log_message("ERROR", "meta_save_snapshot: could not write snapshot");
+        return -1;
+    }
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Index snapshot written: %llu files", (unsigned long long)written);
+    log_message("INFO", msg);
+    return 0;
+}
+
+void meta_reset(void) {
+    pthread_rwlock_wrlock(&meta_lock);
+    for (size_t i = 0; i < overlay_buckets; i++) {
+        MetaNode *n = overlay[i];
+        while (n) {
+            MetaNode *next = n->next;
+            free(n);
+            n = next;
+        }
+    }
+    free(overlay);
+    overlay = NULL;
+    overlay_buckets = overlay_nodes = 0;
+
+    if (base_map) munmap(base_map, base_map_len);
+    base_map = NULL;
+    base_map_len = 0;
+    base_slots = NULL;
+    base_buckets = base_files = 0;
+
+    free(usage);
+    free(usage_reserved);
+    free(usage_slots);
+    usage = NULL;
+    usage_reserved = NULL;
+    usage_slots = NULL;
+    usage_count = usage_cap = usage_slot_count = 0;
+    live_files = 0;
+    pthread_rwlock_unlock(&meta_lock);
+}
+
+int meta_lookup(const char *user, const char *name, FileMeta *out) {
+    uint64_t h = meta_hash(user, name);
+    int found = 0;
+
+    pthread_rwlock_rdlock(&meta_lock);
+    MetaNode *n = overlay_find(user, name, h);
+    if (n) {
+        if (!n->deleted) {
+            if (out) *out = n->meta;
+            found = 1;
+        }
+    } else {
+        const FileMeta *b = base_find(user, name, h);
+        if (b) {
+            if (out) *out = *b;
+            found = 1;
+        }
+    }
+    pthread_rwlock_unlock(&meta_lock);
+    return found ? 0 : -1;
+}
+
+static void meta_store(const char *user, const char *name, uint64_t size, int64_t mtime,
+                       uint32_t root, uint32_t segment, uint64_t offset) {
+    uint64_t h = meta_hash(user, name);
+
+    pthread_rwlock_wrlock(&meta_lock);
+    MetaNode *n = overlay_get(user, name, h);
+    UserUsage *u = usage_get(user, 1);
+    if (!n || !u) {
+        pthread_rwlock_unlock(&meta_lock);
+        log_message("ERROR", "meta_store: out of memory");
+        return;
+    }
+
+    if (n->deleted) {
+        n->deleted = 0;
+        n->meta.downloads = 0;
+        u->files++;
+        live_files++;
+    } else {
+        u->bytes -= n->meta.size;
+    }
+    n->meta.size = size;
+    n->meta.mtime = mtime;
+    n->meta.atime = mtime;
+    n->meta.root = root;
+    n->meta.segment = segment;
+    n->meta.offset = offset;
+    u->bytes += size;
+    meta_generation++;
+    pthread_rwlock_unlock(&meta_lock);
+}
+
+void meta_put(const char *user, const char *name, uint64_t size, int64_t mtime, uint32_t root) {
+    meta_store(user, name, size, mtime, root, 0, 0);
+}
+
+void meta_put_segment(const char *user, const char *name, uint64_t size, int64_t mtime,
+                      uint32_t segment, uint64_t offset) {
+    meta_store(user, name, size, mtime, 0, segment, offset);
+}
+
+int meta_relocate(const char *user, const char *name, uint32_t old_segment, uint64_t old_offset,
+                  uint32_t new_segment, uint64_t new_offset) {
+    uint64_t h = meta_hash(user, name);
+    int rc = -1;
+
+    pthread_rwlock_wrlock(&meta_lock);
+    MetaNode *n = overlay_get(user, name, h);
+    if (n && !n->deleted && n->meta.segment == old_segment && n->meta.offset == old_offset) {
+        n->meta.segment = new_segment;
+        n->meta.offset = new_offset;
+        rc = 0;
+    }
+    pthread_rwlock_unlock(&meta_lock);
+    return rc;
+}
+
+int meta_move_root(const char *user, const char *name, uint32_t old_root, uint64_t size,
+                   int64_t mtime, uint32_t new_root) {
+    uint64_t h = meta_hash(user, name);
+    int rc = -1;
+
+    pthread_rwlock_wrlock(&meta_lock);
+    MetaNode *n = overlay_get(user, name, h);
+    if (n && !n->deleted && n->meta.segment == 0 && n->meta.root == old_root &&
+        n->meta.size == size && n->meta.mtime == mtime) {
+        n->meta.root = new_root;
+        rc = 0;
+    }
+    pthread_rwlock_unlock(&meta_lock);
+    return rc;
+}
+
+void meta_remove(const char *user, const char *name) {
+    uint64_t h = meta_hash(user, name);
+
+    pthread_rwlock_wrlock(&meta_lock);
+    MetaNode *n = overlay_get(user, name, h);
+    if (n && !n->deleted) {
+        UserUsage *u = usage_get(user, 0);
+        if (u) {
+            u->files--;
+            u->bytes -= n->meta.size;
+        }
+        n->deleted = 1;
+        live_files--;
+        meta_generation++;
+    }
+    pthread_rwlock_unlock(&meta_lock);
+}
+
+void meta_record_download(const char *user, const char *name) {
+    uint64_t h = meta_hash(user, name);
+
+    pthread_rwlock_wrlock(&meta_lock);
+    MetaNode *n = overlay_get(user, name, h);
+    if (n && !n->deleted) {
+        n->meta.downloads++;
+        n->meta.atime = (int64_t)time(NULL);
+        UserUsage *u = usage_get(user, 0);
+        if (u) u->downloads++;
+    }
+    pthread_rwlock_unlock(&meta_lock);
+}
+
+int meta_user_usage(const char *user, UserUsage *out) {
+    pthread_rwlock_rdlock(&meta_lock);
+    UserUsage *u = usage_get(user, 0);
+    if (u && out) *out = *u;
+    pthread_rwlock_unlock(&meta_lock);
+    return u ? 0 : -1;
+}
+
+int meta_reserve(const char *user, const char *name, uint64_t size, uint64_t limit,
+                 uint64_t *used) {
+    uint64_t h = meta_hash(user, name);
+
+    pthread_rwlock_wrlock(&meta_lock);
+    UserUsage *u = usage_get(user, 1);
+    if (!u) {
+        pthread_rwlock_unlock(&meta_lock);
+        log_message("ERROR", "meta_reserve: out of memory");
+        return -1;
+    }
+    uint64_t *held = &usage_reserved[u - usage];
+
+    /* An overwrite gives back the old copy's bytes once it lands */
+    uint64_t existing = 0;
+    MetaNode *n = overlay_find(user, name, h);
+    if (n) {
+        if (!n->deleted) existing = n->meta.size;
+    } else {
+        const FileMeta *b = base_find(user, name, h);
+        if (b) existing = b->size;
+    }
+
+    uint64_t current = u->bytes + *held;
+    uint64_t projected = current + size > existing ? current + size - existing : 0;
+    int rc = (limit && projected > limit) ? -1 : 0;
+    if (rc == 0) *held += size;
+    if (used) *used = current;
+    pthread_rwlock_unlock(&meta_lock);
+    return rc;
+}
+
+void meta_release(const char *user, uint64_t size) {
+    pthread_rwlock_wrlock(&meta_lock);
+    UserUsage *u = usage_get(user, 0);
+    if (u) {
+        uint64_t *held = &usage_reserved[u - usage];
+        *held = *held > size ? *held - size : 0;
+    }
+    pthread_rwlock_unlock(&meta_lock);
+}
+
+/* Caller holds meta_lock (either mode) */
+static void foreach_locked(const char *user, meta_iter_fn fn, void *arg) {
+    for (size_t i = 0; i < overlay_buckets; i++) {
+        for (MetaNode *n = overlay[i]; n; n = n->next) {
+            if (n->deleted) continue;
+            if (user && strcmp(n->meta.user, user) != 0) continue;
+            fn(&n->meta, arg);
+        }
+    }
+    for (uint64_t i = 0; i < base_buckets; i++) {
+        const FileMeta *b = &base_slots[i];
+        if (!b->user[0]) continue;
+        if (user && strcmp(b->user, user) != 0) continue;
+        if (overlay_find(b->user, b->name, meta_hash(b->user, b->name))) continue;
+        fn(b, arg);
+    }
+}
+
+void meta_foreach(const char *user, meta_iter_fn fn, void *arg) {
+    pthread_rwlock_rdlock(&meta_lock);
+    foreach_locked(user, fn, arg);
+    pthread_rwlock_unlock(&meta_lock);
+}
+
+typedef struct {
+    uint64_t files;
+    uint64_t bytes;
+} UsageTotal;
+
+static void tally_visit(const FileMeta *meta, void *arg) {
+    UserUsage *u = usage_get(meta->user, 0);
+    if (!u) return;
+    UsageTotal *t = (UsageTotal*)arg + (u - usage);
+    t->files++;
+    t->bytes += meta->size;
+}
+
+int meta_reconcile_usage(void) {
+    /* Recount under the read lock so uploads keep landing meanwhile */
+    pthread_rwlock_rdlock(&meta_lock);
+    size_t n = usage_count;
+    uint64_t gen = meta_generation;
+    UsageTotal *totals = calloc(n ? n : 1, sizeof(UsageTotal));
+    if (!totals) {
+        pthread_rwlock_unlock(&meta_lock);
+        log_message("ERROR", "meta_reconcile_usage: out of memory");
+        return -1;
+    }
+    foreach_locked(NULL, tally_visit, totals);
+    size_t drifted = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (totals[i].files != usage[i].files || totals[i].bytes != usage[i].bytes) drifted++;
+    }
+    pthread_rwlock_unlock(&meta_lock);
+
+    if (drifted == 0) {
+        free(totals);
+        return 0;
+    }
+
+    pthread_rwlock_wrlock(&meta_lock);
+    /* A store or remove since the recount makes it stale; the next pass retries */
+    if (meta_generation != gen) {
+        pthread_rwlock_unlock(&meta_lock);
+        free(totals);
+        return 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        UserUsage *u = &usage[i];
+        if (totals[i].files == u->files && totals[i].bytes == u->bytes) continue;
+        char msg[USERNAME_LEN + 160];
+        snprintf(msg, sizeof(msg),
+                 "Usage for %s corrected: %llu files / %llu bytes -> %llu files / %llu bytes",
+                 u->user, (unsigned long long)u->files, (unsigned long long)u->bytes,
+                 (unsigned long long)totals[i].files, (unsigned long long)totals[i].bytes);
+        log_message("WARN", msg);
+        u->files = totals[i].files;
+        u->bytes = totals[i].bytes;
+    }
+    pthread_rwlock_unlock(&meta_lock);
+    free(totals);
+    return (int)drifted;
+}
+
+size_t meta_count(void) {
+    pthread_rwlock_rdlock(&meta_lock);
+    size_t n = live_files;
+    pthread_rwlock_unlock(&meta_lock);
+    return n;
+}
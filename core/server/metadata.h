@@ -0,0 +1,80 @@
+#ifndef METADATA_H
+#define METADATA_H
+
+#include "../common/common.h"
+
+#define META_SNAPSHOT_FILE "data/index.snap"
+
+/* One stored file. Also the on-disk slot format of the snapshot, so keep it
+ * fixed-size and pointer-free; bump META_SNAPSHOT_VERSION when it changes. */
+typedef struct {
+    char     user[USERNAME_LEN];
+    char     name[FILE_NAME_LEN];
+    uint64_t size;
+    int64_t  mtime;
+    uint64_t downloads;
+    uint32_t segment;    /* 0 = stored as its own file, else segment id */
+    uint32_t root;       /* storage root of a file stored on its own */
+    uint64_t offset;     /* record offset inside the segment */
+    int64_t  atime;      /* last upload or download */
+} FileMeta;
+
+/* Per-user usage counters */
+typedef struct {
+    char     user[USERNAME_LEN];
+    uint64_t files;
+    uint64_t bytes;
+    uint64_t downloads;
+} UserUsage;
+
+typedef void (*meta_iter_fn)(const FileMeta *meta, void *arg);
+
+/* Map the snapshot left by the last clean shutdown (returns file count, -1 if
+ * there is no usable snapshot and the caller must rebuild the index). */
+int meta_load_snapshot(const char *path);
+
+/* Write the current index to path atomically (returns 0 on success) */
+int meta_save_snapshot(const char *path);
+
+/* Drop all in-memory state and unmap the snapshot */
+void meta_reset(void);
+
+int meta_lookup(const char *user, const char *name, FileMeta *out);
+void meta_put(const char *user, const char *name, uint64_t size, int64_t mtime, uint32_t root);
+void meta_put_segment(const char *user, const char *name, uint64_t size, int64_t mtime,
+                      uint32_t segment, uint64_t offset);
+
+/* Point an entry at a new segment record, but only if it still refers to
+ * the old one (returns 0 if moved, -1 if the entry changed meanwhile). */
+int meta_relocate(const char *user, const char *name, uint32_t old_segment, uint64_t old_offset,
+                  uint32_t new_segment, uint64_t new_offset);
+
+/* Point an entry stored on its own at another storage root, but only if it
+ * is still the size/mtime copy on old_root (returns 0 if moved, -1 if the
+ * entry changed meanwhile). */
+int meta_move_root(const char *user, const char *name, uint32_t old_root, uint64_t size,
+                   int64_t mtime, uint32_t new_root);
+void meta_remove(const char *user, const char *name);
+void meta_record_download(const char *user, const char *name);
+
+int meta_user_usage(const char *user, UserUsage *out);
+
+/* Hold size bytes of an upload of user/name against limit (0 = unlimited),
+ * counting other in-flight uploads and crediting the copy it replaces.
+ * Returns 0 if reserved, -1 if it would exceed the limit; *used gets the
+ * user's current bytes including reservations. Pair with meta_release. */
+int meta_reserve(const char *user, const char *name, uint64_t size, uint64_t limit,
+                 uint64_t *used);
+void meta_release(const char *user, uint64_t size);
+
+/* Recount every user's files and bytes from the index and correct counters
+ * that drifted (returns number of users corrected, -1 on error). */
+int meta_reconcile_usage(void);
+
+/* Visit every live entry (user == NULL for all users). Runs under the index
+ * read lock: the callback must not modify the index. */
+void meta_foreach(const char *user, meta_iter_fn fn, void *arg);
+
+size_t meta_count(void);
+
+#endif /* METADATA_H */
@@ -0,0 +1,14 @@
+#include "file_ops.h"
+
+/* One-time tool: convert data/storage from the flat per-user layout to the
+ * hash-sharded layout. Safe to re-run; already sharded files are left alone. */
+int main(void) {
+    init_logging();
+    log_message("INFO", "Starting storage layout migration");
+
+    int moved = storage_migrate_layout();
+    if (moved < 0) return 1;
+
+    /* The index snapshot stores logical names only, so it stays valid */
+    return 0;
+}
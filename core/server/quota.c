@@ -0,0 +1,136 @@
+#include "quota.h"
+#include "auth.h"
+#include "metadata.h"
+#include <signal.h>
+
+typedef struct {
+    char user[USERNAME_LEN];
+    uint64_t limit;
+} QuotaRecord;
+
+static QuotaRecord quotas[MAX_USERS];
+static int quota_count = 0;
+static uint64_t default_limit = 0;
+
+static pthread_mutex_t reconcile_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reconcile_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t reconcile_tid;
+static int reconcile_running = 0;
+
+/* Parse lines of the form "name": bytes (one entry per line) */
+static int load_quotas(void) {
+    FILE *fp = fopen(QUOTA_FILE, "r");
+    if (!fp) {
+        log_message("INFO", "No quotas.json; storage is unlimited");
+        return 0;
+    }
+
+    char buf[512];
+    int count = 0;
+    while (fgets(buf, sizeof(buf), fp)) {
+        char *p = strchr(buf, '"');
+        if (!p) continue;
+        char *q = strchr(p + 1, '"');
+        if (!q) continue;
+        char *colon = strchr(q + 1, ':');
+        if (!colon) continue;
+
+        char *end;
+        unsigned long long limit = strtoull(colon + 1, &end, 10);
+        if (end == colon + 1) continue;
+
+        size_t len = (size_t)(q - p - 1);
+        if (len == 1 && p[1] == '*') {
+            default_limit = limit;
+            continue;
+        }
+        if (count == MAX_USERS) continue;
+        if (len >= USERNAME_LEN) len = USERNAME_LEN - 1;
+        memset(quotas[count].user, 0, USERNAME_LEN);
+        memcpy(quotas[count].user, p + 1, len);
+        quotas[count].limit = limit;
+        count++;
+    }
+    fclose(fp);
+    quota_count = count;
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Loaded %d user quotas (default %llu bytes%s)", quota_count,
+             (unsigned long long)default_limit, default_limit ? "" : ", unlimited");
+    log_message("INFO", msg);
+    return quota_count;
+}
+
+uint64_t quota_limit(const char *user) {
+    for (int i = 0; i < quota_count; i++) {
+        if (strcmp(quotas[i].user, user) == 0) return quotas[i].limit;
+    }
+    return default_limit;
+}
+
+int quota_reserve(const char *user, const char *filename, uint64_t size) {
+    uint64_t limit = quota_limit(user);
+    uint64_t used = 0;
+    if (meta_reserve(user, filename, size, limit, &used) == 0) return 0;
+
+    char msg[USERNAME_LEN + FILE_NAME_LEN + 128];
+    snprintf(msg, sizeof(msg), "Quota exceeded: %s for %s needs %llu bytes, %llu of %llu used",
+             filename, user, (unsigned long long)size, (unsigned long long)used,
+             (unsigned long long)limit);
+    log_message("WARN", msg);
+    return -1;
+}
+
+void quota_release(const char *user, uint64_t size) {
+    meta_release(user, size);
+}
+
+static void *reconcile_thread(void *arg) {
+    UNUSED(arg);
+
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+    pthread_mutex_lock(&reconcile_lock);
+    while (reconcile_running) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += QUOTA_RECONCILE_INTERVAL;
+        pthread_cond_timedwait(&reconcile_wake, &reconcile_lock, &until);
+        if (!reconcile_running) break;
+
+        pthread_mutex_unlock(&reconcile_lock);
+        meta_reconcile_usage();
+        pthread_mutex_lock(&reconcile_lock);
+    }
+    pthread_mutex_unlock(&reconcile_lock);
+    return NULL;
+}
+
+int quota_init(void) {
+    load_quotas();
+
+    pthread_mutex_lock(&reconcile_lock);
+    if (!reconcile_running) {
+        reconcile_running = 1;
+        if (pthread_create(&reconcile_tid, NULL, reconcile_thread, NULL) != 0) {
+            reconcile_running = 0;
+            log_message("ERROR", "quota_init: cannot start usage reconciler");
+        }
+    }
+    pthread_mutex_unlock(&reconcile_lock);
+    return quota_count;
+}
+
+void quota_shutdown(void) {
+    pthread_mutex_lock(&reconcile_lock);
+    if (!reconcile_running) {
+        pthread_mutex_unlock(&reconcile_lock);
+        return;
+    }
+    reconcile_running = 0;
+    pthread_cond_signal(&reconcile_wake);
+    pthread_mutex_unlock(&reconcile_lock);
+    pthread_join(reconcile_tid, NULL);
+}
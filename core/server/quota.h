@@ -0,0 +1,36 @@
+#ifndef QUOTA_H
+#define QUOTA_H
+
+#include "../common/common.h"
+
+/*
+ * Per-user storage quotas. Limits come from data/quotas.json, a flat map of
+ * username to bytes where "*" sets the default for everyone else:
+ *
+ *   { "*": 1073741824, "john": 10737418240 }
+ *
+ * A missing file or a limit of 0 means unlimited. Uploads are checked
+ * against the metadata index's usage counters from the size declared in
+ * the UPLOAD/DELTA header, before any file data moves. A background thread
+ * periodically recounts usage from the index to correct any drift.
+ */
+
+#define QUOTA_FILE                "data/quotas.json"
+#define QUOTA_RECONCILE_INTERVAL  300     /* seconds between usage recounts */
+
+/* Load quotas and start the reconciler (after the index is loaded) */
+int quota_init(void);
+
+/* Stop the reconciler (before the index is torn down) */
+void quota_shutdown(void);
+
+/* Limit in bytes for user, 0 if unlimited */
+uint64_t quota_limit(const char *user);
+
+/* Reserve size bytes for an upload of user/filename (returns 0 if it fits,
+ * -1 if it would exceed the user's quota). Release once the upload ends,
+ * whether or not it succeeded. */
+int quota_reserve(const char *user, const char *filename, uint64_t size);
+void quota_release(const char *user, uint64_t size);
+
+#endif /* QUOTA_H */
@@ -0,0 +1,772 @@
+#include "replication.h"
+#include "file_ops.h"
+#include "metadata.h"
+#include "../common/protocol.h"
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#define REPL_LOG_MAGIC "LBREPL1"
+#define REPL_SEND_CHUNK (64 * 1024)
+
+typedef struct {
+    char     magic[8];
+    uint64_t log_id;
+    uint64_t base_seq;       /* sequence number of the first record */
+    char     pad[8];
+} ReplLogHeader;
+
+/* One log record: user/filename changed at seq (fixed size, so record k
+ * lives at sizeof(ReplLogHeader) + k * sizeof(ReplRecord)) */
+typedef struct {
+    uint64_t seq;
+    ReplKey  key;
+} ReplRecord;
+
+typedef struct {
+    char host[256];
+    char port[16];
+    int sock;
+    pthread_t tid;
+} Replica;
+
+/* primary state, guarded by repl_lock */
+static pthread_mutex_t repl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t repl_wake = PTHREAD_COND_INITIALIZER;
+static int log_fd = -1;
+static uint64_t log_id = 0;
+static uint64_t log_base = 1;
+static uint64_t log_head = 0;       /* last sequence number written */
+static volatile int repl_running = 0;
+static Replica replicas[REPL_MAX_REPLICAS];
+static int replica_count = 0;
+
+/* secondary state */
+static int secondary_mode = 0;
+static int push_allowed = 0;
+static pthread_mutex_t serve_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int repl_is_secondary(void) {
+    return secondary_mode;
+}
+
+static uint64_t new_log_id(void) {
+    uint64_t id = 0;
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        if (read(fd, &id, sizeof(id)) != (ssize_t)sizeof(id)) id = 0;
+        close(fd);
+    }
+    if (id == 0) id = ((uint64_t)time(NULL) << 20) ^ (uint64_t)getpid();
+    return id;
+}
+
+/* Start an empty log at base (caller holds repl_lock) */
+static int log_create(uint64_t id, uint64_t base) {
+    char tmp[PATH_LEN];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", REPL_LOG_FILE);
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+
+    ReplLogHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, REPL_LOG_MAGIC, sizeof(hdr.magic));
+    hdr.log_id = id;
+    hdr.base_seq = base;
+    if (write(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr) || rename(tmp, REPL_LOG_FILE) != 0) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    if (log_fd >= 0) close(log_fd);
+    log_fd = fd;
+    log_id = id;
+    log_base = base;
+    log_head = base - 1;
+    return 0;
+}
+
+/* Reopen the existing log, or start a new one */
+static int log_open(void) {
+    int fd = open(REPL_LOG_FILE, O_RDWR);
+    if (fd >= 0) {
+        ReplLogHeader hdr;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && read(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr) &&
+            memcmp(hdr.magic, REPL_LOG_MAGIC, sizeof(hdr.magic)) == 0 && hdr.base_seq > 0) {
+            /* A torn record at the tail (crash mid-append) is dropped */
+            uint64_t count = ((uint64_t)st.st_size - sizeof(hdr)) / sizeof(ReplRecord);
+            if (ftruncate(fd, (off_t)(sizeof(hdr) + count * sizeof(ReplRecord))) == 0) {
+                log_fd = fd;
+                log_id = hdr.log_id;
+                log_base = hdr.base_seq;
+                log_head = log_base + count - 1;
+                return 0;
+            }
+        }
+        close(fd);
+        log_message("WARN", "repl: replication log unreadable; starting a new one");
+    }
+    return log_create(new_log_id(), 1);
+}
+
+/* Caller holds repl_lock */
+static int log_read(uint64_t seq, ReplRecord *out) {
+    if (log_fd < 0 || seq < log_base || seq > log_head) return -1;
+    off_t off = (off_t)(sizeof(ReplLogHeader) + (seq - log_base) * sizeof(ReplRecord));
+    return pread(log_fd, out, sizeof(*out), off) == (ssize_t)sizeof(*out) ? 0 : -1;
+}
+
+void repl_record(const char *user, const char *filename) {
+    pthread_mutex_lock(&repl_lock);
+    if (log_fd < 0) {
+        pthread_mutex_unlock(&repl_lock);
+        return;
+    }
+
+    /* Secondaries older than the restart are caught up by a full resync */
+    if (log_head - log_base + 1 >= REPL_LOG_MAX_RECORDS && log_create(log_id, log_head + 1) < 0)
+        log_message("ERROR", "repl_record: cannot restart replication log");
+
+    ReplRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.seq = log_head + 1;
+    strncpy(rec.key.user, user, USERNAME_LEN - 1);
+    strncpy(rec.key.name, filename, FILE_NAME_LEN - 1);
+    off_t off = (off_t)(sizeof(ReplLogHeader) + (rec.seq - log_base) * sizeof(ReplRecord));
+    if (pwrite(log_fd, &rec, sizeof(rec), off) != (ssize_t)sizeof(rec)) {
+        pthread_mutex_unlock(&repl_lock);
+        log_message("ERROR", "repl_record: cannot append to replication log");
+        return;
+    }
+    log_head = rec.seq;
+    pthread_cond_broadcast(&repl_wake);
+    pthread_mutex_unlock(&repl_lock);
+}
+
+static int replica_connect(Replica *r) {
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(r->host, r->port, &hints, &res) != 0) return -1;
+
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+/* Send the current state of user/filename: its data, or a delete */
+static int ship_key(int sock, uint64_t seq, const char *user, const char *filename) {
+    off_t start;
+    uint64_t size;
+    int fd = storage_open(user, filename, &start, &size);
+
+    char header[USERNAME_LEN + FILE_NAME_LEN + 64];
+    Packet p;
+    if (fd < 0) {
+        snprintf(header, sizeof(header), "%llu:%s:%s", (unsigned long long)seq, user, filename);
+        init_packet(&p, CMD_REPL_DELETE, header);
+        return send_packet(sock, &p);
+    }
+
+    /* Copies keep the time the client modified the file, which directory
+     * uploads compare against */
+    FileMeta m;
+    int64_t mtime = meta_lookup(user, filename, &m) == 0 ? m.mtime : (int64_t)time(NULL);
+    snprintf(header, sizeof(header), "%llu:%s:%s:%llu:%lld", (unsigned long long)seq, user, filename,
+             (unsigned long long)size, (long long)mtime);
+    init_packet(&p, CMD_REPL_PUT, header);
+    if (send_packet(sock, &p) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    char *buf = malloc(REPL_SEND_CHUNK);
+    if (!buf) {
+        close(fd);
+        return -1;
+    }
+    uint64_t sent = 0;
+    int rc = 0;
+    while (sent < size) {
+        size_t want = size - sent < REPL_SEND_CHUNK ? (size_t)(size - sent) : REPL_SEND_CHUNK;
+        ssize_t n = pread(fd, buf, want, start + (off_t)sent);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            /* Overwritten while we read it: keep the stream in step; the
+             * record for the overwrite ships the new content */
+            memset(buf, 0, want);
+            n = (ssize_t)want;
+        }
+        if (send_all(sock, buf, (size_t)n) < 0) {
+            rc = -1;
+            break;
+        }
+        sent += (uint64_t)n;
+    }
+    free(buf);
+    close(fd);
+    return rc;
+}
+
+/* End a batch; positioned = 0 for resync batches, which have no log
+ * position until the whole copy is through */
+static int send_sync(int sock, uint64_t seq, int positioned) {
+    char buf[32] = "";
+    if (positioned) snprintf(buf, sizeof(buf), "%llu", (unsigned long long)seq);
+    Packet p;
+    init_packet(&p, CMD_REPL_SYNC, buf);
+    return send_packet(sock, &p);
+}
+
+/* Read one batch acknowledgement */
+static int recv_sync_ack(int sock) {
+    Packet p;
+    if (recv_packet(sock, &p) < 0 || p.command != CMD_ACK) return -1;
+    return 0;
+}
+
+typedef struct {
+    ReplKey *keys;
+    size_t count;
+    size_t cap;
+} KeyList;
+
+static void collect_key(const FileMeta *meta, void *arg) {
+    KeyList *kl = (KeyList*)arg;
+    if (kl->count == kl->cap) {
+        size_t nc = kl->cap ? kl->cap * 2 : 256;
+        ReplKey *nk = realloc(kl->keys, nc * sizeof(ReplKey));
+        if (!nk) return;
+        kl->keys = nk;
+        kl->cap = nc;
+    }
+    ReplKey *k = &kl->keys[kl->count++];
+    memset(k, 0, sizeof(*k));
+    strncpy(k->user, meta->user, USERNAME_LEN - 1);
+    strncpy(k->name, meta->name, FILE_NAME_LEN - 1);
+}
+
+/* Ship keys in batches without a log position, blocking whenever
+ * REPL_WINDOW batches are unacknowledged. *outstanding is left with the
+ * number still to be collected. Stops early (-1) once *running drops. */
+static int ship_batches(int sock, const ReplKey *keys, size_t count, volatile int *running,
+                        int *outstanding) {
+    for (size_t i = 0; i < count; i++) {
+        if (!*running || ship_key(sock, 0, keys[i].user, keys[i].name) < 0) return -1;
+        if ((i + 1) % REPL_BATCH != 0) continue;
+        if (send_sync(sock, 0, 0) < 0) return -1;
+        if (++*outstanding >= REPL_WINDOW) {
+            if (recv_sync_ack(sock) < 0) return -1;
+            --*outstanding;
+        }
+    }
+    return 0;
+}
+
+/* Send every stored file; returns the log position the copy is current to.
+ * The secondary deletes whatever it holds that the copy leaves out (files
+ * deleted here while it was behind, or before the log restarted). */
+static int full_resync(Replica *r, uint64_t *through) {
+    pthread_mutex_lock(&repl_lock);
+    uint64_t head = log_head;
+    pthread_mutex_unlock(&repl_lock);
+
+    /* Changes after head are in the log, so shipping them again is harmless */
+    KeyList kl = { NULL, 0, 0 };
+    meta_foreach(NULL, collect_key, &kl);
+
+    char msg[384];
+    snprintf(msg, sizeof(msg), "Replica %s:%s: full resync of %zu files", r->host, r->port, kl.count);
+    log_message("INFO", msg);
+
+    Packet p;
+    init_packet(&p, CMD_REPL_RESYNC, "");
+    int outstanding = 0;
+    int rc = send_packet(r->sock, &p);
+    if (rc == 0) rc = ship_batches(r->sock, kl.keys, kl.count, &repl_running, &outstanding);
+    free(kl.keys);
+    if (rc < 0) return -1;
+
+    if (send_sync(r->sock, head, 1) < 0) return -1;
+    for (outstanding++; outstanding > 0; outstanding--) {
+        if (recv_sync_ack(r->sock) < 0) return -1;
+    }
+    *through = head;
+    return 0;
+}
+
+/* One connection to a secondary: handshake, catch up, then follow the log */
+static int replica_session(Replica *r) {
+    const char *token = getenv(REPL_TOKEN_ENV);
+    char buf[MAX_PAYLOAD];
+    snprintf(buf, sizeof(buf), "%s:%llx", token ? token : "", (unsigned long long)log_id);
+
+    Packet p;
+    init_packet(&p, CMD_REPL_HELLO, buf);
+    if (send_packet(r->sock, &p) < 0 || recv_packet(r->sock, &p) < 0) return -1;
+    if (p.command != CMD_ACK) {
+        char msg[384];
+        snprintf(msg, sizeof(msg), "Replica %s:%s refused replication: %.*s", r->host, r->port,
+                 (int)(p.data_length < 64 ? p.data_length : 64), p.data);
+        log_message("ERROR", msg);
+        return -1;
+    }
+
+    unsigned long long their_id = 0, their_seq = 0;
+    if (sscanf(p.data, "%llx:%llu", &their_id, &their_seq) != 2) return -1;
+
+    pthread_mutex_lock(&repl_lock);
+    int in_log = their_id == log_id && their_seq + 1 >= log_base && their_seq <= log_head;
+    uint64_t head = log_head;
+    pthread_mutex_unlock(&repl_lock);
+
+    char msg[384];
+    snprintf(msg, sizeof(msg), "Replica %s:%s connected at seq %llu (primary at %llu)",
+             r->host, r->port, their_seq, (unsigned long long)head);
+    log_message("INFO", msg);
+
+    uint64_t synced = their_seq;
+    if (!in_log && full_resync(r, &synced) < 0) return -1;
+
+    uint64_t next = synced + 1;
+    int outstanding = 0;
+    while (repl_running) {
+        ReplRecord batch[REPL_BATCH];
+        int n = 0, lost = 0;
+
+        pthread_mutex_lock(&repl_lock);
+        if (next > log_head && outstanding == 0) {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_sec += REPL_HEARTBEAT;
+            pthread_cond_timedwait(&repl_wake, &repl_lock, &until);
+        }
+        while (n < REPL_BATCH && next + (uint64_t)n <= log_head) {
+            if (log_read(next + (uint64_t)n, &batch[n]) < 0) {
+                lost = 1;
+                break;
+            }
+            n++;
+        }
+        pthread_mutex_unlock(&repl_lock);
+        if (!repl_running) break;
+
+        /* The log restarted past our position */
+        if (lost && n == 0) {
+            while (outstanding > 0 && recv_sync_ack(r->sock) == 0) outstanding--;
+            if (outstanding > 0 || full_resync(r, &synced) < 0) return -1;
+            next = synced + 1;
+            continue;
+        }
+
+        for (int i = 0; i < n; i++) {
+            ReplKey *k = &batch[i].key;
+            k->user[USERNAME_LEN - 1] = '\0';
+            k->name[FILE_NAME_LEN - 1] = '\0';
+            if (ship_key(r->sock, batch[i].seq, k->user, k->name) < 0) return -1;
+        }
+        next += (uint64_t)n;
+
+        /* An empty batch is the heartbeat, and flushes outstanding acks */
+        if (n > 0 || outstanding == 0) {
+            if (send_sync(r->sock, next - 1, 1) < 0) return -1;
+            outstanding++;
+        }
+
+        /* Backpressure: block once REPL_WINDOW batches are in flight; also
+         * collect acks as they arrive, and all of them when idle */
+        for (;;) {
+            struct pollfd pfd = { r->sock, POLLIN, 0 };
+            int ready = outstanding >= REPL_WINDOW || (n == 0 && outstanding > 0) ||
+                        (outstanding > 0 && poll(&pfd, 1, 0) > 0);
+            if (!ready) break;
+            if (recv_sync_ack(r->sock) < 0) return -1;
+            outstanding--;
+        }
+    }
+    return 0;
+}
+
+static void *shipper_thread(void *arg) {
+    Replica *r = (Replica*)arg;
+
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+    unsigned backoff = 1;
+    while (repl_running) {
+        int fd = replica_connect(r);
+        if (fd >= 0) {
+            pthread_mutex_lock(&repl_lock);
+            r->sock = fd;
+            pthread_mutex_unlock(&repl_lock);
+
+            if (replica_session(r) == 0) backoff = 1;
+
+            pthread_mutex_lock(&repl_lock);
+            r->sock = -1;
+            pthread_mutex_unlock(&repl_lock);
+            close(fd);
+            if (repl_running) {
+                char msg[320];
+                snprintf(msg, sizeof(msg), "Replica %s:%s disconnected; retrying in %us",
+                         r->host, r->port, backoff);
+                log_message("WARN", msg);
+            }
+        }
+
+        pthread_mutex_lock(&repl_lock);
+        if (repl_running) {
+            struct timespec until;
+            clock_gettime(CLOCK_REALTIME, &until);
+            until.tv_sec += backoff;
+            pthread_cond_timedwait(&repl_wake, &repl_lock, &until);
+        }
+        pthread_mutex_unlock(&repl_lock);
+        backoff = backoff * 2 > REPL_MAX_BACKOFF ? REPL_MAX_BACKOFF : backoff * 2;
+    }
+    return NULL;
+}
+
+int repl_init(int secondary, char *const targets[], int count) {
+    if (secondary) {
+        secondary_mode = 1;
+        const char *token = getenv(REPL_TOKEN_ENV);
+        log_message(token && *token ? "INFO" : "WARN",
+                    token && *token ? "Running as replication secondary (read-only)"
+                                    : "Running as replication secondary, but " REPL_TOKEN_ENV
+                                      " is not set: no primary can connect");
+        return 0;
+    }
+    if (count <= 0) return 0;
+    if (count > REPL_MAX_REPLICAS) count = REPL_MAX_REPLICAS;
+
+    pthread_mutex_lock(&repl_lock);
+    if (log_open() < 0) {
+        pthread_mutex_unlock(&repl_lock);
+        log_message("ERROR", "repl_init: cannot open replication log");
+        return -1;
+    }
+    repl_running = 1;
+    pthread_mutex_unlock(&repl_lock);
+
+    for (int i = 0; i < count; i++) {
+        Replica *r = &replicas[replica_count];
+        memset(r, 0, sizeof(*r));
+        r->sock = -1;
+        const char *colon = strrchr(targets[i], ':');
+        if (!colon || colon == targets[i] || (size_t)(colon - targets[i]) >= sizeof(r->host)) {
+            char msg[320];
+            snprintf(msg, sizeof(msg), "repl_init: bad replica address '%s' (want host:port)", targets[i]);
+            log_message("ERROR", msg);
+            continue;
+        }
+        memcpy(r->host, targets[i], (size_t)(colon - targets[i]));
+        strncpy(r->port, colon + 1, sizeof(r->port) - 1);
+        if (pthread_create(&r->tid, NULL, shipper_thread, r) != 0) {
+            log_message("ERROR", "repl_init: cannot start shipper thread");
+            continue;
+        }
+        replica_count++;
+    }
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Replicating to %d secondaries (log at seq %llu)", replica_count,
+             (unsigned long long)log_head);
+    log_message("INFO", msg);
+    return replica_count;
+}
+
+void repl_shutdown(void) {
+    pthread_mutex_lock(&repl_lock);
+    if (!repl_running) {
+        pthread_mutex_unlock(&repl_lock);
+        return;
+    }
+    repl_running = 0;
+    pthread_cond_broadcast(&repl_wake);
+    for (int i = 0; i < replica_count; i++) {
+        if (replicas[i].sock >= 0) shutdown(replicas[i].sock, SHUT_RDWR);
+    }
+    pthread_mutex_unlock(&repl_lock);
+
+    for (int i = 0; i < replica_count; i++) pthread_join(replicas[i].tid, NULL);
+    replica_count = 0;
+
+    pthread_mutex_lock(&repl_lock);
+    if (log_fd >= 0) close(log_fd);
+    log_fd = -1;
+    pthread_mutex_unlock(&repl_lock);
+}
+
+int repl_push(const char *target, const ReplKey *keys, size_t count, volatile int *running) {
+    Replica r;
+    memset(&r, 0, sizeof(r));
+    const char *colon = strrchr(target, ':');
+    if (!colon || colon == target || (size_t)(colon - target) >= sizeof(r.host)) return -1;
+    memcpy(r.host, target, (size_t)(colon - target));
+    strncpy(r.port, colon + 1, sizeof(r.port) - 1);
+
+    int sock = replica_connect(&r);
+    if (sock < 0) return -1;
+
+    /* Log id 0 marks a one-off push: the receiver keeps no position */
+    const char *token = getenv(REPL_TOKEN_ENV);
+    char buf[MAX_PAYLOAD];
+    snprintf(buf, sizeof(buf), "%s:0", token ? token : "");
+    Packet p;
+    init_packet(&p, CMD_REPL_HELLO, buf);
+    int outstanding = 0;
+    int rc = -1;
+    if (send_packet(sock, &p) == 0 && recv_packet(sock, &p) == 0 && p.command == CMD_ACK &&
+        ship_batches(sock, keys, count, running, &outstanding) == 0 &&
+        send_sync(sock, 0, 0) == 0) {
+        rc = 0;
+        for (outstanding++; outstanding > 0; outstanding--) {
+            if (recv_sync_ack(sock) < 0) {
+                rc = -1;
+                break;
+            }
+        }
+    }
+    close(sock);
+    return rc;
+}
+
+void repl_allow_push(void) {
+    push_allowed = 1;
+}
+
+/* ---- secondary side ---- */
+
+static void state_load(uint64_t *id, uint64_t *seq) {
+    *id = *seq = 0;
+    FILE *fp = fopen(REPL_STATE_FILE, "r");
+    if (!fp) return;
+    unsigned long long i = 0, s = 0;
+    if (fscanf(fp, "%llx %llu", &i, &s) == 2) {
+        *id = i;
+        *seq = s;
+    }
+    fclose(fp);
+}
+
+static int state_save(uint64_t id, uint64_t seq) {
+    char tmp[PATH_LEN];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", REPL_STATE_FILE);
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) return -1;
+    fprintf(fp, "%llx %llu\n", (unsigned long long)id, (unsigned long long)seq);
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+        fclose(fp);
+        unlink(tmp);
+        return -1;
+    }
+    fclose(fp);
+    return rename(tmp, REPL_STATE_FILE);
+}
+
+/* Keys received since CMD_REPL_RESYNC, as hashes of user/name */
+typedef struct {
+    uint64_t *hashes;
+    size_t count;
+    size_t cap;
+    int active;
+    int failed;
+} SeenSet;
+
+static uint64_t key_hash(const char *user, const char *name) {
+    uint64_t h = fnv1a64(user, strlen(user) + 1, FNV64_OFFSET);
+    return fnv1a64(name, strlen(name), h);
+}
+
+static void seen_add(SeenSet *s, const char *user, const char *name) {
+    if (!s->active || s->failed) return;
+    if (s->count == s->cap) {
+        size_t nc = s->cap ? s->cap * 2 : 1024;
+        uint64_t *nh = realloc(s->hashes, nc * sizeof(uint64_t));
+        if (!nh) {
+            s->failed = 1;
+            return;
+        }
+        s->hashes = nh;
+        s->cap = nc;
+    }
+    s->hashes[s->count++] = key_hash(user, name);
+}
+
+static int hash_cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+typedef struct {
+    const SeenSet *seen;
+    KeyList stale;
+} SweepState;
+
+static void sweep_visit(const FileMeta *meta, void *arg) {
+    SweepState *st = (SweepState*)arg;
+    uint64_t h = key_hash(meta->user, meta->name);
+    if (!bsearch(&h, st->seen->hashes, st->seen->count, sizeof(uint64_t), hash_cmp))
+        collect_key(meta, &st->stale);
+}
+
+/* A resync is through: delete every file the primary did not send */
+static void seen_sweep(SeenSet *s) {
+    if (s->failed) {
+        log_message("WARN", "repl_serve: out of memory tracking the resync; stale files kept");
+    } else {
+        qsort(s->hashes, s->count, sizeof(uint64_t), hash_cmp);
+        SweepState st = { s, { NULL, 0, 0 } };
+        meta_foreach(NULL, sweep_visit, &st);   /* deletes take the index lock: collect first */
+        for (size_t i = 0; i < st.stale.count; i++) {
+            char req[USERNAME_LEN + FILE_NAME_LEN + 2];
+            snprintf(req, sizeof(req), "%s:%s", st.stale.keys[i].user, st.stale.keys[i].name);
+            handle_file_delete(req);
+        }
+        char msg[96];
+        snprintf(msg, sizeof(msg), "Resync complete: %zu files received, %zu stale files removed",
+                 s->count, st.stale.count);
+        log_message("INFO", msg);
+        free(st.stale.keys);
+    }
+    free(s->hashes);
+    memset(s, 0, sizeof(*s));
+}
+
+static void serve_reply(int sockfd, CommandType cmd, const char *text) {
+    Packet p;
+    init_packet(&p, cmd, text);
+    send_packet(sockfd, &p);
+}
+
+/* Compare the offered token with ours without stopping at the first
+ * mismatch, so response time does not reveal how much of it was right */
+static int token_matches(const char *token, const char *offered, size_t offered_len) {
+    size_t len = strlen(token);
+    unsigned char diff = (unsigned char)(len != offered_len);
+    for (size_t i = 0; i < len; i++)
+        diff |= (unsigned char)token[i] ^ (unsigned char)(i < offered_len ? offered[i] : 0);
+    return diff == 0;
+}
+
+void repl_serve(int sockfd, Session *session, const char *hello) {
+    const char *token = getenv(REPL_TOKEN_ENV);
+    const char *sep = strrchr(hello, ':');
+    unsigned long long primary_id = 0;
+
+    if (!token || !*token || !sep || !token_matches(token, hello, (size_t)(sep - hello)) ||
+        sscanf(sep + 1, "%llx", &primary_id) != 1) {
+        log_message("WARN", "repl_serve: replication handshake rejected");
+        serve_reply(sockfd, CMD_ERROR, "REPL_AUTH_FAIL");
+        return;
+    }
+
+    /* A push (log id 0) just delivers files; a primary's stream is tracked */
+    int push = primary_id == 0;
+    if (push ? !push_allowed : !secondary_mode) {
+        serve_reply(sockfd, CMD_ERROR, "NOT_SECONDARY");
+        return;
+    }
+    if (!push && pthread_mutex_trylock(&serve_lock) != 0) {
+        serve_reply(sockfd, CMD_ERROR, "REPL_BUSY");
+        return;
+    }
+
+    uint64_t state_id = 0, state_seq = 0;
+    if (!push) state_load(&state_id, &state_seq);
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%llx:%llu", (unsigned long long)state_id,
+             (unsigned long long)state_seq);
+    serve_reply(sockfd, CMD_ACK, buf);
+    log_message("INFO", push ? "Accepting pushed files" : "Replication primary connected");
+
+    uint64_t applied = 0;
+    SeenSet seen = { NULL, 0, 0, 0, 0 };
+    Packet pkt;
+    for (;;) {
+        session_set_phase(session, SESSION_IDLE);
+        memset(&pkt, 0, sizeof(pkt));
+        if (recv_packet(sockfd, &pkt) < 0) break;
+        session_set_phase(session, SESSION_TRANSFER);
+
+        char user[USERNAME_LEN] = {0};
+        char filename[FILE_NAME_LEN] = {0};
+        unsigned long long seq = 0;
+        size_t size = 0;
+
+        if (pkt.command == CMD_REPL_PUT) {
+            /* mtime is missing from an older primary's header */
+            long long mtime = (long long)time(NULL);
+            if (sscanf(pkt.data, "%llu:%63[^:]:%255[^:]:%zu:%lld", &seq, user, filename, &size,
+                       &mtime) < 4 ||
+                storage_receive(sockfd, user, filename, size, (int64_t)mtime) < 0) {
+                log_message("ERROR", "repl_serve: applying REPL_PUT failed");
+                break;
+            }
+            if (push) repl_record(user, filename);   /* pass it on to our own secondaries */
+            seen_add(&seen, user, filename);
+            applied++;
+        } else if (pkt.command == CMD_REPL_DELETE) {
+            if (sscanf(pkt.data, "%llu:%63[^:]:%255[^\n]", &seq, user, filename) != 3) break;
+            char req[USERNAME_LEN + FILE_NAME_LEN + 2];
+            snprintf(req, sizeof(req), "%s:%s", user, filename);
+            handle_file_delete(req);   /* already gone is fine */
+            applied++;
+        } else if (pkt.command == CMD_REPL_SYNC) {
+            /* An empty SYNC closes a resync batch that has no position yet */
+            if (pkt.data_length > 0) {
+                if (sscanf(pkt.data, "%llu", &seq) != 1) break;
+            } else {
+                seq = state_seq;
+            }
+            /* Swept before the position is saved, so a crash in between
+             * only means another resync */
+            if (seen.active && pkt.data_length > 0) seen_sweep(&seen);
+            if (!push && pkt.data_length > 0 && (primary_id != state_id || seq != state_seq)) {
+                if (state_save(primary_id, seq) < 0) {
+                    log_message("ERROR", "repl_serve: cannot save replication state");
+                    break;
+                }
+                state_id = primary_id;
+                state_seq = seq;
+            }
+            snprintf(buf, sizeof(buf), "%llu", seq);
+            serve_reply(sockfd, CMD_ACK, buf);
+        } else if (pkt.command == CMD_REPL_RESYNC && !push) {
+            free(seen.hashes);
+            memset(&seen, 0, sizeof(seen));
+            seen.active = 1;
+            log_message("INFO", "Full resync from the primary started");
+        } else {
+            log_message("WARN", "repl_serve: unexpected command from primary");
+            break;
+        }
+    }
+
+    free(seen.hashes);
+
+    char msg[128];
+    if (push) {
+        snprintf(msg, sizeof(msg), "Push finished (%llu files received)", (unsigned long long)applied);
+    } else {
+        snprintf(msg, sizeof(msg), "Replication primary disconnected (%llu changes applied, at seq %llu)",
+                 (unsigned long long)applied, (unsigned long long)state_seq);
+        pthread_mutex_unlock(&serve_lock);
+    }
+    log_message("INFO", msg);
+}
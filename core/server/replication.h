@@ -0,0 +1,72 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include "../common/common.h"
+#include "session.h"
+
+/*
+ * Asynchronous primary -> secondary replication.
+ *
+ * The primary appends one record per committed upload or delete to a
+ * replication log (data/replog.bin) and runs a shipper thread per secondary
+ * (--replica host:port). A record only names the changed user/file; the
+ * shipper sends whatever the primary holds for that key when it gets to it
+ * (REPL_PUT with the data, or REPL_DELETE if it is gone), so replaying a
+ * record twice or out of order still converges on the primary's state.
+ *
+ * Records go out in batches of REPL_BATCH, each closed by REPL_SYNC, which
+ * the secondary answers once its position is saved. At most REPL_WINDOW
+ * batches may be unacknowledged, so a slow secondary slows its shipper
+ * without holding anything up on the primary.
+ *
+ * A secondary (--secondary) keeps the primary's log id and the last synced
+ * sequence number in data/repl.state and reports them on connect, so a
+ * restarted secondary is caught up from where it stopped. If its position
+ * is no longer in the log (or belongs to another log) the primary resends
+ * every file instead. Secondaries serve downloads and refuse client writes.
+ *
+ * Both sides must set LOCALBIN_REPL_TOKEN to the same value.
+ */
+
+#define REPL_LOG_FILE        "data/replog.bin"
+#define REPL_STATE_FILE      "data/repl.state"
+#define REPL_TOKEN_ENV       "LOCALBIN_REPL_TOKEN"
+#define REPL_MAX_REPLICAS    8
+#define REPL_LOG_MAX_RECORDS 65536   /* log is restarted past this */
+#define REPL_BATCH           64      /* records per REPL_SYNC */
+#define REPL_WINDOW          4       /* unacknowledged batches per secondary */
+#define REPL_HEARTBEAT       2       /* seconds; idle shippers send a REPL_SYNC */
+#define REPL_MAX_BACKOFF     30      /* seconds between reconnect attempts */
+
+/* Start replication: as a secondary, or as a primary shipping to the given
+ * "host:port" targets (none = replication off). Call after storage_init. */
+int repl_init(int secondary, char *const targets[], int count);
+
+/* Stop the shippers and close the log (before storage_shutdown) */
+void repl_shutdown(void);
+
+int repl_is_secondary(void);
+
+/* Note a committed change to user/filename (no-op unless primary) */
+void repl_record(const char *user, const char *filename);
+
+typedef struct {
+    char user[USERNAME_LEN];
+    char name[FILE_NAME_LEN];
+} ReplKey;
+
+/* Copy the current state of the given files to another server ("host:port")
+ * over the replication stream, without any log position (cluster
+ * rebalancing). The target must have called repl_allow_push. Stops early
+ * when *running drops to 0. Returns 0 once the target has acknowledged
+ * everything, -1 otherwise. */
+int repl_push(const char *target, const ReplKey *keys, size_t count, volatile int *running);
+
+/* Accept repl_push connections (cluster members) */
+void repl_allow_push(void);
+
+/* Serve a primary or a push that opened with REPL_HELLO on this connection,
+ * until it disconnects. Answers an error if this server accepts neither. */
+void repl_serve(int sockfd, Session *session, const char *hello);
+
+#endif /* REPLICATION_H */
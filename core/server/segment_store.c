@@ -0,0 +1,522 @@
+#include "segment_store.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+/*
+ * Segment file = sequence of records:
+ *     SegRecordHeader | user | name | data
+ * Records are only ever appended. A later record for the same user/name
+ * supersedes earlier ones; a tombstone cancels the name. Replaying all
+ * segments in id order therefore reproduces the segment part of the index.
+ *
+ * Compaction copies records the index still points at into the active
+ * segment, then deletes the old one. Tombstones are carried forward while
+ * the segment holding the record they cancel still exists.
+ */
+
+#define SEG_RECORD_MAGIC   0x4c425347u   /* "LBSG" */
+#define SEG_REC_LIVE       1
+#define SEG_REC_TOMBSTONE  2
+
+typedef struct {
+    uint32_t magic;
+    uint16_t type;
+    uint16_t user_len;
+    uint16_t name_len;
+    uint16_t reserved;
+    uint32_t data_len;
+    uint32_t target;      /* tombstones: segment holding the cancelled record */
+    uint32_t pad;
+    int64_t  mtime;
+} SegRecordHeader;
+
+typedef struct {
+    uint32_t id;
+    uint64_t total;       /* bytes in the segment file */
+    uint64_t live;        /* bytes of records still referenced */
+} SegInfo;
+
+static pthread_mutex_t seg_lock = PTHREAD_MUTEX_INITIALIZER;
+static SegInfo *segs = NULL;
+static size_t seg_count = 0;
+static size_t seg_cap = 0;
+
+static uint32_t active_id = 0;
+static int active_fd = -1;
+static uint64_t active_size = 0;
+
+static pthread_t compactor_tid;
+static int compactor_running = 0;
+static pthread_cond_t compactor_cond = PTHREAD_COND_INITIALIZER;
+static int stats_ready = 0;
+
+static void seg_path(char *dest, size_t len, uint32_t id) {
+    snprintf(dest, len, "%s/seg-%08u.dat", SEGMENT_DIR, id);
+}
+
+static uint64_t record_size(size_t user_len, size_t name_len, uint64_t data_len) {
+    return sizeof(SegRecordHeader) + user_len + name_len + data_len;
+}
+
+/* callers hold seg_lock */
+static SegInfo *seg_info(uint32_t id) {
+    for (size_t i = 0; i < seg_count; i++) {
+        if (segs[i].id == id) return &segs[i];
+    }
+    return NULL;
+}
+
+static SegInfo *seg_add(uint32_t id, uint64_t total) {
+    if (seg_count == seg_cap) {
+        size_t nc = seg_cap ? seg_cap * 2 : 16;
+        SegInfo *ns = realloc(segs, nc * sizeof(SegInfo));
+        if (!ns) return NULL;
+        segs = ns;
+        seg_cap = nc;
+    }
+    SegInfo *si = &segs[seg_count++];
+    si->id = id;
+    si->total = total;
+    si->live = 0;
+    return si;
+}
+
+static void seg_drop(uint32_t id) {
+    for (size_t i = 0; i < seg_count; i++) {
+        if (segs[i].id == id) {
+            segs[i] = segs[--seg_count];
+            return;
+        }
+    }
+}
+
+static void seg_mark_dead(uint32_t id, uint64_t bytes) {
+    SegInfo *si = seg_info(id);
+    if (!si) return;
+    si->live = si->live > bytes ? si->live - bytes : 0;
+}
+
+static int open_active(uint32_t id) {
+    char path[PATH_LEN];
+    seg_path(path, sizeof(path), id);
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) return -1;
+
+    if (active_fd >= 0) close(active_fd);
+    active_fd = fd;
+    active_id = id;
+    active_size = 0;
+    seg_add(id, 0);
+    return 0;
+}
+
+/* Append one record to the active segment; caller holds seg_lock */
+static int append_record(uint16_t type, const char *user, const char *name,
+                         const void *data, uint32_t len, int64_t mtime, uint32_t target,
+                         uint32_t *seg_out, uint64_t *off_out) {
+    if (active_size >= SEGMENT_MAX_SIZE && open_active(active_id + 1) < 0) {
+        log_message("ERROR", "append_record: cannot roll to a new segment");
+        return -1;
+    }
+
+    SegRecordHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = SEG_RECORD_MAGIC;
+    hdr.type = type;
+    hdr.user_len = (uint16_t)strlen(user);
+    hdr.name_len = (uint16_t)strlen(name);
+    hdr.data_len = len;
+    hdr.target = target;
+    hdr.mtime = mtime;
+
+    struct iovec iov[4] = {
+        { &hdr, sizeof(hdr) },
+        { (void*)user, hdr.user_len },
+        { (void*)name, hdr.name_len },
+        { (void*)data, len },
+    };
+    uint64_t size = record_size(hdr.user_len, hdr.name_len, len);
+    ssize_t n = writev(active_fd, iov, data ? 4 : 3);
+    if (n < 0 || (uint64_t)n != size) {
+        /* never leave a torn record in front of later appends */
+        if (ftruncate(active_fd, (off_t)active_size) < 0)
+            log_message("ERROR", "append_record: could not trim torn record");
+        log_message("ERROR", "append_record: write failed");
+        return -1;
+    }
+
+    if (seg_out) *seg_out = active_id;
+    if (off_out) *off_out = active_size;
+    active_size += size;
+
+    SegInfo *si = seg_info(active_id);
+    if (si) {
+        si->total += size;
+        si->live += size;
+    }
+    return 0;
+}
+
+int seg_store_file(const char *user, const char *name, const void *data, uint32_t len,
+                   int64_t mtime) {
+    uint32_t seg;
+    uint64_t off;
+
+    pthread_mutex_lock(&seg_lock);
+    FileMeta old;
+    int had = meta_lookup(user, name, &old) == 0;
+    if (append_record(SEG_REC_LIVE, user, name, data, len, mtime, 0, &seg, &off) < 0) {
+        pthread_mutex_unlock(&seg_lock);
+        return -1;
+    }
+    meta_put_segment(user, name, len, mtime, seg, off);
+    if (had && old.segment)
+        seg_mark_dead(old.segment, record_size(strlen(user), strlen(name), old.size));
+    pthread_mutex_unlock(&seg_lock);
+    return 0;
+}
+
+int seg_forget(const char *user, const char *name) {
+    int forgotten = 0;
+
+    pthread_mutex_lock(&seg_lock);
+    FileMeta old;
+    if (meta_lookup(user, name, &old) == 0 && old.segment &&
+        append_record(SEG_REC_TOMBSTONE, user, name, NULL, 0, (int64_t)time(NULL),
+                      old.segment, NULL, NULL) == 0) {
+        seg_mark_dead(old.segment, record_size(strlen(user), strlen(name), old.size));
+        meta_remove(user, name);
+        forgotten = 1;
+    }
+    pthread_mutex_unlock(&seg_lock);
+    return forgotten;
+}
+
+/* Read and validate the header (and optionally user/name) at off */
+static int read_record(int fd, uint64_t off, uint64_t file_size, SegRecordHeader *hdr,
+                       char *user, char *name) {
+    if (off + sizeof(*hdr) > file_size) return -1;
+    if (pread(fd, hdr, sizeof(*hdr), (off_t)off) != (ssize_t)sizeof(*hdr)) return -1;
+    if (hdr->magic != SEG_RECORD_MAGIC ||
+        (hdr->type != SEG_REC_LIVE && hdr->type != SEG_REC_TOMBSTONE) ||
+        hdr->user_len == 0 || hdr->user_len >= USERNAME_LEN ||
+        hdr->name_len == 0 || hdr->name_len >= FILE_NAME_LEN ||
+        hdr->data_len > SEGMENT_SMALL_FILE ||
+        off + record_size(hdr->user_len, hdr->name_len, hdr->data_len) > file_size)
+        return -1;
+
+    if (user && name) {
+        off_t p = (off_t)(off + sizeof(*hdr));
+        if (pread(fd, user, hdr->user_len, p) != hdr->user_len ||
+            pread(fd, name, hdr->name_len, p + hdr->user_len) != hdr->name_len)
+            return -1;
+        user[hdr->user_len] = '\0';
+        name[hdr->name_len] = '\0';
+    }
+    return 0;
+}
+
+int seg_open_record(uint32_t segment, uint64_t offset, uint64_t *data_off, uint32_t *len) {
+    char path[PATH_LEN];
+    seg_path(path, sizeof(path), segment);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    SegRecordHeader hdr;
+    if (fstat(fd, &st) < 0 ||
+        read_record(fd, offset, (uint64_t)st.st_size, &hdr, NULL, NULL) < 0 ||
+        hdr.type != SEG_REC_LIVE) {
+        close(fd);
+        return -1;
+    }
+    *data_off = offset + sizeof(hdr) + hdr.user_len + hdr.name_len;
+    *len = hdr.data_len;
+    return fd;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+/* Sorted ids of the segment files on disk (caller frees) */
+static uint32_t *list_segments(size_t *count) {
+    *count = 0;
+    DIR *d = opendir(SEGMENT_DIR);
+    if (!d) return NULL;
+
+    size_t cap = 16;
+    uint32_t *ids = malloc(cap * sizeof(uint32_t));
+    struct dirent *e;
+    while (ids && (e = readdir(d)) != NULL) {
+        unsigned id;
+        char tail;
+        if (sscanf(e->d_name, "seg-%8u.da%c", &id, &tail) != 2 || tail != 't' || id == 0)
+            continue;
+        if (*count == cap) {
+            cap *= 2;
+            uint32_t *n = realloc(ids, cap * sizeof(uint32_t));
+            if (!n) break;
+            ids = n;
+        }
+        ids[(*count)++] = id;
+    }
+    closedir(d);
+    if (ids) qsort(ids, *count, sizeof(uint32_t), cmp_u32);
+    return ids;
+}
+
+size_t seg_replay(void) {
+    size_t count = 0;
+    uint32_t *ids = list_segments(&count);
+    size_t records = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        char path[PATH_LEN];
+        seg_path(path, sizeof(path), ids[i]);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) continue;
+        struct stat st;
+        if (fstat(fd, &st) < 0) {
+            close(fd);
+            continue;
+        }
+
+        /* stop at the first bad header: a crash can leave a torn tail */
+        uint64_t off = 0;
+        SegRecordHeader hdr;
+        char user[USERNAME_LEN], name[FILE_NAME_LEN];
+        while (read_record(fd, off, (uint64_t)st.st_size, &hdr, user, name) == 0) {
+            if (hdr.type == SEG_REC_LIVE) {
+                meta_put_segment(user, name, hdr.data_len, hdr.mtime, ids[i], off);
+            } else {
+                FileMeta m;
+                if (meta_lookup(user, name, &m) == 0 && m.segment) meta_remove(user, name);
+            }
+            off += record_size(hdr.user_len, hdr.name_len, hdr.data_len);
+            records++;
+        }
+        close(fd);
+    }
+    free(ids);
+    return records;
+}
+
+typedef struct {
+    uint32_t id;
+    uint64_t live;
+} LiveCount;
+
+typedef struct {
+    LiveCount *items;
+    size_t count;
+    size_t cap;
+} LiveTally;
+
+static void tally_live(const FileMeta *m, void *arg) {
+    if (!m->segment) return;
+    LiveTally *t = (LiveTally*)arg;
+    uint64_t size = record_size(strlen(m->user), strlen(m->name), m->size);
+    for (size_t i = 0; i < t->count; i++) {
+        if (t->items[i].id == m->segment) {
+            t->items[i].live += size;
+            return;
+        }
+    }
+    if (t->count == t->cap) {
+        size_t nc = t->cap ? t->cap * 2 : 16;
+        LiveCount *n = realloc(t->items, nc * sizeof(LiveCount));
+        if (!n) return;
+        t->items = n;
+        t->cap = nc;
+    }
+    t->items[t->count].id = m->segment;
+    t->items[t->count].live = size;
+    t->count++;
+}
+
+/* Live byte counts are not persisted; derive them from the index once,
+ * in the background, instead of at startup. */
+static void compute_live_stats(void) {
+    LiveTally t = { NULL, 0, 0 };
+    meta_foreach(NULL, tally_live, &t);
+
+    pthread_mutex_lock(&seg_lock);
+    for (size_t i = 0; i < seg_count; i++) {
+        if (segs[i].id == active_id) continue;
+        segs[i].live = 0;
+        for (size_t j = 0; j < t.count; j++) {
+            if (t.items[j].id == segs[i].id) segs[i].live = t.items[j].live;
+        }
+    }
+    stats_ready = 1;
+    pthread_mutex_unlock(&seg_lock);
+    free(t.items);
+}
+
+static void compact_segment(uint32_t id) {
+    char path[PATH_LEN];
+    seg_path(path, sizeof(path), id);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    unsigned char *buf = malloc(SEGMENT_SMALL_FILE);
+    if (fstat(fd, &st) < 0 || !buf) {
+        free(buf);
+        close(fd);
+        return;
+    }
+
+    uint64_t off = 0, copied = 0;
+    SegRecordHeader hdr;
+    char user[USERNAME_LEN], name[FILE_NAME_LEN];
+    while (read_record(fd, off, (uint64_t)st.st_size, &hdr, user, name) == 0) {
+        uint64_t rsize = record_size(hdr.user_len, hdr.name_len, hdr.data_len);
+        uint64_t data_off = off + sizeof(hdr) + hdr.user_len + hdr.name_len;
+        FileMeta m;
+
+        if (hdr.type == SEG_REC_LIVE) {
+            if (pread(fd, buf, hdr.data_len, (off_t)data_off) != (ssize_t)hdr.data_len) break;
+
+            pthread_mutex_lock(&seg_lock);
+            if (meta_lookup(user, name, &m) == 0 && m.segment == id && m.offset == off) {
+                uint32_t nseg;
+                uint64_t noff;
+                if (append_record(SEG_REC_LIVE, user, name, buf, hdr.data_len, hdr.mtime, 0,
+                                  &nseg, &noff) == 0) {
+                    if (meta_relocate(user, name, id, off, nseg, noff) == 0)
+                        copied += rsize;
+                    else
+                        seg_mark_dead(nseg, rsize);
+                }
+            }
+            pthread_mutex_unlock(&seg_lock);
+        } else {
+            /* Still needed only while the cancelled record can be replayed
+             * and no newer segment record supersedes it anyway. */
+            pthread_mutex_lock(&seg_lock);
+            int superseded = meta_lookup(user, name, &m) == 0 && m.segment;
+            if (!superseded && hdr.target != id && seg_info(hdr.target)) {
+                append_record(SEG_REC_TOMBSTONE, user, name, NULL, 0, hdr.mtime, hdr.target,
+                              NULL, NULL);
+            }
+            pthread_mutex_unlock(&seg_lock);
+        }
+        off += rsize;
+    }
+    free(buf);
+    close(fd);
+
+    /* Readers that already opened the old segment keep their fd; new
+     * lookups see the relocated offsets. */
+    pthread_mutex_lock(&seg_lock);
+    seg_drop(id);
+    unlink(path);
+    pthread_mutex_unlock(&seg_lock);
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Compacted segment %u: %llu of %llu bytes still live",
+             id, (unsigned long long)copied, (unsigned long long)st.st_size);
+    log_message("INFO", msg);
+}
+
+static void *compactor_thread(void *arg) {
+    UNUSED(arg);
+
+    pthread_mutex_lock(&seg_lock);
+    while (compactor_running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += SEGMENT_COMPACT_INTERVAL;
+        pthread_cond_timedwait(&compactor_cond, &seg_lock, &deadline);
+        if (!compactor_running) break;
+        pthread_mutex_unlock(&seg_lock);
+
+        if (!stats_ready) compute_live_stats();
+
+        /* pick sealed segments that are mostly dead */
+        uint32_t victims[16];
+        size_t nvictims = 0;
+        pthread_mutex_lock(&seg_lock);
+        for (size_t i = 0; i < seg_count && nvictims < 16; i++) {
+            SegInfo *si = &segs[i];
+            if (si->id == active_id || si->total == 0) continue;
+            if ((si->total - si->live) * 100 >= si->total * SEGMENT_COMPACT_DEAD_PCT)
+                victims[nvictims++] = si->id;
+        }
+        pthread_mutex_unlock(&seg_lock);
+
+        for (size_t i = 0; i < nvictims && compactor_running; i++)
+            compact_segment(victims[i]);
+
+        pthread_mutex_lock(&seg_lock);
+    }
+    pthread_mutex_unlock(&seg_lock);
+    return NULL;
+}
+
+int seg_init(void) {
+    mkdir(SEGMENT_DIR, 0755);
+
+    size_t count = 0;
+    uint32_t *ids = list_segments(&count);
+    uint32_t max_id = 0;
+
+    pthread_mutex_lock(&seg_lock);
+    for (size_t i = 0; i < count; i++) {
+        char path[PATH_LEN];
+        struct stat st;
+        seg_path(path, sizeof(path), ids[i]);
+        if (stat(path, &st) == 0) seg_add(ids[i], (uint64_t)st.st_size);
+        if (ids[i] > max_id) max_id = ids[i];
+    }
+    free(ids);
+
+    /* Always append to a new segment: the previous active one may end in a
+     * torn record after a crash. */
+    int rc = open_active(max_id + 1);
+    stats_ready = 0;
+    pthread_mutex_unlock(&seg_lock);
+    if (rc < 0) {
+        log_message("ERROR", "seg_init: cannot open active segment");
+        return -1;
+    }
+
+    compactor_running = 1;
+    if (pthread_create(&compactor_tid, NULL, compactor_thread, NULL) != 0) {
+        compactor_running = 0;
+        log_message("WARN", "seg_init: compactor thread not started");
+    }
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Segment store ready: %zu sealed segments, active %u",
+             count, max_id + 1);
+    log_message("INFO", msg);
+    return 0;
+}
+
+void seg_shutdown(void) {
+    pthread_mutex_lock(&seg_lock);
+    int was_running = compactor_running;
+    compactor_running = 0;
+    pthread_cond_broadcast(&compactor_cond);
+    pthread_mutex_unlock(&seg_lock);
+    if (was_running) pthread_join(compactor_tid, NULL);
+
+    pthread_mutex_lock(&seg_lock);
+    if (active_fd >= 0) {
+        close(active_fd);
+        active_fd = -1;
+        if (active_size == 0) {
+            char path[PATH_LEN];
+            seg_path(path, sizeof(path), active_id);
+            unlink(path);
+        }
+    }
+    free(segs);
+    segs = NULL;
+    seg_count = seg_cap = 0;
+    pthread_mutex_unlock(&seg_lock);
+}
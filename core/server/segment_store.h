@@ -0,0 +1,41 @@
+#ifndef SEGMENT_STORE_H
+#define SEGMENT_STORE_H
+
+#include "../common/common.h"
+#include "metadata.h"
+
+/*
+ * Log-structured store for small files. Uploads up to SEGMENT_SMALL_FILE
+ * bytes are appended as records to large segment files instead of getting
+ * an inode each; the metadata index holds (segment, offset) for them.
+ * Overwrites and deletes append new records, and a background compactor
+ * rewrites mostly-dead segments.
+ */
+
+#define SEGMENT_DIR              "data/storage/.segments"
+#define SEGMENT_SMALL_FILE       (64 * 1024)
+#define SEGMENT_MAX_SIZE         (64 * 1024 * 1024)
+#define SEGMENT_COMPACT_INTERVAL 30     /* seconds between compaction passes */
+#define SEGMENT_COMPACT_DEAD_PCT 50     /* compact sealed segments at least this % dead */
+
+/* Open a fresh active segment and start the compactor (returns 0 on success) */
+int seg_init(void);
+void seg_shutdown(void);
+
+/* Store a small file and point the index at it */
+int seg_store_file(const char *user, const char *name, const void *data, uint32_t len,
+                   int64_t mtime);
+
+/* If user/name currently lives in a segment, log a tombstone for it and
+ * drop it from the index (returns 1 if it did). Call before replacing the
+ * file with an individually stored one, or to delete it. */
+int seg_forget(const char *user, const char *name);
+
+/* Open the segment holding a record (returns fd, -1 if it is gone).
+ * The file data starts at *data_off and is *len bytes long. */
+int seg_open_record(uint32_t segment, uint64_t offset, uint64_t *data_off, uint32_t *len);
+
+/* Replay all segments in order into the index (crash recovery) */
+size_t seg_replay(void);
+
+#endif /* SEGMENT_STORE_H */
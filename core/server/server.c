@@ -1,25 +1,78 @@
 #include "server.h"
 #include <signal.h>
 #include <errno.h>
+#include <poll.h>
+#include <sys/un.h>
 
 volatile int server_running = 1;
 static int listen_sock = -1;
+static int local_sock = -1;
+static char local_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
 
 static void sigint_handler(int sig) {
     UNUSED(sig);
-    log_message("INFO", "SIGINT received; shutting down server");
+    log_message("INFO", "Shutdown signal received; shutting down server");
     server_running = 0;
     if (listen_sock != -1) close(listen_sock);
 }
 
+/* Same-host listener (see LOCAL_SOCKET_FMT); the server runs without it if
+ * it cannot be created */
+static int open_local_listener(int port) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    int n = snprintf(addr.sun_path, sizeof(addr.sun_path), LOCAL_SOCKET_FMT, port);
+    if (n < 0 || (size_t)n >= sizeof(addr.sun_path)) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    unlink(addr.sun_path);   /* left behind by a server that did not shut down */
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, SERVER_BACKLOG) < 0) {
+        close(fd);
+        return -1;
+    }
+    memcpy(local_path, addr.sun_path, sizeof(local_path));
+    return fd;
+}
+
+static void start_client_thread(int client_sock, const struct sockaddr_in *client_addr, int local) {
+    ClientThreadArgs *args = malloc(sizeof(ClientThreadArgs));
+    if (!args) {
+        log_message("ERROR", "malloc failed for client args");
+        close(client_sock);
+        return;
+    }
+    args->client_sock = client_sock;
+    args->client_addr = *client_addr;
+    args->local = local;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, client_thread, args) != 0) {
+        log_message("ERROR", "pthread_create failed");
+        close(client_sock);
+        free(args);
+        return;
+    }
+    pthread_detach(tid);
+
+    char buf[128];
+    if (local)
+        snprintf(buf, sizeof(buf), "Accepted local connection");
+    else
+        snprintf(buf, sizeof(buf), "Accepted %s:%d",
+                 inet_ntoa(client_addr->sin_addr), ntohs(client_addr->sin_port));
+    log_message("INFO", buf);
+}
+
 int start_server(int port) {
     struct sockaddr_in addr, client_addr;
-    socklen_t client_len = sizeof(client_addr);
 
     init_logging();
     log_message("INFO", "Server initializing");
 
     signal(SIGINT, sigint_handler);
+    signal(SIGTERM, sigint_handler);
     server_running = 1;
 
     if ((listen_sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
@@ -47,45 +100,64 @@ int start_server(int port) {
         return -1;
     }
 
-    char buf[128];
+    if (session_start_reaper() < 0) {
+        close(listen_sock);
+        return -1;
+    }
+
+    char buf[PATH_LEN];
     snprintf(buf, sizeof(buf), "Server listening on port %d", port);
     log_message("INFO", buf);
     printf("[SERVER] %s\n", buf);
 
+    local_sock = open_local_listener(port);
+    if (local_sock >= 0) {
+        snprintf(buf, sizeof(buf), "Local clients can connect on %s", local_path);
+        log_message("INFO", buf);
+    } else {
+        log_message("WARN", "Local socket unavailable; same-host clients will use TCP");
+    }
+
+    /* The signal handler closes listen_sock, which ends the loop */
     while (server_running) {
-        int client_sock = accept(listen_sock, (struct sockaddr*)&client_addr, &client_len);
-        if (client_sock < 0) {
+        struct pollfd fds[2] = { { listen_sock, POLLIN, 0 }, { local_sock, POLLIN, 0 } };
+        int nfds = local_sock >= 0 ? 2 : 1;
+        if (poll(fds, (nfds_t)nfds, -1) < 0) {
             if (errno == EINTR) continue;
-            log_message("ERROR", "accept failed");
-            continue;
+            log_message("ERROR", "poll failed");
+            break;
         }
-        ClientThreadArgs *args = malloc(sizeof(ClientThreadArgs));
-        if (!args) {
-            log_message("ERROR", "malloc failed for client args");
-            close(client_sock);
-            continue;
+        if (fds[0].revents & POLLNVAL) break;
+
+        if (fds[0].revents & POLLIN) {
+            socklen_t client_len = sizeof(client_addr);
+            int client_sock = accept(listen_sock, (struct sockaddr*)&client_addr, &client_len);
+            if (client_sock >= 0)
+                start_client_thread(client_sock, &client_addr, 0);
+            else if (errno != EINTR)
+                log_message("ERROR", "accept failed");
         }
-        args->client_sock = client_sock;
-        args->client_addr = client_addr;
-
-        pthread_t tid;
-        if (pthread_create(&tid, NULL, client_thread, args) != 0) {
-            log_message("ERROR", "pthread_create failed");
-            close(client_sock);
-            free(args);
-            continue;
+        if (nfds > 1 && (fds[1].revents & POLLIN)) {
+            int client_sock = accept(local_sock, NULL, NULL);
+            if (client_sock >= 0) {
+                memset(&client_addr, 0, sizeof(client_addr));
+                start_client_thread(client_sock, &client_addr, 1);
+            } else if (errno != EINTR) {
+                log_message("ERROR", "accept failed on local socket");
+            }
         }
-        pthread_detach(tid);
-
-        snprintf(buf, sizeof(buf), "Accepted %s:%d",
-                 inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-        log_message("INFO", buf);
     }
 
     if (listen_sock != -1) {
         close(listen_sock);
         listen_sock = -1;
     }
+    if (local_sock != -1) {
+        close(local_sock);
+        unlink(local_path);
+        local_sock = -1;
+    }
+    session_stop_reaper();
     log_message("INFO", "Server stopped");
     return 0;
 }
@@ -0,0 +1,167 @@
+#include "session.h"
+#include <signal.h>
+#include <stddef.h>
+#include <sys/socket.h>
+
+static TimerWheel wheel;
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reaper_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t reaper_tid;
+static int reaper_running = 0;
+static uint64_t expired_total = 0;
+
+/* Lets the transfer loops in file_ops report progress without a parameter */
+static __thread Session *current_session = NULL;
+
+static uint64_t now_tick(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    uint64_t ms = (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+    return ms / SESSION_TICK_MS;
+}
+
+static uint64_t phase_timeout(SessionPhase phase) {
+    uint64_t sec;
+    switch (phase) {
+        case SESSION_AUTH:     sec = SESSION_AUTH_TIMEOUT; break;
+        case SESSION_TRANSFER: sec = SESSION_STALL_TIMEOUT; break;
+        default:               sec = SESSION_IDLE_TIMEOUT; break;
+    }
+    return sec * 1000 / SESSION_TICK_MS;
+}
+
+const char *session_phase_name(SessionPhase phase) {
+    switch (phase) {
+        case SESSION_AUTH: return "auth";
+        case SESSION_IDLE: return "idle";
+        case SESSION_TRANSFER: return "transfer";
+        default: return "unknown";
+    }
+}
+
+/* Runs in the reaper with session_lock held */
+static void session_expire(TimerNode *node, void *arg) {
+    Session *s = (Session*)((char*)node - offsetof(Session, timer));
+    uint64_t now = *(uint64_t*)arg;
+
+    /* Deadlines only move later lazily: re-arm instead of expiring */
+    if (s->deadline > now) {
+        tw_add(&wheel, node, s->deadline);
+        return;
+    }
+
+    s->expired = 1;
+    shutdown(s->sock, SHUT_RDWR);
+    expired_total++;
+
+    char msg[128];
+    snprintf(msg, sizeof(msg), "Session FD=%d expired in %s phase; closing connection",
+             s->sock, session_phase_name(s->phase));
+    log_message("WARN", msg);
+}
+
+static void *reaper_thread(void *arg) {
+    UNUSED(arg);
+
+    /* Leave SIGINT/SIGTERM to the accept loop, whose accept() they interrupt */
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+    pthread_mutex_lock(&session_lock);
+    while (reaper_running) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += SESSION_TICK_MS * 1000000L;
+        if (until.tv_nsec >= 1000000000L) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&reaper_wake, &session_lock, &until);
+
+        uint64_t now = now_tick();
+        tw_advance(&wheel, now, session_expire, &now);
+    }
+    pthread_mutex_unlock(&session_lock);
+    return NULL;
+}
+
+int session_start_reaper(void) {
+    pthread_mutex_lock(&session_lock);
+    if (reaper_running) {
+        pthread_mutex_unlock(&session_lock);
+        return 0;
+    }
+    tw_init(&wheel, now_tick());
+    reaper_running = 1;
+    if (pthread_create(&reaper_tid, NULL, reaper_thread, NULL) != 0) {
+        reaper_running = 0;
+        pthread_mutex_unlock(&session_lock);
+        log_message("ERROR", "session_start_reaper: cannot start reaper thread");
+        return -1;
+    }
+    pthread_mutex_unlock(&session_lock);
+    return 0;
+}
+
+void session_stop_reaper(void) {
+    pthread_mutex_lock(&session_lock);
+    if (!reaper_running) {
+        pthread_mutex_unlock(&session_lock);
+        return;
+    }
+    reaper_running = 0;
+    pthread_cond_signal(&reaper_wake);
+    pthread_mutex_unlock(&session_lock);
+    pthread_join(reaper_tid, NULL);
+
+    char msg[96];
+    snprintf(msg, sizeof(msg), "Session reaper stopped (%llu sessions expired)",
+             (unsigned long long)session_expired_count());
+    log_message("INFO", msg);
+}
+
+void session_register(Session *s, int sock) {
+    memset(s, 0, sizeof(*s));
+    s->sock = sock;
+    s->phase = SESSION_AUTH;
+    s->deadline = now_tick() + phase_timeout(SESSION_AUTH);
+    current_session = s;
+
+    pthread_mutex_lock(&session_lock);
+    if (reaper_running) tw_add(&wheel, &s->timer, s->deadline);
+    pthread_mutex_unlock(&session_lock);
+}
+
+void session_unregister(Session *s) {
+    pthread_mutex_lock(&session_lock);
+    tw_del(&s->timer);
+    pthread_mutex_unlock(&session_lock);
+    if (current_session == s) current_session = NULL;
+}
+
+void session_set_phase(Session *s, SessionPhase phase) {
+    uint64_t deadline = now_tick() + phase_timeout(phase);
+
+    pthread_mutex_lock(&session_lock);
+    s->phase = phase;
+    s->deadline = deadline;
+    /* A later deadline is picked up when the armed timer fires; an earlier
+     * one (e.g. idle -> transfer) must re-arm now */
+    if (tw_pending(&s->timer) && s->timer.expires > deadline)
+        tw_add(&wheel, &s->timer, deadline);
+    pthread_mutex_unlock(&session_lock);
+}
+
+void session_progress(void) {
+    Session *s = current_session;
+    if (!s || s->phase != SESSION_TRANSFER) return;
+    s->deadline = now_tick() + phase_timeout(SESSION_TRANSFER);
+}
+
+uint64_t session_expired_count(void) {
+    pthread_mutex_lock(&session_lock);
+    uint64_t n = expired_total;
+    pthread_mutex_unlock(&session_lock);
+    return n;
+}
@@ -0,0 +1,55 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "../common/common.h"
+#include "timer_wheel.h"
+
+/*
+ * Per-connection deadlines. Every client thread registers a Session; a
+ * reaper thread keeps them in a timer wheel and shuts down the socket of
+ * any session whose current phase has run past its deadline, which makes
+ * the blocked recv()/send() in that thread fail so it can clean up.
+ */
+
+#define SESSION_TICK_MS        100
+#define SESSION_AUTH_TIMEOUT   15     /* seconds from connect to successful auth */
+#define SESSION_IDLE_TIMEOUT   300    /* seconds between commands */
+#define SESSION_STALL_TIMEOUT  30     /* seconds without progress during a transfer */
+
+typedef enum {
+    SESSION_AUTH,
+    SESSION_IDLE,
+    SESSION_TRANSFER
+} SessionPhase;
+
+typedef struct {
+    int sock;
+    SessionPhase phase;
+    volatile uint64_t deadline;   /* tick; may move later without re-arming */
+    volatile int expired;
+    TimerNode timer;
+} Session;
+
+/* Start/stop the reaper thread (start returns 0 on success) */
+int session_start_reaper(void);
+void session_stop_reaper(void);
+
+/* Track a new connection (starts in SESSION_AUTH) and make it the calling
+ * thread's current session */
+void session_register(Session *s, int sock);
+
+/* Stop tracking; after this returns the reaper will not touch s->sock */
+void session_unregister(Session *s);
+
+/* Enter a phase, restarting its deadline */
+void session_set_phase(Session *s, SessionPhase phase);
+
+/* Report transfer progress on the calling thread's session (cheap; safe
+ * to call from any loop, does nothing on threads without a session) */
+void session_progress(void);
+
+uint64_t session_expired_count(void);
+
+const char *session_phase_name(SessionPhase phase);
+
+#endif /* SESSION_H */
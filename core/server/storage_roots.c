@@ -0,0 +1,267 @@
+#include "storage_roots.h"
+#include "../common/hashring.h"
+#include "file_ops.h"
+#include "metadata.h"
+#include <signal.h>
+
+typedef struct {
+    char user[USERNAME_LEN];
+    char name[FILE_NAME_LEN];
+} RootMove;
+
+/* One storage root and the files waiting to be moved onto it */
+typedef struct {
+    char path[ROOTS_PATH_LEN];
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    RootMove *queue;        /* ring of ROOTS_QUEUE_MAX */
+    size_t head, count;
+    uint64_t moved;
+} StorageRoot;
+
+static StorageRoot roots[ROOTS_MAX] = { { .path = STORAGE_BASE } };
+static uint32_t root_count = 1;
+static HashRing stripe_ring;    /* every root, node i = root i */
+static HashRing cold_ring;      /* roots 1.., node i = root i + 1 */
+static int cold_after = 0;      /* seconds; 0 = striping */
+
+static volatile int roots_running = 0;
+static pthread_mutex_t scan_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scan_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t scan_tid;
+static int scan_started = 0;
+
+int roots_add(const char *path) {
+    char msg[ROOTS_PATH_LEN + 64];
+    if (root_count == ROOTS_MAX || strlen(path) >= ROOTS_PATH_LEN) {
+        snprintf(msg, sizeof(msg), "roots_add: cannot add %.255s", path);
+        log_message("ERROR", msg);
+        return -1;
+    }
+
+    struct stat st;
+    if (stat(path, &st) < 0) mkdir(path, 0755);
+    if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        snprintf(msg, sizeof(msg), "roots_add: %s is not a directory", path);
+        log_message("ERROR", msg);
+        return -1;
+    }
+    for (uint32_t r = 0; r < root_count; r++) {
+        struct stat other;
+        if (stat(roots[r].path, &other) == 0 && other.st_dev == st.st_dev &&
+            other.st_ino == st.st_ino) {
+            snprintf(msg, sizeof(msg), "roots_add: %s is already a storage root", path);
+            log_message("ERROR", msg);
+            return -1;
+        }
+    }
+
+    /* Ring points depend only on the paths, so placement survives restarts */
+    if (root_count == 1 && hashring_add(&stripe_ring, roots[0].path) != 0) return -1;
+    if (hashring_add(&stripe_ring, path) != (int)root_count ||
+        hashring_add(&cold_ring, path) != (int)root_count - 1) {
+        log_message("ERROR", "roots_add: out of memory");
+        return -1;
+    }
+    snprintf(roots[root_count].path, ROOTS_PATH_LEN, "%s", path);
+    return (int)root_count++;
+}
+
+void roots_set_tiering(int cold_secs) {
+    cold_after = cold_secs > 0 ? cold_secs : 0;
+}
+
+uint32_t roots_count(void) {
+    return root_count;
+}
+
+const char *roots_path(uint32_t root) {
+    return root < root_count ? roots[root].path : NULL;
+}
+
+uint32_t roots_place(const char *user, const char *filename) {
+    if (root_count == 1 || cold_after) return 0;
+    int r = hashring_lookup(&stripe_ring, user, filename);
+    return r < 0 ? 0 : (uint32_t)r;
+}
+
+static uint32_t cold_place(const char *user, const char *filename) {
+    int r = hashring_lookup(&cold_ring, user, filename);
+    return r < 0 ? 0 : (uint32_t)r + 1;
+}
+
+/* Where a file belongs now: its stripe, or for tiering the hot root until
+ * it has been idle long enough, then its cold stripe */
+static uint32_t wanted_root(const FileMeta *m, int64_t now) {
+    if (!cold_after) return roots_place(m->user, m->name);
+    if (m->root == 0 && m->atime + cold_after > now) return 0;
+    return cold_place(m->user, m->name);
+}
+
+/* Queue user/filename to be moved onto root (returns 0 if queued, -1 if
+ * already queued, full, or not running) */
+static int queue_move(uint32_t root, const char *user, const char *filename) {
+    if (!roots_running || root >= root_count) return -1;
+    StorageRoot *r = &roots[root];
+    int rc = -1;
+
+    pthread_mutex_lock(&r->lock);
+    int queued = r->queue == NULL;
+    for (size_t i = 0; i < r->count && !queued; i++) {
+        const RootMove *mv = &r->queue[(r->head + i) % ROOTS_QUEUE_MAX];
+        queued = strcmp(mv->name, filename) == 0 && strcmp(mv->user, user) == 0;
+    }
+    if (!queued && r->count < ROOTS_QUEUE_MAX) {
+        RootMove *mv = &r->queue[(r->head + r->count) % ROOTS_QUEUE_MAX];
+        snprintf(mv->user, sizeof(mv->user), "%s", user);
+        snprintf(mv->name, sizeof(mv->name), "%s", filename);
+        r->count++;
+        pthread_cond_signal(&r->wake);
+        rc = 0;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return rc;
+}
+
+void roots_note_access(const char *user, const char *filename) {
+    if (!cold_after || !roots_running) return;
+    FileMeta m;
+    if (meta_lookup(user, filename, &m) == 0 && m.segment == 0 && m.root != 0)
+        queue_move(0, user, filename);
+}
+
+static void *move_thread(void *arg) {
+    StorageRoot *r = (StorageRoot*)arg;
+    uint32_t root = (uint32_t)(r - roots);
+
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+    pthread_mutex_lock(&r->lock);
+    while (roots_running) {
+        if (r->count == 0) {
+            pthread_cond_wait(&r->wake, &r->lock);
+            continue;
+        }
+        RootMove mv = r->queue[r->head];
+        r->head = (r->head + 1) % ROOTS_QUEUE_MAX;
+        r->count--;
+        pthread_mutex_unlock(&r->lock);
+
+        int rc = storage_move(mv.user, mv.name, root);
+
+        pthread_mutex_lock(&r->lock);
+        if (rc == 0) r->moved++;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+typedef struct {
+    int64_t now;
+    size_t queued;
+} ScanState;
+
+static void scan_visit(const FileMeta *m, void *arg) {
+    ScanState *s = (ScanState*)arg;
+    if (m->segment || s->queued >= ROOTS_SCAN_BATCH || !roots_running) return;
+    uint32_t want = wanted_root(m, s->now);
+    if (want != m->root && queue_move(want, m->user, m->name) == 0) s->queued++;
+}
+
+static void *scan_thread(void *arg) {
+    UNUSED(arg);
+
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+    int interval = ROOTS_SCAN_INTERVAL;
+    if (cold_after && cold_after / 2 < interval) interval = cold_after > 1 ? cold_after / 2 : 1;
+
+    pthread_mutex_lock(&scan_lock);
+    while (roots_running) {
+        pthread_mutex_unlock(&scan_lock);
+        ScanState s = { (int64_t)time(NULL), 0 };
+        meta_foreach(NULL, scan_visit, &s);
+        if (s.queued > 0) {
+            char msg[96];
+            snprintf(msg, sizeof(msg), "Storage roots: %zu files queued to move", s.queued);
+            log_message("INFO", msg);
+        }
+        pthread_mutex_lock(&scan_lock);
+
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += interval;
+        if (roots_running) pthread_cond_timedwait(&scan_wake, &scan_lock, &until);
+    }
+    pthread_mutex_unlock(&scan_lock);
+    return NULL;
+}
+
+int roots_start(void) {
+    if (root_count == 1) {
+        if (cold_after) log_message("WARN", "Tiering needs at least one --root besides data/storage");
+        return 0;
+    }
+
+    roots_running = 1;
+    for (uint32_t i = 0; i < root_count; i++) {
+        StorageRoot *r = &roots[i];
+        pthread_mutex_init(&r->lock, NULL);
+        pthread_cond_init(&r->wake, NULL);
+        r->head = r->count = 0;
+        r->moved = 0;
+        r->queue = malloc(ROOTS_QUEUE_MAX * sizeof(RootMove));
+        if (!r->queue || pthread_create(&r->tid, NULL, move_thread, r) != 0) {
+            /* files stay where they are; nothing is moved onto this root */
+            free(r->queue);
+            r->queue = NULL;
+            log_message("ERROR", "roots_start: cannot start a storage root worker");
+        }
+    }
+    scan_started = pthread_create(&scan_tid, NULL, scan_thread, NULL) == 0;
+    if (!scan_started) log_message("ERROR", "roots_start: cannot start the storage root scanner");
+
+    char msg[128];
+    if (cold_after)
+        snprintf(msg, sizeof(msg), "Storage roots: %u, tiering (cold after %d s)",
+                 root_count, cold_after);
+    else
+        snprintf(msg, sizeof(msg), "Storage roots: %u, striping", root_count);
+    log_message("INFO", msg);
+    return (int)root_count;
+}
+
+void roots_shutdown(void) {
+    if (!roots_running) return;
+
+    pthread_mutex_lock(&scan_lock);
+    roots_running = 0;
+    pthread_cond_signal(&scan_wake);
+    pthread_mutex_unlock(&scan_lock);
+    if (scan_started) pthread_join(scan_tid, NULL);
+    scan_started = 0;
+
+    for (uint32_t i = 0; i < root_count; i++) {
+        StorageRoot *r = &roots[i];
+        if (!r->queue) continue;
+        pthread_mutex_lock(&r->lock);
+        pthread_cond_signal(&r->wake);
+        pthread_mutex_unlock(&r->lock);
+        pthread_join(r->tid, NULL);
+
+        char msg[ROOTS_PATH_LEN + 96];
+        snprintf(msg, sizeof(msg), "Storage root %u (%s): %llu files moved in, %zu moves dropped",
+                 i, r->path, (unsigned long long)r->moved, r->count);
+        log_message("INFO", msg);
+
+        pthread_mutex_lock(&r->lock);
+        free(r->queue);
+        r->queue = NULL;
+        pthread_mutex_unlock(&r->lock);
+    }
+}
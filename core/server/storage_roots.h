@@ -0,0 +1,60 @@
+#ifndef STORAGE_ROOTS_H
+#define STORAGE_ROOTS_H
+
+#include "../common/common.h"
+
+/*
+ * Storage roots. Files stored on their own (larger than SEGMENT_SMALL_FILE)
+ * can be spread over several directories, typically one per disk: root 0
+ * is always data/storage, which also keeps the segment log, and --root DIR
+ * adds more. The index records the root of every file, so reads go
+ * straight to the right disk.
+ *
+ * Placement:
+ *   striping (default)   a file goes to the root owning its user/name on a
+ *                        consistent-hash ring of the roots, so concurrent
+ *                        transfers of different files use different disks
+ *                        and adding a root only claims its share of files
+ *   tiering (--tier-cold SECS)
+ *                        root 0 is the hot tier (put it on the fast disk):
+ *                        uploads land there, files not uploaded or
+ *                        downloaded for SECS are demoted to the other roots
+ *                        (striped as above), and a download of a demoted
+ *                        file promotes it back
+ *
+ * Files are moved in the background. Every root has a worker thread with
+ * its own queue of files to move onto it, so a slow or busy disk only
+ * delays moves onto itself. A scanner queues demotions, and files left on
+ * the wrong root after the root list changed, every ROOTS_SCAN_INTERVAL
+ * seconds (more often for short cold ages). Transfers never wait for a
+ * move; a move that races with an upload or delete of the file gives way.
+ */
+
+#define ROOTS_MAX            8
+#define ROOTS_PATH_LEN       256
+#define ROOTS_QUEUE_MAX      1024   /* pending moves per root */
+#define ROOTS_SCAN_INTERVAL  60     /* seconds between scans */
+#define ROOTS_SCAN_BATCH     4096   /* moves queued per scan */
+
+/* Add a storage root before storage_init; the directory is created if
+ * missing (returns its index, -1 if unusable or too many roots) */
+int roots_add(const char *path);
+
+/* Demote files idle for cold_secs from root 0 (call before roots_start) */
+void roots_set_tiering(int cold_secs);
+
+/* Start/stop the move workers and the scanner (after storage_init, before
+ * storage_shutdown); nothing runs with a single root */
+int roots_start(void);
+void roots_shutdown(void);
+
+uint32_t roots_count(void);
+const char *roots_path(uint32_t root);
+
+/* Root a new copy of user/filename is written to */
+uint32_t roots_place(const char *user, const char *filename);
+
+/* A file was downloaded: queue its promotion if it sits on a cold root */
+void roots_note_access(const char *user, const char *filename);
+
+#endif /* STORAGE_ROOTS_H */
@@ -0,0 +1,85 @@
+#include "timer_wheel.h"
+#include <string.h>
+
+void tw_init(TimerWheel *tw, uint64_t now) {
+    memset(tw, 0, sizeof(*tw));
+    tw->now = now;
+}
+
+static void slot_push(TimerNode **slot, TimerNode *node) {
+    node->next = *slot;
+    if (*slot) (*slot)->pprev = &node->next;
+    node->pprev = slot;
+    *slot = node;
+}
+
+void tw_del(TimerNode *node) {
+    if (!node->pprev) return;
+    *node->pprev = node->next;
+    if (node->next) node->next->pprev = node->pprev;
+    node->next = NULL;
+    node->pprev = NULL;
+}
+
+/* Pick the level whose span covers the distance to expiry */
+static void place(TimerWheel *tw, TimerNode *node) {
+    uint64_t expires = node->expires;
+    if (expires <= tw->now) expires = tw->now + 1;
+    uint64_t delta = expires - tw->now;
+
+    int level = 0;
+    while (level < TW_LEVELS - 1 && delta >= (1ULL << (TW_BITS * (level + 1))))
+        level++;
+    if (level == TW_LEVELS - 1) {
+        /* Beyond the wheel's range: park at the farthest reachable slot and
+         * let the cascade re-place it when that slot comes round */
+        uint64_t max = (1ULL << (TW_BITS * TW_LEVELS)) - 1;
+        if (delta > max) expires = tw->now + max;
+    }
+
+    size_t idx = (size_t)((expires >> (TW_BITS * level)) & TW_MASK);
+    slot_push(&tw->slots[level][idx], node);
+}
+
+void tw_add(TimerWheel *tw, TimerNode *node, uint64_t expires) {
+    tw_del(node);
+    node->expires = expires;
+    place(tw, node);
+}
+
+/* Move every timer of one upper-level slot down to where it now belongs */
+static void cascade(TimerWheel *tw, int level, size_t idx) {
+    TimerNode *list = tw->slots[level][idx];
+    tw->slots[level][idx] = NULL;
+    while (list) {
+        TimerNode *next = list->next;
+        list->next = NULL;
+        list->pprev = NULL;
+        place(tw, list);
+        list = next;
+    }
+}
+
+void tw_advance(TimerWheel *tw, uint64_t now, tw_expire_fn fn, void *arg) {
+    while (tw->now < now) {
+        tw->now++;
+
+        /* Entering a new lap of level l-1: pull the matching level-l slot down */
+        for (int level = 1; level < TW_LEVELS; level++) {
+            if ((tw->now & ((1ULL << (TW_BITS * level)) - 1)) != 0) break;
+            cascade(tw, level, (size_t)((tw->now >> (TW_BITS * level)) & TW_MASK));
+        }
+
+        TimerNode **slot = &tw->slots[0][tw->now & TW_MASK];
+        while (*slot) {
+            TimerNode *node = *slot;
+            tw_del(node);
+            if (node->expires > tw->now) {
+                /* Parked beyond the wheel's range; not due yet */
+                place(tw, node);
+                continue;
+            }
+            fn(node, arg);
+        }
+    }
+}
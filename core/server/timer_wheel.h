@@ -0,0 +1,45 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include "../common/common.h"
+
+/*
+ * Hierarchical timer wheel. Level l has TW_SLOTS buckets of TW_SLOTS^l
+ * ticks each; adding, deleting and expiring a timer are O(1), and timers
+ * in the upper levels are cascaded down once per TW_SLOTS^l ticks.
+ * Not thread-safe: the owner serializes access.
+ */
+
+#define TW_BITS   6
+#define TW_SLOTS  (1 << TW_BITS)
+#define TW_MASK   (TW_SLOTS - 1)
+#define TW_LEVELS 4
+
+typedef struct TimerNode {
+    struct TimerNode *next;
+    struct TimerNode **pprev;   /* NULL when not queued */
+    uint64_t expires;           /* absolute tick */
+} TimerNode;
+
+typedef struct {
+    TimerNode *slots[TW_LEVELS][TW_SLOTS];
+    uint64_t now;               /* last processed tick */
+} TimerWheel;
+
+typedef void (*tw_expire_fn)(TimerNode *node, void *arg);
+
+void tw_init(TimerWheel *tw, uint64_t now);
+
+/* Queue node to fire at tick `expires` (re-queues it if already pending) */
+void tw_add(TimerWheel *tw, TimerNode *node, uint64_t expires);
+
+/* Unqueue node if pending */
+void tw_del(TimerNode *node);
+
+static inline int tw_pending(const TimerNode *node) { return node->pprev != NULL; }
+
+/* Process every tick up to `now`, calling fn for each expired timer.
+ * The node is already unqueued when fn runs, so fn may re-add it. */
+void tw_advance(TimerWheel *tw, uint64_t now, tw_expire_fn fn, void *arg);
+
+#endif /* TIMER_WHEEL_H */
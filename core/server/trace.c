@@ -0,0 +1,234 @@
+#include "trace.h"
+#include <signal.h>
+#include <sys/syscall.h>
+
+typedef struct TraceRing {
+    struct TraceRing *next;
+    uint32_t tid;
+    int in_use;                  /* owned by a live thread */
+    uint64_t head;               /* events ever written */
+    TraceEvent events[TRACE_RING_EVENTS];
+} TraceRing;
+
+static const char *trace_span_names[TRACE_SPAN_COUNT] = {
+    "recv_packet",
+    "AUTH",
+    "UPLOAD",
+    "DOWNLOAD",
+    "DELTA",
+    "DELETE",
+    "command",
+    "auth_check",
+    "file_open",
+    "disk_read",
+    "disk_write",
+    "net_recv",
+    "net_send",
+    "segment_append",
+    "delta_signatures",
+    "delta_apply",
+};
+
+volatile int trace_enabled = 0;
+
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static TraceRing *all_rings = NULL;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+static uint64_t next_trace_id = 0;
+static unsigned dump_seq = 0;
+
+static __thread TraceRing *my_ring = NULL;
+static __thread uint64_t my_trace_id = 0;
+
+/* SIGUSR1 only writes to this pipe; the toggle thread does the work */
+static int toggle_pipe[2] = { -1, -1 };
+static pthread_t toggle_tid;
+static int toggle_running = 0;
+
+uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Thread exit: hand the ring back for reuse. The next owner appends after
+ * its events, so they stay dumpable until the ring wraps. */
+static void ring_release(void *arg) {
+    TraceRing *ring = (TraceRing*)arg;
+    pthread_mutex_lock(&ring_lock);
+    ring->in_use = 0;
+    pthread_mutex_unlock(&ring_lock);
+}
+
+static void make_ring_key(void) {
+    pthread_key_create(&ring_key, ring_release);
+}
+
+static TraceRing *get_ring(void) {
+    if (my_ring) return my_ring;
+    pthread_once(&ring_key_once, make_ring_key);
+
+    pthread_mutex_lock(&ring_lock);
+    TraceRing *ring = all_rings;
+    while (ring && ring->in_use) ring = ring->next;
+    if (!ring) {
+        ring = calloc(1, sizeof(TraceRing));
+        if (!ring) {
+            pthread_mutex_unlock(&ring_lock);
+            return NULL;
+        }
+        ring->next = all_rings;
+        all_rings = ring;
+    }
+    ring->in_use = 1;
+    ring->tid = (uint32_t)syscall(SYS_gettid);
+    pthread_mutex_unlock(&ring_lock);
+
+    pthread_setspecific(ring_key, ring);
+    my_ring = ring;
+    return ring;
+}
+
+void trace_new_request(void) {
+    my_trace_id = trace_enabled ? __atomic_add_fetch(&next_trace_id, 1, __ATOMIC_RELAXED) : 0;
+}
+
+void trace_record(TraceSpan span, uint64_t start_ns, uint64_t arg) {
+    TraceRing *ring = get_ring();
+    if (!ring) return;
+
+    uint64_t head = ring->head;
+    TraceEvent *ev = &ring->events[head % TRACE_RING_EVENTS];
+    ev->start_ns = start_ns;
+    ev->dur_ns = trace_now() - start_ns;
+    ev->trace_id = my_trace_id;
+    ev->arg = arg;
+    ev->span = (uint32_t)span;
+    ev->tid = ring->tid;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+int trace_dump(void) {
+    char path[PATH_LEN];
+    snprintf(path, sizeof(path), "%s/trace-%d-%u.bin", LOG_DIR, (int)getpid(), dump_seq++);
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        log_message("ERROR", "trace_dump: cannot create dump file");
+        return -1;
+    }
+
+    pthread_mutex_lock(&ring_lock);
+    TraceFileHeader fh;
+    memset(&fh, 0, sizeof(fh));
+    memcpy(fh.magic, TRACE_MAGIC, sizeof(fh.magic));
+    fh.span_count = TRACE_SPAN_COUNT;
+    fwrite(&fh, sizeof(fh), 1, fp);     /* thread_count filled in at the end */
+
+    for (int i = 0; i < TRACE_SPAN_COUNT; i++) {
+        char name[TRACE_NAME_LEN] = {0};
+        strncpy(name, trace_span_names[i], TRACE_NAME_LEN - 1);
+        fwrite(name, TRACE_NAME_LEN, 1, fp);
+    }
+
+    uint64_t total = 0;
+    for (TraceRing *r = all_rings; r; r = r->next) {
+        uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (head == 0) continue;
+        uint64_t count = head < TRACE_RING_EVENTS ? head : TRACE_RING_EVENTS;
+
+        /* One thread header per run of events from the same thread */
+        uint64_t k = head - count;
+        while (k < head) {
+            uint32_t tid = r->events[k % TRACE_RING_EVENTS].tid;
+            uint64_t end = k + 1;
+            while (end < head && r->events[end % TRACE_RING_EVENTS].tid == tid) end++;
+            TraceThreadHeader th = { tid, (uint32_t)(end - k) };
+            fwrite(&th, sizeof(th), 1, fp);
+            for (; k < end; k++)
+                fwrite(&r->events[k % TRACE_RING_EVENTS], sizeof(TraceEvent), 1, fp);
+            fh.thread_count++;
+        }
+        total += count;
+    }
+    pthread_mutex_unlock(&ring_lock);
+
+    if (fseek(fp, 0, SEEK_SET) == 0) fwrite(&fh, sizeof(fh), 1, fp);
+
+    int rc = fclose(fp) == 0 ? 0 : -1;
+    char msg[PATH_LEN + 64];
+    snprintf(msg, sizeof(msg), "Trace dump written: %s (%llu events)", path,
+             (unsigned long long)total);
+    log_message(rc == 0 ? "INFO" : "ERROR", msg);
+    return rc;
+}
+
+static void sigusr1_handler(int sig) {
+    UNUSED(sig);
+    char c = 't';
+    ssize_t n = write(toggle_pipe[1], &c, 1);
+    UNUSED(n);
+}
+
+static void *toggle_thread(void *arg) {
+    UNUSED(arg);
+
+    /* Signals belong to the accept loop (SIGINT/SIGTERM) or just write to the pipe */
+    sigset_t all;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, NULL);
+
+    for (;;) {
+        char c;
+        ssize_t n = read(toggle_pipe[0], &c, 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n != 1 || c == 'q') break;
+        trace_enabled = !trace_enabled;
+        log_message("INFO", trace_enabled ? "Tracing enabled" : "Tracing disabled");
+        if (!trace_enabled) trace_dump();
+    }
+    return NULL;
+}
+
+void trace_init(void) {
+    const char *env = getenv(TRACE_ENV);
+    if (env && strcmp(env, "1") == 0) {
+        trace_enabled = 1;
+        log_message("INFO", "Tracing enabled from " TRACE_ENV);
+    }
+
+    if (toggle_running || pipe(toggle_pipe) < 0) return;
+    if (pthread_create(&toggle_tid, NULL, toggle_thread, NULL) != 0) {
+        close(toggle_pipe[0]);
+        close(toggle_pipe[1]);
+        toggle_pipe[0] = toggle_pipe[1] = -1;
+        return;
+    }
+    toggle_running = 1;
+
+    /* SA_RESTART keeps the signal from failing recv()/send() in client threads */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigusr1_handler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+}
+
+void trace_shutdown(void) {
+    if (toggle_running) {
+        signal(SIGUSR1, SIG_IGN);
+        char c = 'q';
+        ssize_t n = write(toggle_pipe[1], &c, 1);
+        UNUSED(n);
+        pthread_join(toggle_tid, NULL);
+        close(toggle_pipe[0]);
+        close(toggle_pipe[1]);
+        toggle_pipe[0] = toggle_pipe[1] = -1;
+        toggle_running = 0;
+    }
+    if (trace_enabled) {
+        trace_enabled = 0;
+        trace_dump();
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "../common/common.h"
+
+/*
+ * Request tracing. Each thread records completed spans (name, start,
+ * duration, trace id, one numeric argument) into its own fixed-size ring,
+ * so recording takes no locks and never allocates after the first span.
+ * When tracing is off a span costs one predictable branch.
+ *
+ * Tracing starts enabled if LOCALBIN_TRACE=1 is set, and SIGUSR1 toggles
+ * it at runtime. Switching it off (or shutting down while it is on) dumps
+ * all rings to data/logs/trace-<pid>-<n>.bin; bin/trace2json converts a
+ * dump to Chrome trace / Perfetto JSON.
+ */
+
+#define TRACE_ENV          "LOCALBIN_TRACE"
+#define TRACE_RING_EVENTS  8192          /* per thread, oldest overwritten */
+#define TRACE_MAGIC        "LBTRACE1"
+#define TRACE_NAME_LEN     24
+
+/* Span names; keep trace_span_names[] in trace.c in the same order */
+typedef enum {
+    TRACE_RECV_PACKET,
+    TRACE_CMD_AUTH,
+    TRACE_CMD_UPLOAD,
+    TRACE_CMD_DOWNLOAD,
+    TRACE_CMD_DELTA,
+    TRACE_CMD_DELETE,
+    TRACE_CMD_OTHER,
+    TRACE_AUTH_CHECK,
+    TRACE_FILE_OPEN,
+    TRACE_DISK_READ,
+    TRACE_DISK_WRITE,
+    TRACE_NET_RECV,
+    TRACE_NET_SEND,
+    TRACE_SEG_APPEND,
+    TRACE_DELTA_SIGS,
+    TRACE_DELTA_APPLY,
+    TRACE_SPAN_COUNT
+} TraceSpan;
+
+/* On-disk event record (host byte order) */
+typedef struct {
+    uint64_t start_ns;
+    uint64_t dur_ns;
+    uint64_t trace_id;
+    uint64_t arg;
+    uint32_t span;
+    uint32_t tid;               /* thread that recorded it; rings outlive threads */
+} TraceEvent;
+
+/* Dump layout: TraceFileHeader, span_count names of TRACE_NAME_LEN bytes,
+ * then per thread a TraceThreadHeader followed by its events, oldest first
+ * (a thread can appear more than once) */
+typedef struct {
+    char magic[8];
+    uint32_t span_count;
+    uint32_t thread_count;
+} TraceFileHeader;
+
+typedef struct {
+    uint32_t tid;
+    uint32_t event_count;
+} TraceThreadHeader;
+
+extern volatile int trace_enabled;
+
+/* Read LOCALBIN_TRACE and install the SIGUSR1 toggle */
+void trace_init(void);
+
+/* Dump if tracing is on and stop the toggle thread */
+void trace_shutdown(void);
+
+uint64_t trace_now(void);
+
+/* Start a new trace id for the calling thread (0 when tracing is off) */
+void trace_new_request(void);
+
+void trace_record(TraceSpan span, uint64_t start_ns, uint64_t arg);
+
+/* Write every thread's ring to a new dump file (returns 0 on success) */
+int trace_dump(void);
+
+/* Span helpers: TRACE_BEGIN(t); ...; TRACE_END(t, TRACE_DISK_READ, bytes); */
+#define TRACE_BEGIN(var) uint64_t var = trace_enabled ? trace_now() : 0
+#define TRACE_END(var, span, arg) do { if (var) trace_record((span), (var), (uint64_t)(arg)); } while (0)
+
+#endif /* TRACE_H */
@@ -0,0 +1,86 @@
+#include "trace.h"
+
+/* Convert a trace dump (data/logs/trace-*.bin) to Chrome trace JSON, which
+ * chrome://tracing and ui.perfetto.dev both open.
+ *
+ *   trace2json dump.bin [out.json]      (stdout if out.json is omitted) */
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <trace.bin> [out.json]\n", argv[0]);
+        return 2;
+    }
+
+    FILE *in = fopen(argv[1], "rb");
+    if (!in) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    TraceFileHeader fh;
+    if (fread(&fh, sizeof(fh), 1, in) != 1 || memcmp(fh.magic, TRACE_MAGIC, sizeof(fh.magic)) != 0) {
+        fprintf(stderr, "%s: not a LocalBin trace dump\n", argv[1]);
+        fclose(in);
+        return 1;
+    }
+
+    char (*names)[TRACE_NAME_LEN] = calloc(fh.span_count ? fh.span_count : 1, TRACE_NAME_LEN);
+    if (!names || fread(names, TRACE_NAME_LEN, fh.span_count, in) != fh.span_count) {
+        fprintf(stderr, "%s: truncated span table\n", argv[1]);
+        free(names);
+        fclose(in);
+        return 1;
+    }
+    for (uint32_t i = 0; i < fh.span_count; i++) names[i][TRACE_NAME_LEN - 1] = '\0';
+
+    FILE *out = stdout;
+    if (argc == 3 && !(out = fopen(argv[2], "w"))) {
+        perror(argv[2]);
+        free(names);
+        fclose(in);
+        return 1;
+    }
+
+    /* Timestamps are relative to the earliest event so they stay readable */
+    long events_at = ftell(in);
+    uint64_t base = UINT64_MAX;
+    for (uint32_t t = 0; t < fh.thread_count; t++) {
+        TraceThreadHeader th;
+        if (fread(&th, sizeof(th), 1, in) != 1) break;
+        for (uint32_t k = 0; k < th.event_count; k++) {
+            TraceEvent ev;
+            if (fread(&ev, sizeof(ev), 1, in) != 1) break;
+            if (ev.start_ns < base) base = ev.start_ns;
+        }
+    }
+    fseek(in, events_at, SEEK_SET);
+
+    fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    uint64_t written = 0;
+    for (uint32_t t = 0; t < fh.thread_count; t++) {
+        TraceThreadHeader th;
+        if (fread(&th, sizeof(th), 1, in) != 1) break;
+        fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, "
+                     "\"args\": {\"name\": \"client %u\"}}",
+                written++ ? ",\n" : "", th.tid, th.tid);
+        for (uint32_t k = 0; k < th.event_count; k++) {
+            TraceEvent ev;
+            if (fread(&ev, sizeof(ev), 1, in) != 1) break;
+            const char *name = ev.span < fh.span_count ? names[ev.span] : "unknown";
+            fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, "
+                         "\"ts\": %.3f, \"dur\": %.3f, "
+                         "\"args\": {\"trace_id\": %llu, \"arg\": %llu}}",
+                    name, th.tid, (double)(ev.start_ns - base) / 1000.0,
+                    (double)ev.dur_ns / 1000.0, (unsigned long long)ev.trace_id,
+                    (unsigned long long)ev.arg);
+            written++;
+        }
+    }
+    fprintf(out, "\n]}\n");
+
+    if (out != stdout) fclose(out);
+    fclose(in);
+    free(names);
+    fprintf(stderr, "trace2json: %llu events from %u threads\n",
+            (unsigned long long)(written - fh.thread_count), fh.thread_count);
+    return 0;
+}
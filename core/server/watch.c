@@ -0,0 +1,343 @@
+#include "watch.h"
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "../common/md5.h"
+#include "../common/protocol.h"
+
+#define WATCH_PREFIX_LEN  FILE_NAME_LEN
+
+typedef struct {
+    char user[USERNAME_LEN];
+    char name[FILE_NAME_LEN];
+    uint64_t size;
+    char md5[MD5_HEX_LEN];
+    char kind;
+} WatchEvent;
+
+typedef struct Subscriber {
+    struct Subscriber *next;
+    int sock;
+    char user[USERNAME_LEN];
+    char prefix[WATCH_PREFIX_LEN];
+    char *out;              /* packed packets not yet sent (NULL when idle) */
+    size_t out_len;
+    size_t out_cap;
+    int polling_out;        /* EPOLLOUT armed */
+    int lost;               /* events dropped since the last R line went out */
+    int resync_queued;      /* an R line is in out */
+} Subscriber;
+
+/* Everything below is under watch_lock; the hub only leaves it to wait */
+static pthread_mutex_t watch_lock = PTHREAD_MUTEX_INITIALIZER;
+static Subscriber *subscribers = NULL;
+static volatile int subscriber_count = 0;
+static WatchEvent pending[WATCH_MAX_PENDING];
+static size_t pending_count = 0;
+static uint64_t batch_due_ms = 0;       /* 0 = nothing pending */
+
+static int epoll_fd = -1;
+static int wake_fd = -1;
+static pthread_t hub_tid;
+static int hub_running = 0;
+static volatile int hub_stop = 0;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void wake_hub(void) {
+    uint64_t one = 1;
+    ssize_t n = write(wake_fd, &one, sizeof(one));
+    UNUSED(n);
+}
+
+static void sub_poll_out(Subscriber *s, int on) {
+    if (s->polling_out == on) return;
+    struct epoll_event ev = { .events = EPOLLIN | (on ? EPOLLOUT : 0), .data.ptr = s };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, s->sock, &ev) == 0) s->polling_out = on;
+}
+
+static void sub_drop(Subscriber *s) {
+    for (Subscriber **p = &subscribers; *p; p = &(*p)->next) {
+        if (*p == s) {
+            *p = s->next;
+            break;
+        }
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, s->sock, NULL);
+    close(s->sock);
+    free(s->out);
+    free(s);
+    subscriber_count--;
+}
+
+/* Append one packet to the subscriber's backlog; force ignores the cap
+ * (the R line). Returns -1 if it did not fit. */
+static int sub_queue(Subscriber *s, const Packet *pkt, int force) {
+    char wire[PACKET_WIRE_MAX];
+    size_t n = pack_packet(wire, pkt);
+    if (!force && s->out_len + n > WATCH_MAX_BACKLOG) return -1;
+    if (s->out_len + n > s->out_cap) {
+        size_t cap = s->out_cap ? s->out_cap : PACKET_WIRE_MAX;
+        while (cap < s->out_len + n) cap *= 2;
+        char *out = realloc(s->out, cap);
+        if (!out) return -1;
+        s->out = out;
+        s->out_cap = cap;
+    }
+    memcpy(s->out + s->out_len, wire, n);
+    s->out_len += n;
+    return 0;
+}
+
+/* Send what the socket takes without blocking (returns -1 if it broke) */
+static int sub_flush(Subscriber *s) {
+    while (s->out_len > 0) {
+        ssize_t n = send(s->sock, s->out, s->out_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            sub_poll_out(s, 1);
+            return 0;
+        }
+        if (n <= 0) return -1;
+        memmove(s->out, s->out + n, s->out_len - (size_t)n);
+        s->out_len -= (size_t)n;
+    }
+    /* Drained: an idle subscriber keeps no buffer */
+    free(s->out);
+    s->out = NULL;
+    s->out_cap = 0;
+    s->resync_queued = 0;
+    sub_poll_out(s, 0);
+    return 0;
+}
+
+/* Pack this batch's events for one subscriber */
+static void sub_dispatch(Subscriber *s) {
+    Packet pkt;
+    init_packet(&pkt, CMD_WATCH_EVENT, NULL);
+    size_t prefix_len = strlen(s->prefix);
+
+    for (size_t i = 0; i < pending_count; i++) {
+        const WatchEvent *e = &pending[i];
+        if (strcmp(e->user, s->user) != 0 || strncmp(e->name, s->prefix, prefix_len) != 0)
+            continue;
+        char line[FILE_NAME_LEN + MD5_HEX_LEN + 32];
+        int len = snprintf(line, sizeof(line), "%c %llu %s %s\n", e->kind,
+                           (unsigned long long)e->size, e->md5, e->name);
+        if (pkt.data_length + (size_t)len >= MAX_PAYLOAD) {   /* room for a NUL */
+            if (sub_queue(s, &pkt, 0) < 0) s->lost = 1;
+            init_packet(&pkt, CMD_WATCH_EVENT, NULL);
+        }
+        memcpy(pkt.data + pkt.data_length, line, (size_t)len);
+        pkt.data_length += (uint32_t)len;
+    }
+    if (pkt.data_length > 0 && sub_queue(s, &pkt, 0) < 0) s->lost = 1;
+
+    if (s->lost && !s->resync_queued) {
+        init_packet(&pkt, CMD_WATCH_EVENT, "R 0 - *\n");
+        if (sub_queue(s, &pkt, 1) == 0) {
+            s->resync_queued = 1;
+            s->lost = 0;
+        }
+    }
+}
+
+/* Send the pending batch. Also runs on a notifying thread when the batch
+ * fills up, so a broken subscriber is only shut down here; the hub sees the
+ * hangup and frees it. */
+static void dispatch_batch(void) {
+    for (Subscriber *s = subscribers; s; s = s->next) {
+        sub_dispatch(s);
+        if (sub_flush(s) < 0) {
+            s->out_len = 0;
+            shutdown(s->sock, SHUT_RDWR);
+        }
+    }
+    pending_count = 0;
+    batch_due_ms = 0;
+}
+
+static void *hub_thread(void *arg) {
+    UNUSED(arg);
+    struct epoll_event events[64];
+
+    pthread_mutex_lock(&watch_lock);
+    while (!hub_stop) {
+        int timeout = -1;
+        if (batch_due_ms) {
+            uint64_t now = now_ms();
+            timeout = batch_due_ms > now ? (int)(batch_due_ms - now) : 0;
+        }
+        pthread_mutex_unlock(&watch_lock);
+        int n = epoll_wait(epoll_fd, events, 64, timeout);
+        pthread_mutex_lock(&watch_lock);
+        if (n < 0 && errno != EINTR) {
+            log_message("ERROR", "watch: epoll_wait failed");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            Subscriber *s = (Subscriber*)events[i].data.ptr;
+            if (!s) {
+                uint64_t count;
+                ssize_t r = read(wake_fd, &count, sizeof(count));
+                UNUSED(r);
+                continue;
+            }
+            /* Subscribers never send: input, hangup or error ends it */
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) sub_drop(s);
+            else if ((events[i].events & EPOLLOUT) && sub_flush(s) < 0) sub_drop(s);
+        }
+
+        if (batch_due_ms && now_ms() >= batch_due_ms) dispatch_batch();
+    }
+    pthread_mutex_unlock(&watch_lock);
+    return NULL;
+}
+
+int watch_init(void) {
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_fd < 0 || wake_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) < 0 ||
+        pthread_create(&hub_tid, NULL, hub_thread, NULL) != 0) {
+        log_message("ERROR", "watch_init: cannot start the notification hub");
+        if (epoll_fd >= 0) close(epoll_fd);
+        if (wake_fd >= 0) close(wake_fd);
+        epoll_fd = wake_fd = -1;
+        return -1;
+    }
+    hub_running = 1;
+    return 0;
+}
+
+void watch_shutdown(void) {
+    if (!hub_running) return;
+    hub_stop = 1;
+    wake_hub();
+    pthread_join(hub_tid, NULL);
+    hub_running = 0;
+
+    pthread_mutex_lock(&watch_lock);
+    while (subscribers) sub_drop(subscribers);
+    pending_count = 0;
+    batch_due_ms = 0;
+    pthread_mutex_unlock(&watch_lock);
+    close(epoll_fd);
+    close(wake_fd);
+    epoll_fd = wake_fd = -1;
+}
+
+int watch_wanted(const char *user) {
+    if (subscriber_count == 0) return 0;
+    int found = 0;
+    pthread_mutex_lock(&watch_lock);
+    for (Subscriber *s = subscribers; s && !found; s = s->next)
+        found = strcmp(s->user, user) == 0;
+    pthread_mutex_unlock(&watch_lock);
+    return found;
+}
+
+/* Fold a change into the pending batch (under watch_lock). A file created and deleted within
+ * one batch never shows up; one deleted and recreated is an overwrite. */
+static void add_event(const WatchEvent *ev) {
+    for (size_t i = 0; i < pending_count; i++) {
+        WatchEvent *e = &pending[i];
+        if (strcmp(e->name, ev->name) != 0 || strcmp(e->user, ev->user) != 0) continue;
+        char first = e->kind;
+        if (first == WATCH_UPLOAD && ev->kind == WATCH_DELETE) {
+            pending[i] = pending[--pending_count];
+            return;
+        }
+        *e = *ev;
+        if (first == WATCH_UPLOAD) e->kind = WATCH_UPLOAD;
+        else if (first == WATCH_DELETE && ev->kind == WATCH_UPLOAD) e->kind = WATCH_OVERWRITE;
+        return;
+    }
+
+    /* A full batch goes out now rather than waiting out its window */
+    if (pending_count == WATCH_MAX_PENDING) dispatch_batch();
+    pending[pending_count++] = *ev;
+}
+
+void watch_notify(const char *user, const char *filename, WatchKind kind, uint64_t size,
+                  const char *md5_hex) {
+    if (!hub_running || !watch_wanted(user)) return;
+
+    WatchEvent ev;
+    memset(&ev, 0, sizeof(ev));
+    strncpy(ev.user, user, USERNAME_LEN - 1);
+    strncpy(ev.name, filename, FILE_NAME_LEN - 1);
+    ev.kind = (char)kind;
+    ev.size = kind == WATCH_DELETE ? 0 : size;
+    strncpy(ev.md5, kind != WATCH_DELETE && md5_hex ? md5_hex : "-", MD5_HEX_LEN - 1);
+
+    pthread_mutex_lock(&watch_lock);
+    add_event(&ev);
+    if (!batch_due_ms && pending_count > 0) {
+        batch_due_ms = now_ms() + WATCH_BATCH_MS;
+        wake_hub();
+    }
+    pthread_mutex_unlock(&watch_lock);
+}
+
+void watch_subscribe(int sockfd, const char *data) {
+    Packet resp;
+    char user[USERNAME_LEN] = {0};
+    const char *colon = strchr(data, ':');
+    size_t user_len = colon ? (size_t)(colon - data) : strlen(data);
+    if (!hub_running || user_len == 0 || user_len >= sizeof(user)) {
+        init_packet(&resp, CMD_ERROR, hub_running ? "WATCH_BAD_REQUEST" : "WATCH_UNAVAILABLE");
+        send_packet(sockfd, &resp);
+        close(sockfd);
+        return;
+    }
+    memcpy(user, data, user_len);
+
+    Subscriber *s = calloc(1, sizeof(Subscriber));
+    if (!s) {
+        init_packet(&resp, CMD_ERROR, "WATCH_FAIL");
+        send_packet(sockfd, &resp);
+        close(sockfd);
+        return;
+    }
+    s->sock = sockfd;
+    memcpy(s->user, user, sizeof(user));
+    if (colon) strncpy(s->prefix, colon + 1, WATCH_PREFIX_LEN - 1);
+
+    /* Keepalive lets the kernel notice a peer that vanished silently */
+    int on = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+
+    /* ACK before registering, so no event can overtake it */
+    init_packet(&resp, CMD_ACK, "WATCHING");
+    if (send_packet(sockfd, &resp) < 0) {
+        close(sockfd);
+        free(s);
+        return;
+    }
+
+    pthread_mutex_lock(&watch_lock);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = s };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sockfd, &ev) < 0) {
+        pthread_mutex_unlock(&watch_lock);
+        close(sockfd);
+        free(s);
+        log_message("ERROR", "watch_subscribe: epoll_ctl failed");
+        return;
+    }
+    s->next = subscribers;
+    subscribers = s;
+    subscriber_count++;
+    pthread_mutex_unlock(&watch_lock);
+
+    /* s belongs to the hub now */
+    char msg[USERNAME_LEN + FILE_NAME_LEN + 64];
+    snprintf(msg, sizeof(msg), "Watching %s/%s* for FD=%d", user, colon ? colon + 1 : "", sockfd);
+    log_message("INFO", msg);
+}
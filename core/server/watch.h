@@ -0,0 +1,62 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "../common/common.h"
+
+/*
+ * Change notifications (CMD_WATCH). A client that sends CMD_WATCH
+ * "user:prefix" gets ACK "WATCHING", and from then on the connection only
+ * carries CMD_WATCH_EVENT packets, one line per change to a file of that
+ * user whose name starts with prefix:
+ *
+ *   U <size> <md5> <name>     new file
+ *   O <size> <md5> <name>     overwritten
+ *   D 0 - <name>              deleted
+ *   R 0 - *                   events were dropped: rescan
+ *
+ * The MD5 is "-" for an upload that began before the watch did.
+ *
+ * Watched connections leave their client thread: one hub thread holds
+ * every subscriber socket in an epoll set and only wakes for a change,
+ * a subscriber that can take more data, or one that went away, so an
+ * idle subscriber costs a socket and a small record. Changes are
+ * collected for WATCH_BATCH_MS after the first one (or until
+ * WATCH_MAX_PENDING distinct files changed), repeated changes to the same
+ * file within that window are merged into one event, and each subscriber
+ * gets the batch packed into as few packets as fit.
+ *
+ * Sends never block the hub. A subscriber that stops reading queues up to
+ * WATCH_MAX_BACKLOG bytes; past that its events are dropped and it gets a
+ * single R line instead. Sending anything on the connection, or closing
+ * it, ends the subscription.
+ */
+
+#define WATCH_BATCH_MS     50
+#define WATCH_MAX_PENDING  1024           /* merged events per batch */
+#define WATCH_MAX_BACKLOG  (256 * 1024)   /* unsent bytes per subscriber */
+
+typedef enum {
+    WATCH_UPLOAD    = 'U',
+    WATCH_OVERWRITE = 'O',
+    WATCH_DELETE    = 'D'
+} WatchKind;
+
+/* Start/stop the hub thread (stop closes every subscription) */
+int watch_init(void);
+void watch_shutdown(void);
+
+/* Whether anyone is watching user (cheap when nobody watches at all) */
+int watch_wanted(const char *user);
+
+/* Note a committed change with the size and MD5 hex of the new content
+ * (ignored for deletes). Writers work the MD5 out while the data streams
+ * in, only when watch_wanted(user); "-" or NULL if it is not known. */
+void watch_notify(const char *user, const char *filename, WatchKind kind, uint64_t size,
+                  const char *md5_hex);
+
+/* Take over sockfd as a subscription to "user:prefix": answers ACK (or
+ * an error) and hands the socket to the hub, which closes it when the
+ * subscription ends. Call with the connection's session unregistered. */
+void watch_subscribe(int sockfd, const char *data);
+
+#endif /* WATCH_H */